@@ -1,17 +1,48 @@
 #include "hash-visitor.h"
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/Mangle.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/CodeGen/BackendUtil.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Lex/HeaderSearch.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 #include <utime.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include "Hash.h"
+#include "command-line.h"
+#include "decl-table.h"
+#include "frontend-options.h"
+#include "object-cache.h"
+#include "semantic-deps.h"
+#include "stats-log.h"
 
 using namespace clang;
 using namespace llvm;
@@ -29,6 +60,104 @@ static char *hash_new = NULL;
 
 static char const *objectfile = NULL;
 static char *objectfile_copy = NULL;
+static char *statsfile = NULL;
+static std::string *recorded_diagnostics = nullptr;
+static StatsRecord *stats_record = nullptr;
+
+// Speculative code generation: the cache lookup runs next to the
+// backend. The lookup thread only finds the cached object
+// (speculation_copy); the main thread takes it at the next checkpoint
+// of the backend, unless the backend has finished before
+// (speculation_decided).
+static std::mutex decision_mutex;
+static bool speculation_decided = false;
+static std::thread *speculation_thread = nullptr;
+static std::string *speculation_copy = nullptr;
+static std::function<void(const std::string &)> *speculation_hit = nullptr;
+
+/// Takes a hit of the lookup thread on the main thread, where the
+/// backend is not writing its output in the meantime
+static void take_speculative_hit() {
+  std::string Copy;
+  {
+    std::lock_guard<std::mutex> Lock(decision_mutex);
+    if (speculation_decided || speculation_copy == nullptr)
+      return;
+    Copy = *speculation_copy;
+  }
+  // Returns only, if the hit cannot be taken
+  (*speculation_hit)(Copy);
+}
+
+/// A checkpoint between the functions of the optimization passes.
+/// The code generation has none, so a hit during the code generation
+/// is only taken, if it came before.
+struct SpeculationCheckpoint : public FunctionPass {
+  static char ID;
+  SpeculationCheckpoint() : FunctionPass(ID) {}
+
+  bool runOnFunction(llvm::Function &) override {
+    take_speculative_hit();
+    return false;
+  }
+};
+char SpeculationCheckpoint::ID = 0;
+
+static void addSpeculationCheckpoint(const PassManagerBuilder &,
+                                     legacy::PassManagerBase &PM) {
+  if (speculation_hit != nullptr)
+    PM.add(new SpeculationCheckpoint());
+}
+
+static RegisterStandardPasses CheckpointEarly(
+    PassManagerBuilder::EP_EarlyAsPossible, addSpeculationCheckpoint);
+static RegisterStandardPasses CheckpointScalar(
+    PassManagerBuilder::EP_ScalarOptimizerLate, addSpeculationCheckpoint);
+static RegisterStandardPasses CheckpointLast(
+    PassManagerBuilder::EP_OptimizerLast, addSpeculationCheckpoint);
+static RegisterStandardPasses CheckpointO0(
+    PassManagerBuilder::EP_EnabledOnOptLevel0, addSpeculationCheckpoint);
+
+// Bitcode cache: the frontend output of a miss is written there
+static char *bitcode_file = nullptr;
+
+/// Writes the module, as the frontend generated it, to the bitcode
+/// cache. The function passes are initialized with the module before
+/// any pass runs, at every optimization level.
+struct BitcodeCapture : public FunctionPass {
+  static char ID;
+  BitcodeCapture() : FunctionPass(ID) {}
+
+  bool doInitialization(llvm::Module &M) override {
+    const std::string Temporary =
+        std::string(bitcode_file) + ".tmp." + std::to_string(getpid());
+    std::error_code EC;
+    {
+      raw_fd_ostream Out(Temporary, EC, sys::fs::F_None);
+      if (EC)
+        return false;
+#if LLVM_VERSION_MAJOR >= 7
+      WriteBitcodeToFile(M, Out);
+#else
+      WriteBitcodeToFile(&M, Out);
+#endif
+    }
+    if (rename(Temporary.c_str(), bitcode_file) != 0)
+      unlink(Temporary.c_str());
+    return false;
+  }
+
+  bool runOnFunction(llvm::Function &) override { return false; }
+};
+char BitcodeCapture::ID = 0;
+
+static RegisterStandardPasses
+    RegisterBitcodeCapture(PassManagerBuilder::EP_EarlyAsPossible,
+                           [](const PassManagerBuilder &,
+                              legacy::PassManagerBase &PM) {
+                             if (bitcode_file != nullptr)
+                               PM.add(new BitcodeCapture());
+                           });
 
 static void link_object_file() {
   if (atexit_mode == ATEXIT_NOP) {
@@ -69,6 +198,18 @@ static void link_object_file() {
     return;
   }
 
+  const auto CompileTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::high_resolution_clock::now() - StartCompilation).count();
+
+  // The diagnostics and the compile time are in place before the object
+  // becomes visible
+  if (atexit_mode == ATEXIT_TO_CACHE && recorded_diagnostics != nullptr) {
+    ObjectCache<raw_ostream>::store_diagnostics(dst, *recorded_diagnostics);
+  }
+  if (atexit_mode == ATEXIT_TO_CACHE) {
+    ObjectCache<raw_ostream>::store_duration(dst, CompileTime);
+  }
+
   // Copy by hardlink
   if (link(src, dst) != 0) {
     perror("clang-hash: objectfile update failed");
@@ -82,77 +223,184 @@ static void link_object_file() {
       fwrite(hash_new, strlen(hash_new), 1, f);
       fclose(f);
     }
+    if (statsfile != NULL) {
+      ObjectCache<raw_ostream>::record_store(statsfile, dst);
+    }
+    ObjectCache<raw_ostream>::from_environment(nullptr).upload(hash_new);
   } else if (atexit_mode == ATEXIT_FROM_CACHE) {
     // Update Timestamp
     utime(dst, NULL);
   }
+
+  if (stats_record != nullptr) {
+    stats_record->m_time = StatsRecord::now_ns();
+    stats_record->m_compile_time = CompileTime;
+    if (stat(dst, &dummy) == 0) {
+      stats_record->m_object_size = dummy.st_size;
+    }
+    stats_record->append(StatsRecord::log_filename());
+  }
 }
 
-struct ObjectCache {
-  std::string m_cachedir;
-  raw_ostream *m_terminal;
+/// Forwards all diagnostics to the consumer of the compiler and
+/// records their text, as a later hit replays them.
+class DiagnosticRecorder : public DiagnosticConsumer {
+public:
+  DiagnosticRecorder(CompilerInstance &CI, std::string &Text)
+      : Owner(CI.getDiagnostics().takeClient()),
+        Client(CI.getDiagnostics().getClient()), Stream(Text),
+        Printer(Stream, &CI.getDiagnosticOpts()) {
+    // The source file is already open, and the summary of the compiler
+    // counts the diagnostics from the start
+    Printer.BeginSourceFile(CI.getLangOpts(), &CI.getPreprocessor());
+    NumWarnings = Client->getNumWarnings();
+    NumErrors = Client->getNumErrors();
+  }
 
-  ObjectCache(std::string cachedir, raw_ostream *Terminal)
-      : m_cachedir(cachedir), m_terminal(Terminal) {}
+  void BeginSourceFile(const LangOptions &LangOpts,
+                       const Preprocessor *PP) override {
+    Client->BeginSourceFile(LangOpts, PP);
+    Printer.BeginSourceFile(LangOpts, PP);
+  }
 
-  char *hash_filename(std::string objectfile) {
-    if (m_cachedir == "") {
-      std::string path(objectfile + ".hash");
-      return strdup(path.c_str());
-    }
-    return NULL;
+  void EndSourceFile() override {
+    Client->EndSourceFile();
+    Printer.EndSourceFile();
+    Stream.flush();
+  }
+
+  void finish() override {
+    Client->finish();
+    Printer.finish();
+    Stream.flush();
+  }
+
+  bool IncludeInDiagnosticCounts() const override {
+    return Client->IncludeInDiagnosticCounts();
   }
 
-  char *objectcopy_filename(std::string objectfile, std::string hash) {
-    if (m_cachedir == "") {
-      std::string path(objectfile + ".hash.copy");
-      return strdup(path.c_str());
+  void HandleDiagnostic(DiagnosticsEngine::Level Level,
+                        const Diagnostic &Info) override {
+    // A speculative hit replays the diagnostics that were not emitted
+    std::lock_guard<std::mutex> Lock(decision_mutex);
+    DiagnosticConsumer::HandleDiagnostic(Level, Info);
+    Client->HandleDiagnostic(Level, Info);
+    Printer.HandleDiagnostic(Level, Info);
+    // The compiler may exit without destroying its consumers
+    Stream.flush();
+  }
+
+private:
+  std::unique_ptr<DiagnosticConsumer> Owner;
+  DiagnosticConsumer *Client;
+  raw_string_ostream Stream;
+  TextDiagnosticPrinter Printer;
+};
+
+/// The main file ends after the backend has finished. From then on, a
+/// speculative hit no longer stops the compiler, its output is kept.
+class SpeculationBarrier : public PPCallbacks {
+public:
+  SpeculationBarrier(raw_ostream *Terminal) : Terminal(Terminal) {}
+
+  void EndOfMainFile() override {
+    bool Taken;
+    {
+      std::lock_guard<std::mutex> Lock(decision_mutex);
+      Taken = speculation_decided;
+      speculation_decided = true;
     }
-    std::string dir(m_cachedir + "/" + hash.substr(0, 2));
-    mkdir(dir.c_str(), 0755);
-    std::string path(dir + "/" + hash.substr(2) + ".o");
-    return strdup(path.c_str());
+    if (Taken)
+      return;
+    speculation_thread->join();
+    if (Terminal)
+      *Terminal << "skipped:0\n";
+    if (speculation_copy != nullptr)
+      stats_record->set_reason({"in the cache after the backend"});
   }
 
-  std::string find_object_from_hash(std::string objectfile, std::string hash) {
-    if (m_cachedir != "") {
-      std::string ObjectPath(m_cachedir + "/" + hash.substr(0, 2) + "/" +
-                             hash.substr(2) + ".o");
-      struct stat dummy;
-      if (stat(ObjectPath.c_str(), &dummy) == 0) {
-        // Found!
-        return ObjectPath;
-      }
-      return "";
-    } else {
-      std::string OldHash;
-      std::string HashPath(objectfile + ".hash");
-      std::string ObjectPath(objectfile + ".hash.copy");
-      std::ifstream FileStream(HashPath);
-      if (FileStream.good()) {
-        getline(FileStream, OldHash);
-        if (m_terminal) {
-          (*m_terminal) << HashPath << ": old hash string: " << OldHash << "\n";
-        }
-      } else {
-        if (m_terminal) {
-          (*m_terminal) << "Warning: could not open file \"" << HashPath
-                        << "\", cannot read previous hash.\n";
-        }
-        return "";
-      }
+private:
+  raw_ostream *Terminal;
+};
 
-      // Hashes are equal, try to find the objectfile
-      if (hash == OldHash) {
-        struct stat dummy;
-        if (stat(ObjectPath.c_str(), &dummy) == 0) {
-          // Found!
-          return ObjectPath;
-        }
-      }
-      return "";
+/// Records the files whose preprocessor directives influence the
+/// translation unit: the definitions of the macros that were expanded
+/// or tested, and conditionals other than include guards.
+class DependencyRecorder : public PPCallbacks {
+public:
+  DependencyRecorder(const SourceManager &SM) : SM(SM) {}
+
+  void MacroExpands(const Token &, const MacroDefinition &MD, SourceRange,
+                    const MacroArgs *) override {
+    addDefinition(MD);
+  }
+
+  void Defined(const Token &, const MacroDefinition &MD,
+               SourceRange) override {
+    addDefinition(MD);
+  }
+
+  void MacroUndefined(const Token &, const MacroDefinition &MD,
+                      const MacroDirective *Undef) override {
+    if (MD && Undef)
+      addFile(Undef->getLocation());
+  }
+
+  void If(SourceLocation Loc, SourceRange, ConditionValueKind) override {
+    addFile(Loc);
+  }
+
+  void Elif(SourceLocation Loc, SourceRange, ConditionValueKind,
+            SourceLocation) override {
+    addFile(Loc);
+  }
+
+  void Ifdef(SourceLocation Loc, const Token &,
+             const MacroDefinition &MD) override {
+    addDefinition(MD);
+    addFile(Loc);
+  }
+
+  void Ifndef(SourceLocation Loc, const Token &MacroNameTok,
+              const MacroDefinition &MD) override {
+    addDefinition(MD);
+    // Include guards are only known at the end of their header
+    if (MD)
+      addFile(Loc);
+    else
+      Guards.emplace_back(getFile(Loc), MacroNameTok.getIdentifierInfo());
+  }
+
+  /// Adds the recorded files to Files
+  void getFiles(HeaderSearch &HS, llvm::DenseSet<FileID> &Files) const {
+    Files.insert(Directives.begin(), Directives.end());
+    for (const auto &Guard : Guards) {
+      const FileEntry *FE = SM.getFileEntryForID(Guard.first);
+      if (!FE || HS.getFileInfo(FE).ControllingMacro != Guard.second)
+        Files.insert(Guard.first);
     }
   }
+
+private:
+  FileID getFile(SourceLocation Loc) const {
+    return SM.getFileID(SM.getExpansionLoc(Loc));
+  }
+
+  void addFile(SourceLocation Loc) {
+    if (Loc.isValid())
+      Directives.insert(getFile(Loc));
+  }
+
+  void addDefinition(const MacroDefinition &MD) {
+    const MacroInfo *MI = MD.getMacroInfo();
+    if (MI && Macros.insert(MI).second)
+      addFile(MI->getDefinitionLoc());
+  }
+
+  const SourceManager &SM;
+  llvm::DenseSet<FileID> Directives;
+  llvm::DenseSet<const MacroInfo *> Macros;
+  std::vector<std::pair<FileID, const IdentifierInfo *>> Guards;
 };
 
 class DefinitionUseVisitor
@@ -212,12 +460,33 @@ public:
 class HashTranslationUnitConsumer : public ASTConsumer {
 public:
   HashTranslationUnitConsumer(CompilerInstance &CI, raw_ostream *OS,
-                              bool StopIfSameHash)
-      : CI(CI), Terminal(OS), StopIfSameHash(StopIfSameHash) {}
+                              bool StopIfSameHash,
+                              DependencyRecorder *Dependencies)
+      : CI(CI), Terminal(OS), StopIfSameHash(StopIfSameHash),
+        Dependencies(Dependencies) {}
 
     typedef llvm::MurMur3 Hash;
     typedef llvm::MurMur3::Digest HashResult;
 
+  void Initialize(ASTContext &Context) override {
+    TopLevelVisitor.reset(new CHashVisitor<Hash, HashResult>(Context));
+    if (Dependencies)
+      TopLevelVisitor->trackFiles();
+    HashThreads = hashThreads(Context);
+  }
+
+  /// The top-level declarations are hashed while the parser continues
+  /// with the next ones, so that a hit only waits for the final combine
+  bool HandleTopLevelDecl(DeclGroupRef DG) override {
+    if (HashThreads > 1 || CI.getDiagnostics().hasErrorOccurred())
+      return true;
+    const auto Start = std::chrono::high_resolution_clock::now();
+    for (Decl *D : DG)
+      TopLevelVisitor->hashTopLevelDecl(D);
+    StreamedHashing += std::chrono::high_resolution_clock::now() - Start;
+    return true;
+  }
+
   virtual void HandleTranslationUnit(clang::ASTContext &Context) override {
     /// Step 1: Calculate Hash
     const auto StartHashing = std::chrono::high_resolution_clock::now();
@@ -225,8 +494,11 @@ public:
     TranslationUnitDecl *TU = Context.getTranslationUnitDecl();
 
     // Traversing the translation unit decl via a RecursiveASTVisitor
-    // will visit all nodes in the AST.
-    CHashVisitor<Hash, HashResult> Visitor(Context);
+    // will visit all nodes in the AST. Only the declarations that were
+    // not streamed are hashed now.
+    CHashVisitor<Hash, HashResult> &Visitor = *TopLevelVisitor;
+    if (HashThreads > 1 && !CI.getDiagnostics().hasErrorOccurred())
+      hashInParallel(TU, Visitor);
     Visitor.TraverseDecl(TU);
 
     unsigned ProcessedBytes;
@@ -236,7 +508,8 @@ public:
     HashResult TUHashResult;
     const HashResult *ASTHash = Visitor.getHash(TU);
     TUHash.update(ASTHash->Bytes);
-    hashCommandLineArguments(TUHash);
+    DeclTable Table;
+    hashCommandLineArguments(TUHash, Table);
 
 
     TUHash.final(TUHashResult);
@@ -244,17 +517,49 @@ public:
     hash_new = strdup(HashString.c_str());
 
     const auto FinishHashing = std::chrono::high_resolution_clock::now();
+    const long long ParseTime =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            StartHashing - StartCompilation - StreamedHashing).count();
+    const long long HashTime =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            FinishHashing - StartHashing + StreamedHashing).count();
+
+    if (Context.getLangOpts().CPlusPlus) {
+      Mangler.reset(Context.createMangleContext());
+    }
 
-    /* Record all uses of interessting definitions for clang-global-hash */
-    DefinitionUseVisitor DefUse;
-    DefUse.TraverseDecl(TU);
+    if (Dependencies && objectfile != nullptr && *objectfile &&
+        !Context.getSourceManager().getDiagnostics().hasErrorOccurred()) {
+      writeSemanticDependencies(Visitor.getFiles());
+    }
+
+    /* The files read by the translation unit, for the direct mode of
+     * chash-collect */
+    if (const char *InputsFile = getenv("CLANG_HASH_INPUTS")) {
+      std::ofstream Inputs(InputsFile);
+      const SourceManager &SM = Context.getSourceManager();
+      for (auto I = SM.fileinfo_begin(), E = SM.fileinfo_end(); I != E; ++I)
+        Inputs << I->first->getName().str() << "\n";
+      // The headers of a precompiled header are not read again, but a
+      // change of them requires a new precompiled header
+      const std::string &PCH = CI.getPreprocessorOpts().ImplicitPCHInclude;
+      if (!PCH.empty())
+        Inputs << PCH << "\n";
+    }
 
-    char *cachedir = getenv("CLANG_HASH_CACHE");
-    ObjectCache cache(cachedir ? cachedir : "", Terminal);
+    ObjectCache<raw_ostream> cache =
+        ObjectCache<raw_ostream>::from_environment(Terminal);
 
     // Step 2: Consequent Handling
+    // With CLANG_HASH_SPECULATE, the code generation does not wait for
+    // the lookup; it is decided in the background (see speculate())
+    const bool Speculate =
+        StopIfSameHash && objectfile != nullptr && *objectfile &&
+        std::string(objectfile) != "-" && isEnabled("CLANG_HASH_SPECULATE") &&
+        !Context.getSourceManager().getDiagnostics().hasErrorOccurred();
     bool HashEqual;
-    if (Context.getSourceManager().getDiagnostics().hasErrorOccurred()) {
+    if (Context.getSourceManager().getDiagnostics().hasErrorOccurred() ||
+        Speculate) {
       HashEqual = false;
     } else {
       if (objectfile == nullptr) {
@@ -271,6 +576,19 @@ public:
       }
     }
 
+    // With CLANG_HASH_BITCODE, a miss may reuse the frontend output of a
+    // compilation with other backend options (see reuseBitcode())
+    ObjectCache<raw_ostream> BitcodeCache =
+        ObjectCache<raw_ostream>::from_environment(Terminal, "bc");
+    std::string FrontendHash;
+    if (StopIfSameHash && objectfile != nullptr && *objectfile &&
+        !Speculate && isEnabled("CLANG_HASH_BITCODE") &&
+        BitcodeCache.has_cachedir() &&
+        CI.getFrontendOpts().ProgramAction == frontend::EmitObj &&
+        !Context.getSourceManager().getDiagnostics().hasErrorOccurred()) {
+      FrontendHash = frontendHash(*ASTHash);
+    }
+
     // Step 2.1: -hash-verbose
     // Sometimes we do terminal output
     if (Terminal) {
@@ -278,100 +596,49 @@ public:
                 << std::chrono::duration_cast<std::chrono::nanoseconds>(
                        StartHashing.time_since_epoch()).count() << "\n";
       *Terminal << "top-level-hash: " << HashString << "\n";
+      if (FrontendHash != "")
+        *Terminal << "frontend-hash: " << FrontendHash << "\n";
       *Terminal << "processed-bytes: " << ProcessedBytes << "\n";
-      *Terminal << "parse-time-ns: "
-                << std::chrono::duration_cast<std::chrono::nanoseconds>(
-                       StartHashing - StartCompilation).count() << "\n";
-      *Terminal << "hash-time-ns: "
-                << std::chrono::duration_cast<std::chrono::nanoseconds>(
-                       FinishHashing - StartHashing).count() << "\n";
+      *Terminal << "parse-time-ns: " << ParseTime << "\n";
+      *Terminal << "hash-time-ns: " << HashTime << "\n";
+
+      /* Record all uses of interessting definitions for clang-global-hash */
+      DefinitionUseVisitor DefUse;
+      DefUse.TraverseDecl(TU);
       *Terminal << "element-hashes: [";
       for (const auto &SavedHash : Visitor.DeclSilo) {
         const Decl *D = SavedHash.first;
         const HashResult &Dig = SavedHash.second;
         // Only Top-level declarations
-        if (D->getDeclContext() &&
-            isa<TranslationUnitDecl>(D->getDeclContext()) &&
-            isa<NamedDecl>(D)) {
-          const bool IsFunctionDefinition =
-              isa<FunctionDecl>(D) &&
-              cast<FunctionDecl>(D)->isThisDeclarationADefinition();
-          const bool IsNonExternVariableDeclaration =
-              isa<VarDecl>(D) && !cast<VarDecl>(D)->hasExternalStorage();
-
-          bool AppendFilename = false;
-          if (IsFunctionDefinition) { // Ignore declarations without definition
-            if (cast<FunctionDecl>(D)->getStorageClass() == SC_Static) {
-              *Terminal << "(\"static function:";
-              AppendFilename = true;
-            } else {
-              *Terminal << "(\"function:";
-            }
-          } else if (IsNonExternVariableDeclaration) { // Ignore extern
-                                                       // variables
-            if (cast<VarDecl>(D)->getStorageClass() == SC_Static) {
-              *Terminal << "(\"static variable:";
-              AppendFilename = true;
-            } else {
-              *Terminal << "(\"variable:";
-            }
-          } else if (isa<RecordDecl>(D)) {
-            *Terminal << "(\"record:";
-            AppendFilename = true;
-          } else
-            continue;
-
-          if (cast<NamedDecl>(D)->getName() != "") {
-            *Terminal << cast<NamedDecl>(D)->getName();
-          } else if (auto TD = cast<TypeDecl>(D)) {
-            // If the name is empty, use the typedef'ed name (or the generic
-            // identifier provided by the compiler).
-            // This happens e.g. when a struct is unnamed (and may or may not be
-            // typedef'ed at definition).
-            *Terminal << TD->getTypeForDecl()
-                             ->getCanonicalTypeInternal()
-                             .getAsString();
-          }
-          if (AppendFilename) {
-            // Append the filename to the symbol's name
-            const auto Filename =
-                CI.getSourceManager().getFilename(D->getLocation());
-            *Terminal << ":" << (Filename.startswith("./")
-                                     ? Filename.slice(2, Filename.size())
-                                     : Filename);
-          }
-          *Terminal << "\", \"";
+        const std::string Name = getElementName(D);
+        if (Name != "") {
+          *Terminal << "(\"" << Name << "\", \"";
           *Terminal << Dig.digest().str();
           *Terminal << "\"";
 
-          if (IsFunctionDefinition || IsNonExternVariableDeclaration) {
+          if (!isa<RecordDecl>(D)) {
             *Terminal << ", [";
             for (const auto &SavedCallee : DefUse.DefUseSilo[cast<Decl>(D)]) {
               // TODO: also dump records? could be forward-declarated?!
               bool AppendFilename = false;
               if (isa<FunctionDecl>(SavedCallee)) {
-                if (cast<FunctionDecl>(SavedCallee)->getStorageClass() ==
-                    SC_Static) {
+                if (hasInternalLinkage(cast<FunctionDecl>(SavedCallee))) {
                   *Terminal << "\"static function:";
                   AppendFilename = true;
                 } else
                   *Terminal << "\"function:";
               } else {
-                if (cast<VarDecl>(SavedCallee)->getStorageClass() ==
-                    SC_Static) {
+                if (hasInternalLinkage(cast<VarDecl>(SavedCallee))) {
                   *Terminal << "\"static variable:";
                   AppendFilename = true;
                 } else
                   *Terminal << "\"variable:";
               }
-              *Terminal << cast<NamedDecl>(SavedCallee)->getName();
+              *Terminal << getSymbolName(cast<NamedDecl>(SavedCallee));
               if (AppendFilename) {
                 // Append the filename to the symbol's name
-                const auto Filename = CI.getSourceManager().getFilename(
-                    SavedCallee->getLocation());
-                *Terminal << ":" << (Filename.startswith("./")
-                                         ? Filename.slice(2, Filename.size())
-                                         : Filename);
+                *Terminal << ":"
+                          << getElementFilename(SavedCallee->getLocation());
               }
               *Terminal << "\", ";
             }
@@ -382,78 +649,432 @@ public:
         }
       }
       *Terminal << "]\n";
-      *Terminal << "hash-equal:" << HashEqual << "\n";
-      *Terminal << "skipped:" << (HashEqual && StopIfSameHash) << "\n";
+      if (!Speculate) {
+        *Terminal << "hash-equal:" << HashEqual << "\n";
+        *Terminal << "skipped:" << (HashEqual && StopIfSameHash) << "\n";
+      }
+    }
+
+    std::vector<std::string> MissReasons;
+    if (StopIfSameHash && objectfile != nullptr && *objectfile &&
+        !Context.getSourceManager().getDiagnostics().hasErrorOccurred()) {
+      // Explain a miss by the differences to the last compilation
+      Table.m_hash = HashString;
+      Table.add(DeclTable::unit_name(), ASTHash->digest().str());
+      for (const auto &SavedHash : Visitor.DeclSilo) {
+        const std::string Name = getElementName(SavedHash.first);
+        if (Name != "") {
+          const SourceLocation Loc = CI.getSourceManager().getExpansionLoc(
+              SavedHash.first->getLocation());
+          Table.add(Name, SavedHash.second.digest().str(),
+                    getElementFilename(Loc));
+        }
+      }
+      if (!Speculate)
+        MissReasons = Table.update(objectfile, !HashEqual, Terminal);
     }
 
     if (StopIfSameHash && objectfile != nullptr) {
       // We are in caching mode and there should be an objectfile
       atexit(link_object_file);
+      stats_record = new StatsRecord();
+      stats_record->set_objectfile(objectfile);
+      stats_record->m_parse_time = ParseTime;
+      stats_record->m_hash_time = HashTime;
       if (HashEqual) {
+        stats_record->m_event = 'H';
+        stats_record->m_saved_time =
+            ObjectCache<raw_ostream>::read_duration(objectfile_copy);
+        cache.record_hit(HashString);
+        // The frontend diagnostics were just emitted again, the ones of
+        // the backend come from the cache
+        errs() << ObjectCache<raw_ostream>::read_diagnostics(objectfile_copy);
         CI.clearOutputFiles(true);
         atexit_mode = ATEXIT_FROM_CACHE;
         exit(0);
       } else {
         hashfile = cache.hash_filename(objectfile);
         objectfile_copy = cache.objectcopy_filename(objectfile, HashString);
+        if (cache.stats_filename(HashString) != "") {
+          statsfile = strdup(cache.stats_filename(HashString).c_str());
+        }
         atexit_mode = ATEXIT_TO_CACHE;
+        stats_record->set_reason(MissReasons);
+        // Record the diagnostics of the backend for the cache entry
+        recorded_diagnostics = new std::string();
+        CI.getDiagnostics().setClient(
+            new DiagnosticRecorder(CI, *recorded_diagnostics), true);
+        if (FrontendHash != "")
+          reuseBitcode(BitcodeCache, FrontendHash);
+        if (Speculate)
+          speculate(cache, HashString, Table);
         // Continue with compilation
       }
     }
   }
 
 private:
-  // Returns true if the -stop-if-same-hash flag is set, else false.
-  void hashCommandLineArguments(Hash &TUHash) {
-    // Get command line arguments
-    const std::string PPID{std::to_string(getppid())};
-    const std::string FilePath = "/proc/" + PPID + "/cmdline";
-    std::ifstream CommandLine{FilePath};
-    if (CommandLine.good()) { // TODO: move this to own method?
-      std::list<std::string> CommandLineArgs;
-      std::string Arg;
-      do {
-        getline(CommandLine, Arg, '\0');
-        if ("-o" == Arg) {
-          // throw away next parameter (name of outfile)
-          getline(CommandLine, Arg, '\0');
-          continue;
-        }
-        if (Arg.size() > 2 && Arg.compare(Arg.size() - 2, 2, ".c") == 0)
-          continue;
-        if (Arg.size() > 2 && Arg.compare(Arg.size() - 2, 2, ".i") == 0)
-          continue;
+  static bool isEnabled(const char *Name) {
+    const char *Value = getenv(Name);
+    return Value && *Value && std::string(Value) != "0";
+  }
 
-        if (Arg.find("-stop-if-same-hash") != std::string::npos) {
-          continue; // also don't hash this (plugin argument)
-        }
-        if (Arg == "-I") {
-          // throw away next parameter (include path)
-          getline(CommandLine, Arg, '\0');
-          continue;
-        }
-        if (Arg.substr(0, 2) == "-I") {
-          continue; // also don't hash include paths
-        }
-        if (Arg.substr(0, 2) == "-D") {
-          continue; // also don't hash macro defines
-        }
-        if (Arg.find("-hash-verbose") != std::string::npos) {
-          continue; // also don't hash this (plugin argument)
-        }
+  /// Speculative code generation: the compiler is prepared for a miss
+  /// and continues, while a thread looks up the hash. On a hit, the
+  /// main thread stops the backend at its next checkpoint (see
+  /// SpeculationCheckpoint), replays the diagnostics of the backend that
+  /// were not emitted yet, removes the unfinished output and exits as
+  /// on a hit before the backend. Later, the output of the backend is
+  /// kept and stored as on a miss.
+  void speculate(ObjectCache<raw_ostream> Cache, std::string HashString,
+                 DeclTable Table) {
+    CI.getPreprocessor().addPPCallbacks(
+        llvm::make_unique<SpeculationBarrier>(Terminal));
+    CompilerInstance &CI = this->CI;
+    raw_ostream *Terminal = this->Terminal;
+    speculation_hit = new std::function<void(const std::string &)>(
+        [&CI, Cache, HashString, Terminal](const std::string &Copy) mutable {
+          // A compilation with errors must not end as a hit
+          if (CI.getDiagnostics().hasErrorOccurred())
+            return;
+          {
+            std::lock_guard<std::mutex> Lock(decision_mutex);
+            speculation_decided = true;
+          }
+          speculation_thread->join();
+          if (Terminal)
+            *Terminal << "skipped:1\n";
+          stats_record->m_event = 'H';
+          stats_record->m_saved_time =
+              ObjectCache<raw_ostream>::read_duration(Copy);
+          Cache.record_hit(HashString);
+          const std::string Cached =
+              ObjectCache<raw_ostream>::read_diagnostics(Copy);
+          const std::string &Emitted = *recorded_diagnostics;
+          if (Cached.compare(0, Emitted.size(), Emitted) == 0)
+            errs() << Cached.substr(Emitted.size());
+          else
+            errs() << Cached;
+          CI.clearOutputFiles(true);
+          objectfile_copy = strdup(Copy.c_str());
+          atexit_mode = ATEXIT_FROM_CACHE;
+          exit(0);
+        });
+    speculation_thread = new std::thread([=]() mutable {
+      const std::string Copy =
+          Cache.find_object_from_hash(objectfile, HashString);
+      std::lock_guard<std::mutex> Lock(decision_mutex);
+      if (Terminal)
+        *Terminal << "hash-equal:" << (Copy != "") << "\n";
+      const std::vector<std::string> MissReasons =
+          Table.update(objectfile, Copy == "", Terminal);
+      if (Copy == "")
+        stats_record->set_reason(MissReasons);
+      else
+        speculation_copy = new std::string(Copy);
+    });
+  }
 
-        TUHash.update(Arg);
-      } while (Arg.size());
+  /// The element-hashes list contains only top-level declarations. For
+  /// C++, functions and variables within namespaces and classes are
+  /// also top-level symbols, as long as they are no template patterns.
+  bool isElementDecl(const Decl *D) const {
+    const DeclContext *DC = D->getDeclContext();
+    if (!DC || !isa<NamedDecl>(D))
+      return false;
+    if (!CI.getLangOpts().CPlusPlus)
+      return isa<TranslationUnitDecl>(DC);
+
+    if (DC->isDependentContext())
+      return false;
+    if (isa<RecordDecl>(D)) {
+      // Instantiations share the name of their template
+      return isa<TranslationUnitDecl>(DC->getRedeclContext()) &&
+             !isa<ClassTemplateSpecializationDecl>(D);
+    }
+    if (const auto *FD = dyn_cast<FunctionDecl>(D))
+      return !FD->isDependentContext();
+    if (const auto *VD = dyn_cast<VarDecl>(D)) {
+      return (VD->isFileVarDecl() || VD->isStaticDataMember()) &&
+             !VD->getDescribedVarTemplate() &&
+             !isa<VarTemplatePartialSpecializationDecl>(VD);
+    }
+    return false;
+  }
 
+  /// The name of a top-level element in the element-hashes, or an
+  /// empty string
+  std::string getElementName(const Decl *D) {
+    if (!isElementDecl(D))
+      return "";
+    std::string Name;
+    bool AppendFilename = false;
+    if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+      // Ignore declarations without definition
+      if (!FD->isThisDeclarationADefinition())
+        return "";
+      AppendFilename = hasInternalLinkage(FD);
+      Name = AppendFilename ? "static function:" : "function:";
+    } else if (const auto *VD = dyn_cast<VarDecl>(D)) {
+      // Ignore extern variables
+      if (VD->hasExternalStorage())
+        return "";
+      AppendFilename = hasInternalLinkage(VD);
+      Name = AppendFilename ? "static variable:" : "variable:";
+    } else if (isa<RecordDecl>(D)) {
+      Name = "record:";
+      AppendFilename = true;
+    } else {
+      return "";
+    }
+
+    if (!isa<TypeDecl>(D) || cast<NamedDecl>(D)->getName() != "") {
+      Name += getSymbolName(cast<NamedDecl>(D));
+    } else if (auto TD = cast<TypeDecl>(D)) {
+      // If the name is empty, use the typedef'ed name (or the generic
+      // identifier provided by the compiler).
+      // This happens e.g. when a struct is unnamed (and may or may not be
+      // typedef'ed at definition).
+      Name += TD->getTypeForDecl()->getCanonicalTypeInternal().getAsString();
+    }
+    if (AppendFilename) {
+      // Append the filename to the symbol's name
+      Name += ":" + getElementFilename(D->getLocation());
+    }
+    return Name;
+  }
+
+  /// The filename that is appended to symbols with internal linkage:
+  /// without a leading ./ and relative to CLANG_HASH_BASEDIR
+  std::string getElementFilename(SourceLocation Loc) const {
+    const std::string Filename =
+        relativeToBaseDir(CI.getSourceManager().getFilename(Loc).str());
+    return Filename.compare(0, 2, "./") == 0 ? Filename.substr(2) : Filename;
+  }
+
+  /// Stores the files that influenced the hash in
+  /// <objectfile>.hash.deps and narrows the dependency file of -MD to
+  /// them. Files that include such a file are kept, as their include
+  /// directives matter as well.
+  void writeSemanticDependencies(const llvm::DenseSet<FileID> &DeclFiles) {
+    const SourceManager &SM = CI.getSourceManager();
+    llvm::DenseSet<FileID> Files(DeclFiles);
+    Dependencies->getFiles(CI.getPreprocessor().getHeaderSearchInfo(), Files);
+    Files.insert(SM.getMainFileID());
+    std::vector<FileID> Worklist(Files.begin(), Files.end());
+    while (!Worklist.empty()) {
+      const SourceLocation IncludeLoc = SM.getIncludeLoc(Worklist.back());
+      Worklist.pop_back();
+      if (IncludeLoc.isValid()) {
+        const FileID Includer = SM.getFileID(SM.getExpansionLoc(IncludeLoc));
+        if (Files.insert(Includer).second)
+          Worklist.push_back(Includer);
+      }
+    }
+
+    // In the order of inclusion, like -MD
+    std::vector<FileID> Sorted(Files.begin(), Files.end());
+    std::sort(Sorted.begin(), Sorted.end());
+    const DependencyOutputOptions &DepOpts = CI.getDependencyOutputOpts();
+    SemanticDeps Deps;
+    std::vector<std::string> DepFiles;
+    std::set<std::string> Seen;
+    for (const FileID &FID : Sorted) {
+      const FileEntry *FE = SM.getFileEntryForID(FID);
+      if (!FE || !Seen.insert(FE->getName()).second)
+        continue;
+      SmallString<256> Path(FE->getName());
+      CI.getFileManager().makeAbsolutePath(Path);
+      llvm::sys::path::remove_dots(Path, true);
+      Deps.m_files.push_back(Path.str());
+      if (DepOpts.IncludeSystemHeaders || FID == SM.getMainFileID() ||
+          !SrcMgr::isSystem(SM.getFileCharacteristic(SM.getLocForStartOfFile(FID))))
+        DepFiles.push_back(FE->getName());
+    }
+    Deps.write(SemanticDeps::filename(objectfile));
+
+    if (DepOpts.OutputFile != "" && DepOpts.OutputFile != "-" &&
+        !DepOpts.Targets.empty()) {
+      std::string Targets;
+      for (const std::string &Target : DepOpts.Targets)
+        Targets += (Targets == "" ? "" : " ") + Target;
+      SemanticDeps::write_depfile(DepOpts.OutputFile, Targets, DepFiles,
+                                  DepOpts.UsePhonyTargets);
+    }
+  }
+
+  /// Symbols with internal linkage get the filename appended.
+  bool hasInternalLinkage(const FunctionDecl *FD) const {
+    if (!CI.getLangOpts().CPlusPlus)
+      return FD->getStorageClass() == SC_Static;
+    return !FD->isExternallyVisible();
+  }
+
+  bool hasInternalLinkage(const VarDecl *VD) const {
+    if (!CI.getLangOpts().CPlusPlus)
+      return VD->getStorageClass() == SC_Static;
+    return !VD->isExternallyVisible();
+  }
+
+  /// In C, symbols are named by their identifier. In C++, we use the
+  /// mangled name, since it is unique for overloaded functions and
+  /// does not contain any colons, which separate the record fields.
+  std::string getSymbolName(const NamedDecl *ND) {
+    if (!Mangler || !Mangler->shouldMangleDeclName(ND) ||
+        ND->getDeclContext()->isDependentContext()) {
+      return ND->getNameAsString();
+    }
+    std::string Name;
+    raw_string_ostream Out(Name);
+    if (const auto *CD = dyn_cast<CXXConstructorDecl>(ND))
+      Mangler->mangleCXXCtor(CD, Ctor_Complete, Out);
+    else if (const auto *DD = dyn_cast<CXXDestructorDecl>(ND))
+      Mangler->mangleCXXDtor(DD, Dtor_Complete, Out);
+    else
+      Mangler->mangleName(ND, Out);
+    return Out.str();
+  }
+
+  void hashCommandLineArguments(Hash &TUHash, DeclTable &Table) {
+    // Get command line arguments
+    std::vector<std::string> CommandLineArgs;
+    std::string FilePath;
+    if (readHashedCommandLineArguments(CommandLineArgs, FilePath)) {
+      for (const std::string &Arg : CommandLineArgs) {
+        TUHash.update(Arg);
+        Table.add_option(Arg);
+      }
     } else {
       errs() << "Warning: could not open file \"" << FilePath
              << "\", cannot hash command line arguments.\n";
     }
   }
 
+  /// The key of the frontend output in the bitcode cache: the AST and
+  /// the arguments of the IR generation (see frontend-options.h)
+  std::string frontendHash(const HashResult &ASTHash) {
+    std::vector<std::string> CommandLineArgs;
+    std::string FilePath;
+    if (!readHashedCommandLineArguments(CommandLineArgs, FilePath))
+      return "";
+    Hash FrontendHash;
+    FrontendHash.update(StringRef("bitcode"));
+    FrontendHash.update(ASTHash.Bytes);
+    for (const std::string &Arg : frontendArguments(CommandLineArgs))
+      FrontendHash.update(Arg);
+    HashResult Result;
+    FrontendHash.final(Result);
+    return Result.digest().str();
+  }
+
+  /// On a miss, the frontend output of an earlier compilation with the
+  /// same AST and other backend options goes to the backend right away,
+  /// the code generation of this compilation is skipped, and the
+  /// object is stored like the one of a miss. Otherwise, the frontend
+  /// output of this compilation is stored (see BitcodeCapture).
+  void reuseBitcode(ObjectCache<raw_ostream> &Cache,
+                    const std::string &FrontendHash) {
+    const std::string Cached =
+        Cache.find_object_from_hash(objectfile, FrontendHash);
+    LLVMContext BitcodeContext;
+    std::unique_ptr<llvm::Module> M;
+    if (Cached != "") {
+      auto Buffer = MemoryBuffer::getFile(Cached);
+      if (Buffer) {
+        auto Parsed =
+            parseBitcodeFile((*Buffer)->getMemBufferRef(), BitcodeContext);
+        if (Parsed)
+          M = std::move(*Parsed);
+        else
+          consumeError(Parsed.takeError());
+      }
+    }
+    if (!M) {
+      bitcode_file = Cache.objectcopy_filename(objectfile, FrontendHash);
+      return;
+    }
+
+    if (Terminal)
+      *Terminal << "bitcode-hit: " << FrontendHash << "\n";
+    CI.clearOutputFiles(true);
+    std::error_code EC;
+    auto Out = llvm::make_unique<raw_fd_ostream>(objectfile, EC,
+                                                 sys::fs::F_None);
+    if (!EC) {
+      EmitBackendOutput(CI.getDiagnostics(), CI.getHeaderSearchOpts(),
+                        CI.getCodeGenOpts(), CI.getTargetOpts(),
+                        CI.getLangOpts(), CI.getTarget().getDataLayout(),
+                        M.get(), Backend_EmitObj, std::move(Out));
+    }
+    if (EC || CI.getDiagnostics().hasErrorOccurred()) {
+      unlink(objectfile);
+      atexit_mode = ATEXIT_NOP;
+      exit(1);
+    }
+    exit(0);
+  }
+
+  /// With CLANG_HASH_THREADS=<n>, the top-level declarations of a C
+  /// translation unit are hashed by n threads. While the parser runs,
+  /// Sema modifies shared tables of the AST (e.g. the attributes of the
+  /// ASTContext) without locks, so the threads start after parsing. In
+  /// C++, the AST is extended on demand (implicit members, template
+  /// instantiations), as are declarations from a precompiled header.
+  unsigned hashThreads(ASTContext &Context) const {
+    const char *Value = getenv("CLANG_HASH_THREADS");
+    if (!Value || Dependencies || Context.getLangOpts().CPlusPlus ||
+        Context.getLangOpts().ObjC1 || Context.getExternalSource())
+      return 1;
+    return std::max(1, atoi(Value));
+  }
+
+  /// Each thread has its own visitor. The digest of a top-level
+  /// declaration does not depend on the declarations hashed before it
+  /// (see CHashVisitor::traverseTopLevelDecl()), so the digests and
+  /// the cached ones are merged into the visitor of the main thread.
+  void hashInParallel(TranslationUnitDecl *TU,
+                      CHashVisitor<Hash, HashResult> &Visitor) {
+    std::vector<Decl *> Decls;
+    for (Decl *D : TU->noload_decls()) {
+      // The linkage is computed on first use and cached in the decl
+      if (const auto *FD = dyn_cast<FunctionDecl>(D))
+        FD->getLinkageInternal();
+      if (Visitor.shouldHashTopLevelDecl(D))
+        Decls.push_back(D);
+    }
+
+    std::atomic<size_t> Next(0);
+    auto HashDecls = [&Decls, &Next](CHashVisitor<Hash, HashResult> *V) {
+      for (size_t I = Next++; I < Decls.size(); I = Next++)
+        V->hashTopLevelDecl(Decls[I]);
+    };
+    std::vector<std::unique_ptr<CHashVisitor<Hash, HashResult>>> Visitors;
+    std::vector<std::thread> Threads;
+    for (unsigned I = 1; I < HashThreads; ++I) {
+      Visitors.emplace_back(
+          new CHashVisitor<Hash, HashResult>(TU->getASTContext()));
+      Threads.emplace_back(HashDecls, Visitors.back().get());
+    }
+    HashDecls(&Visitor);
+    for (std::thread &Thread : Threads)
+      Thread.join();
+
+    for (const auto &V : Visitors) {
+      Visitor.TopLevelDigests.insert(V->TopLevelDigests.begin(),
+                                     V->TopLevelDigests.end());
+      Visitor.DeclSilo.insert(V->DeclSilo.begin(), V->DeclSilo.end());
+    }
+  }
+
   CompilerInstance &CI;
   raw_ostream *const Terminal;
   bool StopIfSameHash;
+  DependencyRecorder *const Dependencies; // owned by the preprocessor
+  std::unique_ptr<CHashVisitor<Hash, HashResult>> TopLevelVisitor;
+  unsigned HashThreads = 1;
+  // Time spent on hashing while parsing
+  std::chrono::high_resolution_clock::duration StreamedHashing{};
+  std::unique_ptr<MangleContext> Mangler;
 };
 
 class HashTranslationUnitAction : public PluginASTAction {
@@ -482,12 +1103,26 @@ protected:
       return make_unique<ASTConsumer>();
     }
 
+    // Debug information names the source files and the compilation
+    // directory relative to the base directory
+    const std::string BaseDir = getBaseDir();
+    if (!BaseDir.empty())
+      CI.getCodeGenOpts().DebugPrefixMap[BaseDir] = ".";
+
     raw_ostream *Terminal = nullptr;
     if (Verbose)
       Terminal = &errs();
 
-    return make_unique<HashTranslationUnitConsumer>(CI, Terminal,
-                                                    StopIfSameHash);
+    // The directives are recorded while the source is parsed
+    DependencyRecorder *Dependencies = nullptr;
+    if (SemanticDeps::enabled()) {
+      Dependencies = new DependencyRecorder(CI.getSourceManager());
+      CI.getPreprocessor().addPPCallbacks(
+          std::unique_ptr<PPCallbacks>(Dependencies));
+    }
+
+    return make_unique<HashTranslationUnitConsumer>(
+        CI, Terminal, StopIfSameHash, Dependencies);
   }
 
   bool ParseArgs(const CompilerInstance &CI,
@@ -18,6 +18,9 @@
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/DataCollection.h"
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Support/MD5.h"
 #include <map>
 #include <string>
@@ -39,6 +42,7 @@ public:
 
 protected:
   ASTContext &Context;
+  PrintingPolicy Policy;
 
   // For the DataCollector, we implement a few addData() functions
   void addData(uint64_t data) { topHash().update(data); }
@@ -57,13 +61,17 @@ protected:
       topHash().update(SavedDigest->Bytes);
     } else {
       // 1.1.2 Calculate hash for type
+      const unsigned Pending = PendingDefinitions;
       const Hash *const CurrentHash = pushHash();
       Inherited::TraverseType(T); // Uses getTypePtr() internally
       const HashResult TypeDigest = popHash(CurrentHash);
       topHash().update(TypeDigest.Bytes);
 
-      // Store hash for underlying type
-      storeHash(ActualType, TypeDigest);
+      // Store hash for underlying type. Types that depend on a
+      // definition after the current declaration (e.g. a struct that
+      // is completed after its use) are hashed again later.
+      if (PendingDefinitions == Pending)
+        storeHash(ActualType, TypeDigest);
     }
 
     // Add the qulaifiers at this specific usage of the type
@@ -100,7 +108,42 @@ public:
 #define DEF_ADD_DATA(CLASS, CODE) DEF_ADD_DATA_STORED(CLASS, CODE)
 #include "clang/AST/TypeDataCollectors.inc"
 
-  CHashVisitor(ASTContext &Context) : Context(Context) {}
+  CHashVisitor(ASTContext &Context)
+      : Context(Context), Policy(LangOptions()) {
+    // The location of an anonymous struct would bring the path of its
+    // file into the hash, and the line tables of the SourceManager are
+    // not thread-safe. Its fields are hashed anyway.
+    Policy.AnonymousTagLocations = false;
+  }
+
+  /// Optionally, the visitor records the files of all declarations
+  /// that contribute to a hash (see getFiles()).
+  void trackFiles() { TrackFiles = true; }
+  const llvm::DenseSet<FileID> &getFiles() const { return Files; }
+
+  /// Streaming: hashes a top-level declaration, as soon as the parser
+  /// delivers it. The TU hash only combines the stored digests.
+  void hashTopLevelDecl(Decl *D) {
+    if (!shouldHashTopLevelDecl(D) || TopLevelDigests.count(D))
+      return;
+    Hash *CurrentHash = pushHash();
+    traverseTopLevelDecl(D);
+    TopLevelDigests[D] = popHash(CurrentHash);
+  }
+
+  /// A top-level declaration is hashed as the parser saw it: only
+  /// definitions before its end are visible (see isVisible()).
+  /// Therefore, its digest is the same, whether it is hashed when it
+  /// is delivered, after parsing, or on another thread.
+  void traverseTopLevelDecl(Decl *D) {
+    Decl *const SavedDecl = TopLevelDecl;
+    const unsigned SavedLimit = Limit;
+    TopLevelDecl = D;
+    Limit = position(D);
+    TraverseDecl(D);
+    TopLevelDecl = SavedDecl;
+    Limit = SavedLimit;
+  }
 
   /// For some special nodes, override the traverse function, since
   /// we need both pre- and post order traversal
@@ -113,53 +156,150 @@ public:
 
     Inherited::WalkUpFromTranslationUnitDecl(TU);
 
-    // Do recursion on our own, since we want to exclude some children
-    const auto DC = cast<DeclContext>(TU);
-    for (auto *Child : DC->noload_decls()) {
-      if (isa<TypedefDecl>(Child) || isa<RecordDecl>(Child) ||
-          isa<EnumDecl>(Child))
+    // Do recursion on our own, since we want to exclude some children.
+    // Declarations that were not streamed are hashed now. decls() also
+    // loads the declarations of a precompiled header, which precede the
+    // parsed ones like the header would.
+    for (auto *Child : TU->decls()) {
+      if (!shouldHashTopLevelDecl(Child))
         continue;
+      hashTopLevelDecl(Child);
+      topHash().update(TopLevelDigests[Child].Bytes);
+    }
 
-      // Extern variable definitions at the top-level
-      if (const auto VD = dyn_cast<VarDecl>(Child)) {
-        if (VD->hasExternalStorage()) {
-          continue;
-        }
+    storeHash(TU, popHash(CurrentHash));
+
+    return true;
+  }
+
+  /// In C++, namespaces and extern "C" blocks are only containers for
+  /// further top-level declarations. Therefore, we apply the same
+  /// filter as on the translation-unit level.
+  bool TraverseNamespaceDecl(NamespaceDecl *D) {
+    if (!D)
+      return true;
+    Inherited::WalkUpFromNamespaceDecl(D);
+    TraverseTopLevelDecls(D);
+    return true;
+  }
+
+  bool TraverseLinkageSpecDecl(LinkageSpecDecl *D) {
+    if (!D)
+      return true;
+    Inherited::WalkUpFromLinkageSpecDecl(D);
+    TraverseTopLevelDecls(D);
+    return true;
+  }
+
+  /// Returns true, if the top-level declaration D contributes to the
+  /// TU hash. Types and declarations without definition are only
+  /// hashed if they are referenced from a hashed definition.
+  bool shouldHashTopLevelDecl(const Decl *Child) const {
+    if (isa<TypedefNameDecl>(Child) || isa<RecordDecl>(Child) ||
+        isa<EnumDecl>(Child))
+      return false;
+
+    // Extern variable definitions at the top-level
+    if (const auto VD = dyn_cast<VarDecl>(Child)) {
+      if (VD->hasExternalStorage()) {
+        return false;
       }
+    }
 
-      if (const auto FD = dyn_cast<FunctionDecl>(Child)) {
-        // We try to avoid hashing of declarations that have no definition
-        if (!FD->isThisDeclarationADefinition()) {
-          bool doHashing = false;
-          // HOWEVER! If this declaration is an alias Declaration, we
-          // hash it no matter what
-          if (FD->hasAttrs()) {
-            for (const Attr *const A : FD->getAttrs()) {
-              if (A->getKind() == attr::Kind::Alias) {
-                doHashing = true;
-                break;
-              }
+    if (const auto FD = dyn_cast<FunctionDecl>(Child)) {
+      // We try to avoid hashing of declarations that have no definition
+      if (!FD->isThisDeclarationADefinition()) {
+        // HOWEVER! If this declaration is an alias Declaration, we
+        // hash it no matter what
+        if (FD->hasAttrs()) {
+          for (const Attr *const A : FD->getAttrs()) {
+            if (A->getKind() == attr::Kind::Alias) {
+              return true;
             }
           }
-          if (!doHashing)
-            continue;
         }
+        return false;
       }
-
-      TraverseDecl(Child);
     }
 
-    storeHash(TU, popHash(CurrentHash));
+    // Template patterns, like types, are only hashed if an
+    // instantiation or a reference reaches them (see
+    // TraverseTemplateInstantiation()); unused templates of the headers
+    // cost nothing. This includes out-of-line members of class
+    // templates. Only an explicit instantiation definition emits code
+    // on its own.
+    if (const auto TD = dyn_cast<TemplateDecl>(Child)) {
+      const ClassTemplateDecl *Outer = enclosingClassTemplate(TD);
+      return isExplicitlyInstantiated(TD) ||
+             (Outer && isExplicitlyInstantiated(Outer));
+    }
+    if (Child->getDeclContext()->isDependentContext()) {
+      const ClassTemplateDecl *Outer = enclosingClassTemplate(Child);
+      return Outer && isExplicitlyInstantiated(Outer);
+    }
 
     return true;
   }
 
+  /// The class template that a member belongs to, also through nested
+  /// classes and partial specializations
+  static const ClassTemplateDecl *enclosingClassTemplate(const Decl *D) {
+    for (const DeclContext *DC = D->getDeclContext(); DC;
+         DC = DC->getParent()) {
+      if (const auto *Partial =
+              dyn_cast<ClassTemplatePartialSpecializationDecl>(DC))
+        return Partial->getSpecializedTemplate();
+      if (const auto *RD = dyn_cast<CXXRecordDecl>(DC)) {
+        if (RD->getDescribedClassTemplate())
+          return RD->getDescribedClassTemplate();
+      }
+    }
+    return nullptr;
+  }
+
+  /// Returns true, if the template or one of the members of its
+  /// specializations has an explicit instantiation definition
+  /// (template class A<int>;)
+  static bool isExplicitlyInstantiated(const TemplateDecl *TD) {
+    const auto Explicit = TSK_ExplicitInstantiationDefinition;
+    if (const auto *FTD = dyn_cast<FunctionTemplateDecl>(TD)) {
+      for (const FunctionDecl *FD : FTD->specializations()) {
+        if (FD->getTemplateSpecializationKind() == Explicit)
+          return true;
+      }
+    } else if (const auto *CTD = dyn_cast<ClassTemplateDecl>(TD)) {
+      for (const ClassTemplateSpecializationDecl *CTSD :
+           CTD->specializations()) {
+        if (CTSD->getSpecializationKind() == Explicit)
+          return true;
+        for (const CXXMethodDecl *MD : CTSD->methods()) {
+          if (MD->getTemplateSpecializationKind() == Explicit)
+            return true;
+        }
+      }
+    } else if (const auto *VTD = dyn_cast<VarTemplateDecl>(TD)) {
+      for (const VarTemplateSpecializationDecl *VD : VTD->specializations()) {
+        if (VD->getSpecializationKind() == Explicit)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  void TraverseTopLevelDecls(DeclContext *DC) {
+    for (auto *Child : DC->decls()) {
+      if (!shouldHashTopLevelDecl(Child))
+        continue;
+      traverseTopLevelDecl(Child);
+    }
+  }
+
   bool TraverseDecl(Decl *D) {
     if (!D)
       return true;
     /* For some declarations, we store the calculated hash value. */
     bool CacheHash = false;
-    if (isa<FunctionDecl>(D) && cast<FunctionDecl>(D)->isDefined())
+    if (isa<FunctionDecl>(D) && isDefinitionVisible(cast<FunctionDecl>(D)))
       CacheHash = true;
     if (isa<VarDecl>(D) && cast<VarDecl>(D)->hasGlobalStorage())
       CacheHash = true;
@@ -167,7 +307,8 @@ public:
       CacheHash = true;
 
     if (!CacheHash) {
-      return Inherited::TraverseDecl(D);
+      addFile(D);
+      return TraverseDeclDispatch(D);
     }
 
     const HashResult *const SavedDigest = getHash(D);
@@ -175,10 +316,27 @@ public:
       topHash().update(SavedDigest->Bytes);
       return true;
     }
+    addFile(D);
+
+    // With C++ templates, a declaration can reference itself via its
+    // template arguments (struct A : Base<A>). Such back edges only
+    // contribute the kind and name of the declaration.
+    if (!InProgress.insert(D).second) {
+      addData(llvm::hash_value(D->getKind()));
+      if (const auto *ND = dyn_cast<NamedDecl>(D))
+        addData(ND->getNameAsString());
+      return true;
+    }
+
+    const unsigned Pending = PendingDefinitions;
     Hash *CurrentHash = pushHash();
-    bool Ret = Inherited::TraverseDecl(D);
+    bool Ret = TraverseDeclDispatch(D);
     HashResult CurrentHashResult = popHash(CurrentHash);
-    storeHash(D, CurrentHashResult);
+    // A digest that depends on definitions after the current top-level
+    // declaration is only valid for that declaration.
+    if (PendingDefinitions == Pending || D == TopLevelDecl)
+      storeHash(D, CurrentHashResult);
+    InProgress.erase(D);
     if (!isa<TranslationUnitDecl>(D)) {
       topHash().update(CurrentHashResult.Bytes);
     }
@@ -186,6 +344,196 @@ public:
     return Ret;
   }
 
+protected:
+  /// The position of the top-level declaration that contains D in
+  /// the TU. The TU lists its declarations in the order they were
+  /// parsed; a streaming visitor indexes the new ones on demand.
+  /// Declarations from a precompiled header precede all others (0).
+  unsigned position(const Decl *D) {
+    for (const DeclContext *DC = D->getLexicalDeclContext();
+         DC && !DC->isTranslationUnit(); DC = D->getLexicalDeclContext())
+      D = cast<Decl>(DC);
+    if (D->isFromASTFile())
+      return 0;
+    auto It = Positions.find(D);
+    if (It != Positions.end())
+      return It->second;
+
+    auto Decls = Context.getTranslationUnitDecl()->noload_decls();
+    auto I = Decls.begin();
+    if (LastPositioned)
+      I = std::next(DeclContext::decl_iterator(LastPositioned));
+    for (; I != Decls.end(); ++I) {
+      const unsigned Position = Positions.size() + 1;
+      Positions[*I] = Position;
+      LastPositioned = *I;
+    }
+    It = Positions.find(D);
+    return It != Positions.end() ? It->second : ~0u;
+  }
+
+  /// Returns true, if the declaration was parsed before the end of the
+  /// current top-level declaration. Declarations from a precompiled
+  /// header are always visible, and only they are visible from its
+  /// declarations.
+  bool isVisible(const Decl *D) {
+    if (D->isFromASTFile())
+      return true;
+    const unsigned Position = position(D);
+    return Position == ~0u || Position <= Limit;
+  }
+
+  /// Returns true, if the function has a visible definition whose
+  /// body is hashed. A definition can still follow otherwise.
+  bool isDefinitionVisible(const FunctionDecl *FD) {
+    const FunctionDecl *Definition;
+    if (!FD->isDefined(Definition) || !isVisible(Definition)) {
+      ++PendingDefinitions;
+      return false;
+    }
+    return !BodylessFunctions.count(Definition);
+  }
+
+  /// Tags are incomplete without a visible definition. Then, only their
+  /// kind and name are hashed, as the definition can still follow.
+  bool traverseTag(TagDecl *D) {
+    if (D->isCompleteDefinition() && isVisible(D))
+      return TraverseDecl(D);
+    ++PendingDefinitions;
+    addData(llvm::hash_value(D->getKind()));
+    addData(D->getNameAsString());
+    return true;
+  }
+
+  /// Declarations that are derived from other declarations by the
+  /// compiler are hashed by their origin instead of being traversed.
+  bool TraverseDeclDispatch(Decl *D) {
+    if (D->isImplicit() && isa<CXXMethodDecl>(D))
+      return TraverseImplicitDecl(D);
+    if (isa<CXXRecordDecl>(D) && cast<CXXRecordDecl>(D)->isInjectedClassName())
+      return TraverseImplicitDecl(D);
+    if (isTemplateInstantiation(D))
+      return TraverseTemplateInstantiation(D);
+    return Inherited::TraverseDecl(D);
+  }
+
+  static bool isTemplateInstantiation(const Decl *D) {
+    if (const auto *CTSD = dyn_cast<ClassTemplateSpecializationDecl>(D)) {
+      return isTemplateInstantiation(CTSD->getSpecializationKind());
+    }
+    if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+      return FD->isTemplateInstantiation() &&
+             FD->getTemplateInstantiationPattern() != nullptr;
+    }
+    return false;
+  }
+
+  /// Implicit special members (constructors, destructors, assignment
+  /// operators) and injected class names are completely determined by
+  /// their surrounding class. Their synthesized bodies are not
+  /// traversed; we only record their existence and their properties.
+  bool TraverseImplicitDecl(Decl *D) {
+    addData(llvm::hash_value(D->getKind()));
+    if (const auto *MD = dyn_cast<CXXMethodDecl>(D)) {
+      addData(MD->getNameAsString());
+      addData(MD->getNumParams());
+      addData(MD->isDeleted());
+      addData(MD->isDefaulted());
+      addData(MD->isTrivial());
+      addData(MD->isVirtual());
+    }
+    return true;
+  }
+
+  /// An implicit instantiation is hashed as the digest of its pattern
+  /// plus its template arguments. The pattern digest is cached within
+  /// the DeclSilo; therefore, the costs of hashing scale with the
+  /// number of templates and not with the number of instantiations.
+  bool TraverseTemplateInstantiation(Decl *D) {
+    addData(llvm::hash_value(D->getKind()));
+
+    if (auto *CTSD = dyn_cast<ClassTemplateSpecializationDecl>(D)) {
+      auto From = CTSD->getSpecializedTemplateOrPartial();
+      Decl *Pattern;
+      if (auto *Partial =
+              From.dyn_cast<ClassTemplatePartialSpecializationDecl *>()) {
+        Pattern = Partial;
+        // The partial specialization is matched by a second argument list
+        addTemplateArguments(CTSD->getTemplateInstantiationArgs().asArray());
+      } else {
+        Pattern = From.get<ClassTemplateDecl *>()->getTemplatedDecl();
+      }
+      TraverseDecl(Pattern);
+      addTemplateArguments(CTSD->getTemplateArgs().asArray());
+      return true;
+    }
+
+    FunctionDecl *FD = cast<FunctionDecl>(D);
+    TraverseDecl(FD->getTemplateInstantiationPattern());
+    if (const auto *Args = FD->getTemplateSpecializationArgs()) {
+      addTemplateArguments(Args->asArray());
+    }
+    // Members of class template instantiations are additionally
+    // parameterized by the arguments of their enclosing class.
+    if (const auto *RD = dyn_cast<CXXRecordDecl>(FD->getDeclContext())) {
+      addData(QualType(RD->getTypeForDecl(), 0));
+    }
+    return true;
+  }
+
+  static bool isTemplateInstantiation(TemplateSpecializationKind Kind) {
+    return Kind == TSK_ImplicitInstantiation ||
+           Kind == TSK_ExplicitInstantiationDeclaration ||
+           Kind == TSK_ExplicitInstantiationDefinition;
+  }
+
+  void addTemplateArguments(llvm::ArrayRef<TemplateArgument> Args) {
+    addData(Args);
+    for (const TemplateArgument &Arg : Args) {
+      addTemplateArgument(Arg);
+    }
+  }
+
+  void addTemplateArgument(const TemplateArgument &Arg) {
+    addData(Arg.getKind());
+    switch (Arg.getKind()) {
+    case TemplateArgument::Null:
+      break;
+    case TemplateArgument::Type:
+      addData(Arg.getAsType());
+      break;
+    case TemplateArgument::Declaration:
+      addData(Arg.getAsDecl()->getQualifiedNameAsString());
+      addData(Arg.getParamTypeForDecl());
+      break;
+    case TemplateArgument::NullPtr:
+      addData(Arg.getNullPtrType());
+      break;
+    case TemplateArgument::Integral: {
+      const llvm::APSInt &Value = Arg.getAsIntegral();
+      addData(Arg.getIntegralType());
+      addData(Value.getBitWidth());
+      for (unsigned I = 0, E = Value.getNumWords(); I < E; ++I)
+        addData(Value.getRawData()[I]);
+      break;
+    }
+    case TemplateArgument::Template:
+    case TemplateArgument::TemplateExpansion:
+      // The template pattern itself is hashed at the top level.
+      if (const TemplateDecl *TD =
+              Arg.getAsTemplateOrTemplatePattern().getAsTemplateDecl())
+        addData(TD->getQualifiedNameAsString());
+      break;
+    case TemplateArgument::Expression:
+      TraverseStmt(Arg.getAsExpr());
+      break;
+    case TemplateArgument::Pack:
+      addTemplateArguments(Arg.getPackAsArray());
+      break;
+    }
+  }
+
+public:
   /// When doing a semantic hash, we have to use cross-tree links to
   /// other parts of the AST, here we establish these links
 
@@ -196,10 +544,16 @@ public:
   }
 
   DEF_TYPE_GOTO_DECL(TypedefType, T->getDecl());
-  DEF_TYPE_GOTO_DECL(RecordType, T->getDecl());
+  bool VisitRecordType(RecordType *T) {
+    Inherited::VisitRecordType(T);
+    return traverseTag(T->getDecl());
+  }
   // The EnumType forwards to the declaration. The declaration does
   // not hand back to the type.
-  DEF_TYPE_GOTO_DECL(EnumType, T->getDecl());
+  bool VisitEnumType(EnumType *T) {
+    Inherited::VisitEnumType(T);
+    return traverseTag(T->getDecl());
+  }
   bool TraverseEnumDecl(EnumDecl *E) {
     /* In the original RecursiveASTVisitor
        > if (D->getTypeForDecl()) {
@@ -235,26 +589,40 @@ public:
        * struct foo a = { sizeof(a) };
        */
       VarDecl *VD = static_cast<VarDecl *>(ValDecl);
+      addFile(VD);
       VisitNamedDecl(VD);
       Inherited::TraverseType(VD->getType());
       VisitVarDecl(VD);
     } else if (isa<FunctionDecl>(ValDecl)) {
-      /* Hash Functions without their body */
+      /* Hash Functions without their body. The AST is not modified,
+         as it is still used by the parser and the code generator. */
       FunctionDecl *FD = static_cast<FunctionDecl *>(ValDecl);
-      Stmt *Body = FD->getBody();
-      FD->setBody(nullptr);
+      const bool SkipBody = FD->doesThisDeclarationHaveABody() &&
+                            BodylessFunctions.insert(FD).second;
+      if (SkipBody)
+        SkippedBodies.insert(FD->getBody());
       TraverseDecl(FD);
-      FD->setBody(Body);
+      if (SkipBody) {
+        BodylessFunctions.erase(FD);
+        SkippedBodies.erase(FD->getBody());
+      }
     } else {
       TraverseDecl(ValDecl);
     }
     return true;
   }
 
+  bool TraverseStmt(Stmt *S,
+                    typename Inherited::DataRecursionQueue *Queue = nullptr) {
+    if (S && SkippedBodies.count(S))
+      return true;
+    return Inherited::TraverseStmt(S, Queue);
+  }
+
   bool VisitValueDecl(ValueDecl *D) {
     /* Field Declarations can induce recursions */
     if (isa<FieldDecl>(D)) {
-      addData(std::string(D->getType().getAsString()));
+      addData(D->getType().getAsString(Policy));
     } else {
       addData(D->getType());
     }
@@ -267,7 +635,7 @@ public:
     // addData(QualType) directly on this, because it would reference
     // back to the enclosing CXXRecord and result in a recursion.
     if (isa<CXXThisExpr>(E)) {
-      addData(std::string(E->getType().getAsString()));
+      addData(E->getType().getAsString(Policy));
     } else {
       Inherited::VisitExpr(E);
     }
@@ -282,6 +650,44 @@ public:
   std::map<const Type *, HashResult> TypeSilo;
   std::map<const Decl *, HashResult> DeclSilo;
 
+  // Declarations whose hash is currently calculated
+  llvm::SmallPtrSet<const Decl *, 16> InProgress;
+
+  // The digests of the top-level declarations of the TU
+  std::map<const Decl *, HashResult> TopLevelDigests;
+
+protected:
+  // The top-level declaration under calculation and its position.
+  // Definitions after it are not visible.
+  Decl *TopLevelDecl = nullptr;
+  unsigned Limit = ~0u;
+  llvm::DenseMap<const Decl *, unsigned> Positions;
+  Decl *LastPositioned = nullptr;
+
+  // Lookups of definitions that were not visible. A digest that
+  // contains such a lookup is not reused for later declarations.
+  unsigned PendingDefinitions = 0;
+
+  // Functions that are hashed without their body, and these bodies
+  llvm::SmallPtrSet<const FunctionDecl *, 8> BodylessFunctions;
+  llvm::SmallPtrSet<const Stmt *, 8> SkippedBodies;
+
+  bool TrackFiles = false;
+  llvm::DenseSet<FileID> Files;
+
+  /// Declarations that are expanded from a macro are in the file of
+  /// the expansion and in the file of their spelling.
+  void addFile(const Decl *D) {
+    if (!TrackFiles || D->getLocation().isInvalid())
+      return;
+    const SourceManager &SM = Context.getSourceManager();
+    const SourceLocation Loc = D->getLocation();
+    Files.insert(SM.getFileID(SM.getExpansionLoc(Loc)));
+    if (Loc.isMacroID())
+      Files.insert(SM.getFileID(SM.getSpellingLoc(Loc)));
+  }
+
+public:
   void storeHash(const Type *Obj, HashResult Dig) { TypeSilo[Obj] = Dig; }
 
   void storeHash(const Decl *Obj, HashResult Dig) { DeclSilo[Obj] = Dig; }
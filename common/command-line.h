@@ -0,0 +1,151 @@
+#ifndef __CHASH_COMMAND_LINE
+#define __CHASH_COMMAND_LINE
+
+/*
+ * Both plugins include the command line of the compiler driver into
+ * the translation-unit hash. The driver is the parent process of the
+ * actual compiler (clang -cc1, cc1). Arguments that do not influence
+ * the compiler output are filtered. With debug information, the
+ * working directory and the source files are hashed, as the object
+ * names them. With CLANG_HASH_BASEDIR, paths below that directory are
+ * hashed relative to it.
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+
+inline bool isPathCharacter(char C) {
+  return isalnum((unsigned char)C) || strchr("/._-+~", C) != nullptr;
+}
+
+inline bool isSourceFile(const std::string &Arg) {
+  for (const char *Ext : {".c", ".i", ".cc", ".cpp", ".cxx", ".C", ".ii"}) {
+    const size_t Len = strlen(Ext);
+    if (Arg.size() > Len && Arg.compare(Arg.size() - Len, Len, Ext) == 0)
+      return true;
+  }
+  return false;
+}
+
+/// The base directory of the checkout (CLANG_HASH_BASEDIR), without
+/// trailing slashes, or an empty string
+inline std::string getBaseDir() {
+  const char *Env = getenv("CLANG_HASH_BASEDIR");
+  std::string BaseDir = Env ? Env : "";
+  while (BaseDir.size() > 1 && BaseDir[BaseDir.size() - 1] == '/')
+    BaseDir.erase(BaseDir.size() - 1);
+  if (BaseDir.size() < 2 || BaseDir[0] != '/')
+    return "";
+  return BaseDir;
+}
+
+/// Makes the paths below the base directory relative to it
+/// (/base/src/a.c -> src/a.c, /base -> .). Checkouts in different
+/// directories then hash and name their files alike.
+inline std::string relativeToBaseDir(const std::string &Text) {
+  static const std::string BaseDir = getBaseDir();
+  if (BaseDir.empty())
+    return Text;
+  std::string Result;
+  size_t Pos = 0;
+  for (size_t Match = Text.find(BaseDir); Match != std::string::npos;
+       Match = Text.find(BaseDir, Pos)) {
+    const size_t End = Match + BaseDir.size();
+    // The path must start a word or follow an option (-I/base/include)
+    size_t Word = Match;
+    while (Word > 0 && isPathCharacter(Text[Word - 1]))
+      --Word;
+    bool AtStart = Word == Match || Text[Word] == '-';
+    for (size_t I = Word + 1; I < Match && AtStart; ++I)
+      AtStart = isalpha((unsigned char)Text[I]);
+    if (AtStart && End < Text.size() && Text[End] == '/') {
+      Result += Text.substr(Pos, Match - Pos);
+      Pos = End + 1;
+    } else if (AtStart && (End == Text.size() || !isPathCharacter(Text[End]))) {
+      Result += Text.substr(Pos, Match - Pos) + ".";
+      Pos = End;
+    } else {
+      Result += Text.substr(Pos, End - Pos);
+      Pos = End;
+    }
+  }
+  return Result + Text.substr(Pos);
+}
+
+/// Reads the relevant command line arguments of the compiler
+/// driver. Returns false, and the path of the unreadable file in
+/// FilePath, if the command line is not accessible.
+inline bool readHashedCommandLineArguments(std::vector<std::string> &Args,
+                                           std::string &FilePath) {
+  const std::string PPID{std::to_string(getppid())};
+  FilePath = "/proc/" + PPID + "/cmdline";
+  std::ifstream CommandLine{FilePath};
+  if (!CommandLine.good())
+    return false;
+
+  std::string Arg;
+  std::vector<std::string> SourceFiles;
+  bool Debug = false;
+  do {
+    getline(CommandLine, Arg, '\0');
+    if ("-o" == Arg) {
+      // throw away next parameter (name of outfile)
+      getline(CommandLine, Arg, '\0');
+      continue;
+    }
+    if (isSourceFile(Arg)) {
+      SourceFiles.push_back(relativeToBaseDir(Arg));
+      continue;
+    }
+    if (Arg.compare(0, 2, "-g") == 0 && Arg != "-gcc-toolchain")
+      Debug = Arg != "-g0";
+
+    if (Arg.find("-stop-if-same-hash") != std::string::npos) {
+      continue; // also don't hash this (plugin argument)
+    }
+    if (Arg.compare(0, 12, "-fplugin-arg") == 0) {
+      continue; // gcc plugin arguments (contain the name of the outfile)
+    }
+    if (Arg == "-I") {
+      // throw away next parameter (include path)
+      getline(CommandLine, Arg, '\0');
+      continue;
+    }
+    if (Arg.substr(0, 2) == "-I") {
+      continue; // also don't hash include paths
+    }
+    if (Arg == "-include-pch") {
+      // throw away next parameter (its declarations are hashed)
+      getline(CommandLine, Arg, '\0');
+      continue;
+    }
+    if (Arg.substr(0, 2) == "-D") {
+      continue; // also don't hash macro defines
+    }
+    if (Arg.find("-hash-verbose") != std::string::npos) {
+      continue; // also don't hash this (plugin argument)
+    }
+
+    if (Arg.size())
+      Args.push_back(relativeToBaseDir(Arg));
+  } while (Arg.size());
+
+  // The debug information names the compilation directory and the
+  // source files; other checkouts must not share the object
+  char Cwd[4096];
+  if (Debug && getcwd(Cwd, sizeof(Cwd))) {
+    Args.push_back("-fdebug-compilation-dir=" + relativeToBaseDir(Cwd));
+    Args.insert(Args.end(), SourceFiles.begin(), SourceFiles.end());
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef __CHASH_DECL_TABLE
+#define __CHASH_DECL_TABLE
+
+/*
+ * The digest table of a translation unit: the digests of its
+ * top-level declarations (named like the element-hashes) and its
+ * hashed compiler options, grouped by option name. Both plugins store
+ * the table of the last compilation of an object file in
+ * <objectfile>.hash.decls. On a miss, the difference to that table
+ * explains which declarations, types or options invalidated the
+ * object, and in which file they are.
+ *
+ * The explanation is printed as miss-reason lines with -hash-verbose.
+ * With CLANG_HASH_EXPLAIN=<file>, the explanations of all misses are
+ * appended to that file as "<objectfile>: <reason>" lines, so that
+ * `cut -d' ' -f2- | sort | uniq -c` finds the header or flag that
+ * invalidates the most objects.
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+struct DeclTable {
+  struct Entry {
+    std::string digest;
+    std::string file;
+  };
+
+  /// The hash of the whole translation unit
+  std::string m_hash;
+  std::map<std::string, Entry> m_entries;
+
+  /// The digest of everything in the translation unit. It only
+  /// explains a miss if no declaration with its own digest changed
+  /// (e.g. a prototype or a typedef that no definition uses).
+  static const char *unit_name() { return "translation-unit"; }
+
+  static std::string filename(std::string objectfile) {
+    return objectfile + ".hash.decls";
+  }
+
+  void add(std::string name, std::string digest, std::string file = "") {
+    std::string key = sanitize(name);
+    for (unsigned n = 2; m_entries.count(key); ++n)
+      key = sanitize(name) + "#" + std::to_string(n);
+    m_entries[key] = Entry{sanitize(digest), sanitize(file)};
+  }
+
+  /// Options are grouped by their name (-std=c99 -> option:-std), the
+  /// digest is the option itself.
+  void add_option(const std::string &arg) {
+    add("option:" + arg.substr(0, arg.find('=')), arg);
+  }
+
+  /// Reads a stored table. With only_hash, the entries are skipped.
+  bool read(std::string path, bool only_hash = false) {
+    std::ifstream in(path);
+    std::string line;
+    if (!getline(in, line) || line.compare(0, 5, "hash\t") != 0)
+      return false;
+    m_hash = line.substr(5);
+    while (!only_hash && getline(in, line)) {
+      const size_t tab1 = line.find('\t');
+      const size_t tab2 = line.find('\t', tab1 + 1);
+      if (tab1 == std::string::npos || tab2 == std::string::npos)
+        return false;
+      m_entries[line.substr(0, tab1)] =
+          Entry{line.substr(tab1 + 1, tab2 - tab1 - 1), line.substr(tab2 + 1)};
+    }
+    return true;
+  }
+
+  bool write(std::string path) const {
+    std::string tmpfile(path + ".tmp." + std::to_string(getpid()));
+    {
+      std::ofstream out(tmpfile);
+      out << "hash\t" << m_hash << "\n";
+      for (const auto &entry : m_entries) {
+        out << entry.first << "\t" << entry.second.digest << "\t"
+            << entry.second.file << "\n";
+      }
+      if (!out.good()) {
+        unlink(tmpfile.c_str());
+        return false;
+      }
+    }
+    if (rename(tmpfile.c_str(), path.c_str()) != 0) {
+      unlink(tmpfile.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /// The differences to a previous table: added, removed and changed
+  /// entries, with the file they are in
+  std::vector<std::string> explain(const DeclTable &previous) const {
+    std::vector<std::string> reasons;
+    for (const auto &entry : m_entries) {
+      if (entry.first == unit_name())
+        continue;
+      auto old = previous.m_entries.find(entry.first);
+      if (old == previous.m_entries.end())
+        reasons.push_back("added " + describe(entry));
+      else if (old->second.digest != entry.second.digest)
+        reasons.push_back("changed " + describe(entry, &old->second));
+    }
+    for (const auto &entry : previous.m_entries) {
+      if (entry.first != unit_name() && !m_entries.count(entry.first))
+        reasons.push_back("removed " + describe(entry));
+    }
+    if (reasons.empty() && m_hash != previous.m_hash) {
+      reasons.push_back("changed declarations without own digest "
+                        "(prototypes, typedefs, enums)");
+    }
+    return reasons;
+  }
+
+  /// Compares with the table of the previous compilation of the object
+  /// file, reports the reasons of a miss, and stores this table for the
+  /// next compilation. Returns the reasons.
+  template <typename Terminal>
+  std::vector<std::string> update(std::string objectfile, bool miss,
+                                  Terminal *terminal) const {
+    const std::string path(filename(objectfile));
+    DeclTable previous;
+    const bool have_previous = previous.read(path, !miss);
+    std::vector<std::string> reasons;
+    if (miss && !have_previous)
+      reasons.push_back("no previous compilation");
+    else if (miss && previous.m_hash == m_hash)
+      reasons.push_back("unchanged, but not in the cache");
+    else if (miss)
+      reasons = explain(previous);
+
+    if (!reasons.empty()) {
+      std::string log;
+      for (const std::string &reason : reasons) {
+        if (terminal)
+          (*terminal) << "miss-reason: " << reason << "\n";
+        log += objectfile + ": " + reason + "\n";
+      }
+      // One write, so that the lines of concurrent compilations do
+      // not interleave
+      const char *logfile = getenv("CLANG_HASH_EXPLAIN");
+      if (logfile && *logfile) {
+        int fd = open(logfile, O_APPEND | O_WRONLY | O_CREAT, 0644);
+        if (fd >= 0) {
+          if (::write(fd, log.data(), log.size()) < 0)
+            perror(logfile);
+          close(fd);
+        }
+      }
+    }
+
+    if (!have_previous || previous.m_hash != m_hash)
+      write(path);
+    return reasons;
+  }
+
+private:
+  /// Names and files end up in tab-separated lines
+  static std::string sanitize(std::string text) {
+    for (char &c : text) {
+      if (c == '\t' || c == '\n')
+        c = ' ';
+    }
+    return text;
+  }
+
+  static std::string describe(const std::pair<const std::string, Entry> &entry,
+                              const Entry *old = nullptr) {
+    std::string text = entry.first;
+    if (entry.first.compare(0, 7, "option:") == 0) {
+      // The options are their own digest
+      if (old)
+        text += " (" + old->digest + " -> " + entry.second.digest + ")";
+      else
+        text += " (" + entry.second.digest + ")";
+    } else if (entry.second.file != "") {
+      text += " (" + entry.second.file + ")";
+    }
+    return text;
+  }
+};
+
+#endif
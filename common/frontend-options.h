@@ -0,0 +1,63 @@
+#ifndef __CHASH_FRONTEND_OPTIONS
+#define __CHASH_FRONTEND_OPTIONS
+
+/*
+ * The bitcode cache (CLANG_HASH_BITCODE) keeps the output of the clang
+ * frontend, the unoptimized LLVM IR, for compilations that only differ
+ * in the options of the backend. Its key covers the arguments that
+ * influence the generated IR, and leaves out:
+ *
+ *   - the arguments of the backend: -c, -S, -mllvm <arg>, -Wa,<arg>,
+ *     -f[no-]function-sections, -f[no-]data-sections, -f[no-]vectorize,
+ *     -f[no-]slp-vectorize, -f[no-]unroll-loops, optimization remarks
+ *   - the output file (-o <file>)
+ *   - the optimization level among -O1, -O2, -O3 and -O, as the
+ *     frontend generates the same IR for them
+ *
+ * Other arguments end up in the IR: -O0, -Os, -Oz and -Ofast change
+ * the function attributes, -march the target attributes, and -g the
+ * debug information. They are kept.
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <string>
+#include <vector>
+
+/// Whether an argument only influences the backend
+static bool isBackendArgument(const std::string &Arg) {
+  for (const char *Option :
+       {"-c", "-S", "-ffunction-sections", "-fno-function-sections",
+        "-fdata-sections", "-fno-data-sections", "-fvectorize",
+        "-fno-vectorize", "-fslp-vectorize", "-fno-slp-vectorize",
+        "-funroll-loops", "-fno-unroll-loops", "-fintegrated-as",
+        "-fno-integrated-as", "-fverbose-asm", "-fno-verbose-asm",
+        "-fsave-optimization-record"}) {
+    if (Arg == Option)
+      return true;
+  }
+  for (const char *Prefix : {"-Wa,", "-Rpass", "-foptimization-record-file="}) {
+    if (Arg.compare(0, std::string(Prefix).size(), Prefix) == 0)
+      return true;
+  }
+  return false;
+}
+
+/// The arguments that influence the frontend output, in their order
+static std::vector<std::string>
+frontendArguments(const std::vector<std::string> &Args) {
+  std::vector<std::string> Result;
+  for (size_t I = 0; I < Args.size(); ++I) {
+    const std::string &Arg = Args[I];
+    if (Arg == "-mllvm" || Arg == "-o")
+      ++I; // and its value
+    else if (Arg == "-O" || Arg == "-O1" || Arg == "-O2" || Arg == "-O3" ||
+             Arg == "-O4")
+      Result.push_back("-O");
+    else if (!isBackendArgument(Arg))
+      Result.push_back(Arg);
+  }
+  return Result;
+}
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef __CHASH_OBJECT_CACHE
+#define __CHASH_OBJECT_CACHE
+
+/*
+ * The object cache is shared between the clang and the gcc plugin,
+ * so that both compilers can use the same cache directory.
+ *
+ * Without CLANG_HASH_CACHE, the hash of the last compilation is
+ * stored in <objectfile>.hash and a copy of the compiler output in
+ * <objectfile>.hash.copy. With CLANG_HASH_CACHE, the output is
+ * stored as <cachedir>/<hash[0:2]>/<hash[2:]>.<kind>.
+ *
+ * The kind names the stored compiler output. The clang plugin stores
+ * object files ("o"), the gcc plugin stores the assembler output of
+ * cc1 ("s"), since the object file is produced by the assembler after
+ * cc1 has exited.
+ *
+ * With CLANG_HASH_CCACHE (and without CLANG_HASH_CACHE), the output
+ * is stored in the cache directory of ccache ($CCACHE_DIR or
+ * ~/.ccache) with the layout of ccache 3:
+ * <cachedir>/<hash[0]>/<hash[1]>/<hash[2:]>.<kind>. The AST hash
+ * replaces the hash of the preprocessed source. The files and their
+ * size are added to the stats files of ccache, so that `ccache -s`
+ * shows the hits and misses and `ccache -c` evicts our files like its
+ * own. ccache's own results are named <hash>-<size>.o, so the two
+ * never collide.
+ *
+ * With a cache directory, CLANG_HASH_REMOTE adds a remote cache (see
+ * remote-cache.h): local misses are looked up remotely, and new
+ * entries are uploaded.
+ *
+ * An entry may come with files about the compilation that produced
+ * it: its diagnostics, <entry>.stderr (a hit stops after the frontend,
+ * so the diagnostics of the backend are replayed from there), and its
+ * duration in ns, <entry>.duration (the time a hit saves).
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <vector>
+
+#include "remote-cache.h"
+
+/// The counters in the stats files of ccache 3 (stats.h)
+enum {
+  CCACHE_STATS_TOCACHE = 4,
+  CCACHE_STATS_CACHEHIT_CPP = 8,
+  CCACHE_STATS_NUMFILES = 11,
+  CCACHE_STATS_TOTALSIZE = 12, // KiB
+  CCACHE_STATS_END = 32,
+};
+
+template <typename Terminal>
+struct ObjectCache {
+  std::string m_cachedir;
+  Terminal *m_terminal;
+  std::string m_kind;
+  bool m_ccache;
+  RemoteCache m_remote;
+
+  ObjectCache(std::string cachedir, Terminal *terminal,
+              std::string kind = "o", bool ccache = false)
+      : m_cachedir(cachedir), m_terminal(terminal), m_kind(kind),
+        m_ccache(ccache) {}
+
+  /// The cache of the environment (CLANG_HASH_CACHE, CLANG_HASH_CCACHE)
+  static ObjectCache from_environment(Terminal *terminal,
+                                      std::string kind = "o") {
+    ObjectCache cache("", terminal, kind);
+    const char *cachedir = getenv("CLANG_HASH_CACHE");
+    const char *ccache = getenv("CLANG_HASH_CCACHE");
+    const char *ccachedir = getenv("CCACHE_DIR");
+    const char *home = getenv("HOME");
+    if (cachedir && *cachedir) {
+      cache.m_cachedir = cachedir;
+    } else if (ccache && *ccache) {
+      cache.m_ccache = true;
+      if (ccachedir && *ccachedir)
+        cache.m_cachedir = ccachedir;
+      else if (home)
+        cache.m_cachedir = std::string(home) + "/.ccache";
+    }
+    if (cache.m_cachedir != "")
+      cache.m_remote = RemoteCache::from_environment();
+    return cache;
+  }
+
+  bool has_cachedir() const { return m_cachedir != ""; }
+
+  char *hash_filename(std::string objectfile) {
+    if (m_cachedir == "") {
+      std::string path(objectfile + ".hash");
+      return strdup(path.c_str());
+    }
+    return NULL;
+  }
+
+  std::string local_copy_filename(std::string objectfile) {
+    if (m_kind == "o") {
+      return objectfile + ".hash.copy";
+    }
+    return objectfile + ".hash.copy." + m_kind;
+  }
+
+  std::string cache_filename(std::string hash) {
+    if (m_ccache) {
+      return m_cachedir + "/" + hash.substr(0, 1) + "/" + hash.substr(1, 1) +
+             "/" + hash.substr(2) + "." + m_kind;
+    }
+    return m_cachedir + "/" + hash.substr(0, 2) + "/" + hash.substr(2) +
+           "." + m_kind;
+  }
+
+  char *objectcopy_filename(std::string objectfile, std::string hash) {
+    if (m_cachedir == "") {
+      std::string path(local_copy_filename(objectfile));
+      return strdup(path.c_str());
+    }
+    make_cache_dirs(hash);
+    std::string path(cache_filename(hash));
+    return strdup(path.c_str());
+  }
+
+  void make_cache_dirs(std::string hash) {
+    mkdir(m_cachedir.c_str(), 0755);
+    if (m_ccache) {
+      mkdir((m_cachedir + "/" + hash.substr(0, 1)).c_str(), 0755);
+      mkdir((m_cachedir + "/" + hash.substr(0, 1) + "/" + hash.substr(1, 1)).c_str(), 0755);
+    } else {
+      std::string dir(m_cachedir + "/" + hash.substr(0, 2));
+      mkdir(dir.c_str(), 0755);
+    }
+  }
+
+  /// The files that accompany a stored object
+  static std::vector<std::string> sidecar_suffixes() {
+    return {".stderr", ".duration"};
+  }
+
+  /// The recorded diagnostics of a stored object
+  static std::string diagnostics_filename(std::string path) {
+    return path + ".stderr";
+  }
+
+  /// Stores the diagnostics of a new entry. Without diagnostics, a
+  /// stale file of an earlier entry is removed.
+  static void store_diagnostics(std::string path, const std::string &text) {
+    std::string filename(diagnostics_filename(path));
+    if (text == "") {
+      unlink(filename.c_str());
+      return;
+    }
+    write_sidecar(filename, text);
+  }
+
+  /// The recorded diagnostics of a stored object, or an empty string
+  static std::string read_diagnostics(std::string path) {
+    std::ifstream in(diagnostics_filename(path));
+    return std::string(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+  }
+
+  /// Stores the compile time of a new entry in ns
+  static void store_duration(std::string path, unsigned long long duration) {
+    write_sidecar(path + ".duration", std::to_string(duration) + "\n");
+  }
+
+  /// The compile time of a stored object in ns, or 0 if unknown
+  static unsigned long long read_duration(std::string path) {
+    std::ifstream in(path + ".duration");
+    unsigned long long duration = 0;
+    in >> duration;
+    return duration;
+  }
+
+  /// Writes a file next to an entry atomically
+  static void write_sidecar(std::string filename, const std::string &text) {
+    std::string tmpfile(filename + ".tmp." + std::to_string(getpid()));
+    {
+      std::ofstream out(tmpfile);
+      out << text;
+      if (!out.good()) {
+        unlink(tmpfile.c_str());
+        return;
+      }
+    }
+    if (rename(tmpfile.c_str(), filename.c_str()) != 0)
+      unlink(tmpfile.c_str());
+  }
+
+  /// The manifest of a compiler invocation for the direct mode of
+  /// chash-collect ("manifest") or its token prefilter ("tokens").
+  /// Invocations are keyed like entries.
+  std::string manifest_filename(std::string objectfile, std::string key,
+                                std::string kind = "manifest") {
+    if (m_cachedir == "")
+      return objectfile + ".hash." + kind;
+    make_cache_dirs(key);
+    return cache_filename(key) + "." + kind;
+  }
+
+  /// Uploads a new cache entry to the remote cache in the background.
+  /// The accompanying files go first, so that they are there with the
+  /// object.
+  void upload(std::string hash) {
+    if (!m_remote.enabled())
+      return;
+    RemoteCache::Uploads files;
+    std::string path(cache_filename(hash));
+    struct stat dummy;
+    for (const std::string &suffix : sidecar_suffixes()) {
+      if (stat((path + suffix).c_str(), &dummy) == 0)
+        files.emplace_back(hash + "." + m_kind + suffix, path + suffix);
+    }
+    files.emplace_back(hash + "." + m_kind, path);
+    m_remote.put_async(files);
+  }
+
+  /// The ccache stats file that counts the entry, or an empty string
+  std::string stats_filename(std::string hash) {
+    if (!m_ccache)
+      return "";
+    return m_cachedir + "/" + hash.substr(0, 1) + "/stats";
+  }
+
+  /// Adds to the counters of a ccache stats file. Like ccache, we
+  /// replace the file atomically; concurrent updates may lose counts,
+  /// but `ccache -c` recounts the files and their size.
+  static void update_stats(std::string statsfile, unsigned counter,
+                           unsigned long value,
+                           unsigned long stored_kib = 0) {
+    if (statsfile == "")
+      return;
+    std::vector<unsigned long> counters(CCACHE_STATS_END, 0);
+    {
+      std::ifstream in(statsfile);
+      unsigned long number;
+      for (size_t i = 0; in >> number; ++i) {
+        if (i >= counters.size())
+          counters.resize(i + 1, 0);
+        counters[i] = number;
+      }
+    }
+    counters[counter] += value;
+    if (stored_kib) {
+      counters[CCACHE_STATS_NUMFILES] += 1;
+      counters[CCACHE_STATS_TOTALSIZE] += stored_kib;
+    }
+    std::string tmpfile(statsfile + ".tmp." + std::to_string(getpid()));
+    {
+      std::ofstream out(tmpfile);
+      for (unsigned long number : counters)
+        out << number << "\n";
+      if (!out.good()) {
+        unlink(tmpfile.c_str());
+        return;
+      }
+    }
+    if (rename(tmpfile.c_str(), statsfile.c_str()) != 0)
+      unlink(tmpfile.c_str());
+  }
+
+  /// Counts a hit in the ccache stats. Like ccache, we touch the entry,
+  /// as the cleanup evicts the least recently used files.
+  void record_hit(std::string hash) {
+    if (!m_ccache)
+      return;
+    utime(cache_filename(hash).c_str(), NULL);
+    update_stats(stats_filename(hash), CCACHE_STATS_CACHEHIT_CPP, 1);
+  }
+
+  /// Counts a stored cache entry in the ccache stats
+  static void record_store(std::string statsfile, std::string path) {
+    struct stat st;
+    if (statsfile == "" || stat(path.c_str(), &st) != 0)
+      return;
+    update_stats(statsfile, CCACHE_STATS_TOCACHE, 1,
+                 std::max<unsigned long>(1, (st.st_size + 1023) / 1024));
+  }
+
+  std::string find_object_from_hash(std::string objectfile, std::string hash) {
+    if (m_cachedir != "") {
+      std::string ObjectPath(cache_filename(hash));
+      struct stat dummy;
+      if (stat(ObjectPath.c_str(), &dummy) == 0) {
+        // Found!
+        return ObjectPath;
+      }
+      if (m_remote.enabled()) {
+        make_cache_dirs(hash);
+        // The object becomes visible after its accompanying files
+        std::string tmpfile(ObjectPath + ".remote." + std::to_string(getpid()));
+        // The object and its accompanying files share the time limit
+        const RemoteCache::time_point deadline = m_remote.deadline();
+        if (m_remote.get(hash + "." + m_kind, tmpfile, deadline)) {
+          for (const std::string &suffix : sidecar_suffixes())
+            m_remote.get(hash + "." + m_kind + suffix, ObjectPath + suffix,
+                         deadline);
+          if (rename(tmpfile.c_str(), ObjectPath.c_str()) != 0) {
+            unlink(tmpfile.c_str());
+            return "";
+          }
+          if (m_terminal) {
+            (*m_terminal) << "remote-hit: " << hash << "\n";
+          }
+          return ObjectPath;
+        }
+      }
+      return "";
+    } else {
+      std::string OldHash;
+      std::string HashPath(objectfile + ".hash");
+      std::string ObjectPath(local_copy_filename(objectfile));
+      std::ifstream FileStream(HashPath);
+      if (FileStream.good()) {
+        getline(FileStream, OldHash);
+        if (m_terminal) {
+          (*m_terminal) << HashPath << ": old hash string: " << OldHash << "\n";
+        }
+      } else {
+        if (m_terminal) {
+          (*m_terminal) << "Warning: could not open file \"" << HashPath
+                        << "\", cannot read previous hash.\n";
+        }
+        return "";
+      }
+
+      // Hashes are equal, try to find the objectfile
+      if (hash == OldHash) {
+        struct stat dummy;
+        if (stat(ObjectPath.c_str(), &dummy) == 0) {
+          // Found!
+          return ObjectPath;
+        }
+      }
+      return "";
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef __CHASH_REMOTE_CACHE
+#define __CHASH_REMOTE_CACHE
+
+/*
+ * A remote object cache, shared by many build machines. The protocol
+ * is plain HTTP/1.0: the object with hash <hash> and kind <kind> is
+ * stored with `PUT <prefix>/<hash>.<kind>` and fetched with
+ * `GET <prefix>/<hash>.<kind>`. Any web server with PUT support works;
+ * tools/chash-cache-server is a small reference server.
+ *
+ *   CLANG_HASH_REMOTE          http://<host>[:<port>][/<prefix>]
+ *   CLANG_HASH_REMOTE_TIMEOUT  time limit of a lookup in ms (500)
+ *
+ * A lookup never takes longer than the time limit, a slow or
+ * unreachable server is a miss. This includes the name resolution:
+ * host names are resolved in a child process, which is abandoned at
+ * the time limit; numeric addresses need no resolution. Uploads run in
+ * a detached process, so the compiler does not wait for them.
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+struct RemoteCache {
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  std::string m_host;
+  std::string m_port;
+  std::string m_prefix;
+  int m_timeout_ms;
+
+  RemoteCache() : m_timeout_ms(500) {}
+
+  /// The remote cache of the environment. Without CLANG_HASH_REMOTE,
+  /// or with an unsupported URL, the cache is disabled.
+  static RemoteCache from_environment() {
+    RemoteCache cache;
+    const char *url = getenv("CLANG_HASH_REMOTE");
+    const char *timeout = getenv("CLANG_HASH_REMOTE_TIMEOUT");
+    if (url)
+      cache.parse_url(url);
+    if (timeout && atoi(timeout) > 0)
+      cache.m_timeout_ms = atoi(timeout);
+    return cache;
+  }
+
+  bool enabled() const { return m_host != ""; }
+
+  bool parse_url(std::string url) {
+    if (url.compare(0, 7, "http://") != 0)
+      return false;
+    url = url.substr(7);
+    const size_t slash = url.find('/');
+    std::string authority = url.substr(0, slash);
+    m_prefix = slash == std::string::npos ? "" : url.substr(slash);
+    while (m_prefix != "" && m_prefix[m_prefix.size() - 1] == '/')
+      m_prefix.erase(m_prefix.size() - 1);
+    const size_t colon = authority.rfind(':');
+    m_host = authority.substr(0, colon);
+    m_port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+    return m_host != "";
+  }
+
+  /// The end of a lookup that starts now
+  time_point deadline() const {
+    return std::chrono::steady_clock::now() +
+           std::chrono::milliseconds(m_timeout_ms);
+  }
+
+  /// Fetches an object into path. Returns false on a miss, an error,
+  /// or if the deadline passes. The requests of one lookup share the
+  /// deadline.
+  bool get(std::string key, std::string path, time_point deadline) const {
+    int fd = connect_to(deadline);
+    if (fd < 0)
+      return false;
+
+    std::string request = "GET " + m_prefix + "/" + key +
+                          " HTTP/1.0\r\nHost: " + host_header() + "\r\n\r\n";
+    std::string response;
+    bool ok = send_all(fd, request.data(), request.size(), deadline) &&
+              receive_all(fd, response, deadline);
+    close(fd);
+
+    const size_t body = response.find("\r\n\r\n");
+    if (!ok || body == std::string::npos || status(response) != 200)
+      return false;
+
+    // Write to a temporary file first, so that concurrent
+    // compilations never see a partial object
+    std::string tmpfile = path + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmpfile.c_str(), "w");
+    if (!out)
+      return false;
+    const size_t length = response.size() - body - 4;
+    ok = fwrite(response.data() + body + 4, 1, length, out) == length;
+    if (fclose(out) != 0 || !ok || rename(tmpfile.c_str(), path.c_str()) != 0) {
+      unlink(tmpfile.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /// Uploads the file at path. Returns false, if the server did not
+  /// accept the object.
+  bool put(std::string key, std::string path) const {
+    std::string data;
+    FILE *in = fopen(path.c_str(), "r");
+    if (!in)
+      return false;
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+      data.append(buffer, length);
+    fclose(in);
+
+    // Uploads are in the background, so they get more time
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(30 * 1000);
+    int fd = connect_to(deadline);
+    if (fd < 0)
+      return false;
+    std::string request = "PUT " + m_prefix + "/" + key +
+                          " HTTP/1.0\r\nHost: " + host_header() +
+                          "\r\nContent-Length: " +
+                          std::to_string(data.size()) + "\r\n\r\n";
+    std::string response;
+    bool ok = send_all(fd, request.data(), request.size(), deadline) &&
+              send_all(fd, data.data(), data.size(), deadline) &&
+              receive_all(fd, response, deadline);
+    close(fd);
+    const int code = status(response);
+    return ok && code >= 200 && code < 300;
+  }
+
+  typedef std::vector<std::pair<std::string, std::string>> Uploads;
+
+  /// Uploads the files (key, path) in order in a detached process and
+  /// returns immediately
+  void put_async(const Uploads &files) const {
+    pid_t child = fork();
+    if (child < 0)
+      return;
+    if (child == 0) {
+      // The grandchild is adopted by init, nobody waits for it
+      if (fork() == 0) {
+        // Do not keep the output pipes of the build system open
+        setsid();
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+          dup2(null, STDIN_FILENO);
+          dup2(null, STDOUT_FILENO);
+          dup2(null, STDERR_FILENO);
+          close(null);
+        }
+        for (const auto &file : files) {
+          if (!put(file.first, file.second))
+            break;
+        }
+      }
+      _exit(0);
+    }
+    int status;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+private:
+  static int remaining_ms(time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    return left.count() > 0 ? (int)left.count() : 0;
+  }
+
+  static bool wait_for(int fd, short events, time_point deadline) {
+    struct pollfd pfd = {fd, events, 0};
+    for (;;) {
+      int ready = poll(&pfd, 1, remaining_ms(deadline));
+      if (ready > 0)
+        return true;
+      if (ready == 0 || errno != EINTR)
+        return false;
+    }
+  }
+
+  /// The Host header names the port, if it is not the default one
+  std::string host_header() const {
+    return m_port == "80" ? m_host : m_host + ":" + m_port;
+  }
+
+  /// An address of the server: the family and the socket address
+  typedef std::pair<int, std::string> Address;
+
+  static void add_addresses(const struct addrinfo *ai,
+                            std::vector<Address> &result) {
+    for (; ai; ai = ai->ai_next)
+      result.emplace_back(ai->ai_family,
+                          std::string((const char *)ai->ai_addr, ai->ai_addrlen));
+  }
+
+  /// Resolves the host before the deadline. getaddrinfo() has no time
+  /// limit of its own, so a host name is resolved in a child process,
+  /// which sends the addresses through a pipe and is killed at the
+  /// deadline.
+  bool resolve(time_point deadline, std::vector<Address> &result) const {
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    int error = getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &addresses);
+    if (error == 0) {
+      add_addresses(addresses, result);
+      freeaddrinfo(addresses);
+      return true;
+    }
+    if (error != EAI_NONAME)
+      return false;
+
+    int fds[2];
+    if (pipe(fds) != 0)
+      return false;
+    pid_t child = fork();
+    if (child < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      return false;
+    }
+    if (child == 0) {
+      close(fds[0]);
+      hints.ai_flags = 0;
+      if (getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &addresses) == 0) {
+        // Each address is its family, its length, and the address
+        for (struct addrinfo *ai = addresses; ai; ai = ai->ai_next) {
+          const int header[2] = {ai->ai_family, (int)ai->ai_addrlen};
+          if (write(fds[1], header, sizeof(header)) != sizeof(header) ||
+              write(fds[1], ai->ai_addr, ai->ai_addrlen) !=
+                  (ssize_t)ai->ai_addrlen)
+            break;
+        }
+      }
+      _exit(0);
+    }
+    close(fds[1]);
+    std::string data;
+    const bool ok = receive_all(fds[0], data, deadline);
+    close(fds[0]);
+    if (!ok)
+      kill(child, SIGKILL);
+    while (waitpid(child, nullptr, 0) < 0 && errno == EINTR)
+      ;
+    if (!ok)
+      return false;
+    size_t pos = 0;
+    int header[2];
+    while (pos + sizeof(header) <= data.size()) {
+      memcpy(header, data.data() + pos, sizeof(header));
+      pos += sizeof(header);
+      if (header[1] < 0 || pos + header[1] > data.size())
+        break;
+      result.emplace_back(header[0], data.substr(pos, header[1]));
+      pos += header[1];
+    }
+    return !result.empty();
+  }
+
+  /// Connects without blocking longer than the deadline
+  int connect_to(time_point deadline) const {
+    std::vector<Address> addresses;
+    if (!resolve(deadline, addresses))
+      return -1;
+    int fd = -1;
+    for (size_t i = 0; i < addresses.size() && fd < 0; ++i) {
+      const Address &address = addresses[i];
+      fd = socket(address.first, SOCK_STREAM, 0);
+      if (fd < 0)
+        continue;
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (connect(fd, (const struct sockaddr *)address.second.data(),
+                  address.second.size()) != 0 &&
+          (errno != EINPROGRESS || !wait_for(fd, POLLOUT, deadline) ||
+           getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 ||
+           error != 0)) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    return fd;
+  }
+
+  static bool send_all(int fd, const char *data, size_t length,
+                       time_point deadline) {
+    while (length > 0) {
+      if (!wait_for(fd, POLLOUT, deadline))
+        return false;
+      ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        return false;
+      if (n > 0) {
+        data += n;
+        length -= n;
+      }
+    }
+    return true;
+  }
+
+  /// Reads until the server closes the connection (HTTP/1.0). Also
+  /// reads the pipe of the resolver, so this uses read(), not recv().
+  static bool receive_all(int fd, std::string &data, time_point deadline) {
+    char buffer[65536];
+    for (;;) {
+      if (!wait_for(fd, POLLIN, deadline))
+        return false;
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n == 0)
+        return true;
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        return false;
+      if (n > 0)
+        data.append(buffer, n);
+    }
+  }
+
+  static int status(const std::string &response) {
+    // HTTP/1.x <code> <reason>
+    const size_t space = response.find(' ');
+    if (response.compare(0, 5, "HTTP/") != 0 || space == std::string::npos)
+      return 0;
+    return atoi(response.c_str() + space + 1);
+  }
+};
+
+#endif
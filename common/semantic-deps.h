@@ -0,0 +1,108 @@
+#ifndef __CHASH_SEMANTIC_DEPS
+#define __CHASH_SEMANTIC_DEPS
+
+/*
+ * The semantic dependencies of a translation unit: the files that
+ * influence its hash, instead of all files it includes. A header
+ * belongs to them, if a hashed declaration is in it, if it defines a
+ * macro that was expanded or tested, if it has a conditional other
+ * than its include guard, or if it includes such a header.
+ *
+ *   CLANG_HASH_SEMANTIC_DEPS=1   record the semantic dependencies
+ *
+ * They are stored with absolute paths in <objectfile>.hash.deps, and
+ * the dependency file of -MD/-MMD is narrowed to them, so that make
+ * and ninja no longer rebuild an object for headers it does not use.
+ * tools/chash-affected tells the objects a header change affects.
+ *
+ * A header that only adds a declaration or a macro that was unused
+ * before (e.g. a better overload) is not noticed.
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+struct SemanticDeps {
+  std::vector<std::string> m_files;
+
+  static bool enabled() {
+    const char *value = getenv("CLANG_HASH_SEMANTIC_DEPS");
+    return value && *value && std::string(value) != "0";
+  }
+
+  static std::string filename(std::string objectfile) {
+    return objectfile + ".hash.deps";
+  }
+
+  bool read(std::string path) {
+    std::ifstream in(path);
+    if (!in.good())
+      return false;
+    std::string line;
+    while (getline(in, line)) {
+      if (line != "")
+        m_files.push_back(line);
+    }
+    return !in.bad();
+  }
+
+  bool write(std::string path) const {
+    std::string data;
+    for (const std::string &file : m_files)
+      data += file + "\n";
+    return replace_file(path, data);
+  }
+
+  /// Writes a make dependency file like -MD: the targets depend on
+  /// the files, with -MP, the headers also become phony targets.
+  static bool write_depfile(std::string path, std::string targets,
+                            const std::vector<std::string> &files,
+                            bool phony) {
+    std::string data = targets + ":";
+    for (const std::string &file : files)
+      data += " \\\n  " + escape(file);
+    data += "\n";
+    for (size_t i = 1; phony && i < files.size(); ++i)
+      data += "\n" + escape(files[i]) + ":\n";
+    return replace_file(path, data);
+  }
+
+  /// Quotes a file name for make
+  static std::string escape(const std::string &file) {
+    std::string escaped;
+    for (char c : file) {
+      if (c == ' ' || c == '#')
+        escaped += '\\';
+      else if (c == '$')
+        escaped += '$';
+      escaped += c;
+    }
+    return escaped;
+  }
+
+private:
+  static bool replace_file(std::string path, const std::string &data) {
+    std::string tmpfile(path + ".tmp." + std::to_string(getpid()));
+    {
+      std::ofstream out(tmpfile, std::ios::binary);
+      out << data;
+      if (!out.good()) {
+        unlink(tmpfile.c_str());
+        return false;
+      }
+    }
+    if (rename(tmpfile.c_str(), path.c_str()) != 0) {
+      unlink(tmpfile.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __CHASH_STATS_LOG
+#define __CHASH_STATS_LOG
+
+/*
+ * The statistics log records every hit and miss of the object cache
+ * with the times of the compilation:
+ *
+ *   CLANG_HASH_STATS   the log file, tools/chash-stats reports on it
+ *
+ * Every record is appended with a single write to the file opened
+ * with O_APPEND, so concurrent compilations need no lock. A record
+ * is binary, little-endian:
+ *
+ *   "CHS1", u32 record size, u8 event ('H', 'M'),
+ *   u64 time (end of the compilation, ns since the epoch),
+ *   u64 parse, hash, and compile time (ns),
+ *   u64 saved time (ns, hits: compile time of the stored miss),
+ *   u64 object size, u32 + bytes object file, u32 + bytes reason
+ *
+ * The reason is the explanation of a miss (see decl-table.h).
+ *
+ * This header must be usable without the LLVM or GCC headers.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+struct StatsRecord {
+  char m_event = 'M';
+  uint64_t m_time = 0;
+  uint64_t m_parse_time = 0;
+  uint64_t m_hash_time = 0;
+  uint64_t m_compile_time = 0;
+  uint64_t m_saved_time = 0;
+  uint64_t m_object_size = 0;
+  std::string m_objectfile;
+  std::string m_reason;
+
+  /// The log file of the environment, or an empty string
+  static std::string log_filename() {
+    const char *path = getenv("CLANG_HASH_STATS");
+    return path ? path : "";
+  }
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /// Object files are recorded with their absolute path, so that the
+  /// report can group them by directory
+  void set_objectfile(std::string path) {
+    char cwd[4096];
+    if (path != "" && path[0] != '/' && getcwd(cwd, sizeof(cwd)))
+      path = std::string(cwd) + "/" + (path.compare(0, 2, "./") == 0 ? path.substr(2) : path);
+    m_objectfile = path;
+  }
+
+  /// Joins the reasons of a miss; very long explanations are cut
+  void set_reason(const std::vector<std::string> &reasons) {
+    m_reason = "";
+    for (const std::string &reason : reasons) {
+      if (m_reason.size() + reason.size() > 4096) {
+        m_reason += "\n...";
+        break;
+      }
+      m_reason += (m_reason == "" ? "" : "\n") + reason;
+    }
+  }
+
+  std::string encode() const {
+    std::string data("CHS1");
+    put(data, (uint32_t)0);
+    data += m_event;
+    for (uint64_t value : {m_time, m_parse_time, m_hash_time, m_compile_time,
+                           m_saved_time, m_object_size})
+      put(data, value);
+    put(data, (uint32_t)m_objectfile.size());
+    data += m_objectfile;
+    put(data, (uint32_t)m_reason.size());
+    data += m_reason;
+    std::string size;
+    put(size, (uint32_t)data.size());
+    data.replace(4, 4, size);
+    return data;
+  }
+
+  /// Decodes the record at data[pos] and advances pos. Returns false
+  /// at the end or on a damaged record.
+  bool decode(const std::string &data, size_t &pos) {
+    if (pos + 8 > data.size() || data.compare(pos, 4, "CHS1") != 0)
+      return false;
+    const uint64_t size = get(data, pos + 4, 4);
+    if (size < 65 || pos + size > data.size())
+      return false;
+    const size_t end = pos + size;
+    size_t p = pos + 8;
+    m_event = data[p++];
+    uint64_t *fields[] = {&m_time, &m_parse_time, &m_hash_time,
+                          &m_compile_time, &m_saved_time, &m_object_size};
+    for (uint64_t *field : fields) {
+      *field = get(data, p, 8);
+      p += 8;
+    }
+    for (std::string *text : {&m_objectfile, &m_reason}) {
+      const uint64_t length = get(data, p, 4);
+      p += 4;
+      if (p + length > end)
+        return false;
+      *text = data.substr(p, length);
+      p += length;
+    }
+    pos = end;
+    return true;
+  }
+
+  /// Appends the record to the log; a missing log is no error
+  void append(std::string path) const {
+    if (path == "")
+      return;
+    int fd = open(path.c_str(), O_APPEND | O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+      return;
+    const std::string data(encode());
+    if (write(fd, data.data(), data.size()) < 0)
+      perror(path.c_str());
+    close(fd);
+  }
+
+  /// Reads all records of a log. Damaged records are skipped.
+  static bool read_log(std::string path, std::vector<StatsRecord> &records) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good())
+      return false;
+    const std::string data((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (pos < data.size()) {
+      StatsRecord record;
+      if (record.decode(data, pos)) {
+        records.push_back(record);
+      } else {
+        // Resynchronize at the next record
+        pos = data.find("CHS1", pos + 1);
+        if (pos == std::string::npos)
+          break;
+      }
+    }
+    return true;
+  }
+
+private:
+  static void put(std::string &data, uint64_t value, unsigned bytes = 8) {
+    for (unsigned i = 0; i < bytes; ++i)
+      data += (char)((value >> (8 * i)) & 0xff);
+  }
+
+  static void put(std::string &data, uint32_t value) { put(data, value, 4); }
+
+  static uint64_t get(const std::string &data, size_t pos, unsigned bytes) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < bytes && pos + i < data.size(); ++i)
+      value |= (uint64_t)(unsigned char)data[pos + i] << (8 * i);
+    return value;
+  }
+};
+
+#endif
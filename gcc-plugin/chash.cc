@@ -8,15 +8,37 @@
  *
  * [2] cHash: Detection of Redundant Compilations via AST Hashing
  *     https://lab.sra.uni-hannover.de/Research/cHash/usenix-atc-2017.html
+ *
+ * Plugin arguments (-fplugin-arg-libgcc-hash-<arg>):
+ *
+ *   hash-verbose        print the hashes in the clang-hash format
+ *   hash-gimple         hash the functions after the early GIMPLE
+ *                       optimizations instead of their GENERIC trees
+ *   stop-if-same-hash   reuse the cached compiler output on a hit
+ *   objectfile=<path>   name of the resulting object file. Required
+ *                       for stop-if-same-hash without CLANG_HASH_CACHE
+ *                       or CLANG_HASH_CCACHE.
  */
 
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Hash.h"
+#include "command-line.h"
+#include "decl-table.h"
+#include "object-cache.h"
+#include "stats-log.h"
 
 #include "gcc-common.h"
 #include "chash.h"
 #include "tree.h"
+#include "hash-visitor.h"
 
 int plugin_is_GPL_compatible;
 
@@ -25,13 +47,41 @@ struct plugin_info chash_plugin_info = {
     .help = "cHash AST hashing\n"
 };
 
-#define dump_file stderr
+typedef std::chrono::high_resolution_clock chash_clock;
+
+static struct {
+    bool verbose;
+    bool stop_if_same_hash;
+    bool gimple;
+    std::string objectfile;
+} chash_options;
+
+// A hashed top-level definition. The name and the used definitions
+// are formatted like the element-hashes of the clang plugin.
+struct chash_element {
+    std::string name;
+    Hash::Digest digest;
+    std::set<std::string> uses;
+    std::string file;
+
+    bool operator<(const chash_element &other) const {
+        if (name != other.name)
+            return name < other.name;
+        return digest.asString() < other.digest.asString();
+    }
+};
+
+static CHashVisitor chash_visitor;
+static std::vector<chash_element> chash_elements;
+
+static chash_clock::time_point chash_start_compilation;
+static chash_clock::duration chash_hash_time;
 
-#define debug_printf(args...) do {              \
-        if (dump_file) {                        \
-            fprintf(dump_file, args);           \
-        }                                       \
-    } while(0)
+static std::string chash_hash_new;
+static std::string chash_hashfile;
+static std::string chash_objectcopy;
+static std::string chash_statsfile;
+static StatsRecord chash_stats;
 
 /*
  * Return the call graph node of fndecl.
@@ -47,179 +97,414 @@ struct cgraph_node *get_fn_cnode(const_tree fndecl)
 }
 
 /*
- * Pass to calculate the AST hash
+ * The source file of a declaration, relative to the base directory.
+ */
+static std::string chash_symbol_file(tree decl)
+{
+    std::string filename = relativeToBaseDir(DECL_SOURCE_FILE(decl));
+    if (filename.compare(0, 2, "./") == 0)
+        filename = filename.substr(2);
+    return filename;
+}
+
+/*
+ * Symbol names are compatible with the clang plugin: functions and
+ * variables with internal linkage get the filename appended.
+ */
+static std::string chash_symbol_name(tree decl)
+{
+    const bool is_static = !TREE_PUBLIC(decl);
+    std::string name = is_static ? "static " : "";
+    name += TREE_CODE(decl) == FUNCTION_DECL ? "function:" : "variable:";
+    name += IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(decl));
+    if (is_static)
+        name += ":" + chash_symbol_file(decl);
+    return name;
+}
+
+static void chash_log_event(const char *event)
+{
+    if (getenv("CLANG_HASH_LOGFILE")) {
+        int fd = open(getenv("CLANG_HASH_LOGFILE"),
+                      O_APPEND | O_WRONLY | O_CREAT, 0644);
+        if (fd >= 0) {
+            write(fd, event, 1);
+            close(fd);
+        }
+    }
+}
+
+static bool chash_copy_stream(FILE *in, FILE *out)
+{
+    char buffer[BUFSIZ];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, len, out) != len)
+            return false;
+    }
+    return !ferror(in);
+}
+
+/*
+ * Pass to calculate the AST hash of every function definition.
  */
 extern "C" void chash_ast_hash_execute(void *gcc_data, void*) {
+    if (chash_options.gimple)
+        return;
+
     tree fndecl = (tree)gcc_data;
-    
-    int code = TREE_CODE(fndecl);
-    if(code==FUNCTION_DECL){
-        tree rType = TREE_TYPE(DECL_RESULT(fndecl)),   
-            arguments = DECL_ARGUMENTS(fndecl),
-            body = DECL_SAVED_TREE(fndecl);
-        printf("Function decl:\n");
-        printf("Name:\t\t\t\t\t%s\n", IDENTIFIER_POINTER(DECL_NAME(fndecl)));
-        printf("Type of return value:\t\t\t%s\n", get_tree_code_name(TREE_CODE(rType)));
-        tree_statement_list_node* tmp= STATEMENT_LIST_HEAD(body);
-        // printf("bodyparsing\n");
-        // while(tmp!=0){
-        //     int i=0;
-        //     tree tmp2=TREE_OPERAND(tmp->stmt,i);
-        //     while(tmp2!=0)
-        //     {
-        //         printf("%s\n", get_tree_code_name(TREE_CODE(tmp2)));
-        //         tmp2 = TREE_OPERAND(tmp->stmt,++i);
-        //     }
-        //     tmp= tmp->next;
-        // }
-        // printf("bodyparsing\n");
-        printf("<%s ", get_tree_code_name(TREE_CODE(body)));
-        printf("%p\n", body);
-        printf("\ttype <%s ", get_tree_code_name(TREE_CODE(TREE_TYPE(body))));
-        printf("%p\n", TREE_TYPE(body));
-        printf("\t\talign %i ", TYPE_ALIGN(TREE_TYPE(body)));
-        printf("canonical type %p\n", TYPE_CANONICAL(TREE_TYPE(body)));
-        printf("\t\tpointer_to_this <%s ", get_tree_code_name(TREE_CODE(TYPE_POINTER_TO(TREE_TYPE(body)))));
-        printf("%p>>\n", TYPE_POINTER_TO(TREE_TYPE(body)));
-
-        printf("\t%s ", TREE_SIDE_EFFECTS(body)?"side-effects":"");
-        printf("head %p ", tmp);
-        printf("tail %p ", STATEMENT_LIST_TAIL(body));
-        printf("stmts %p ", tmp->stmt);
-        printf("%p\n\n", STATEMENT_LIST_TAIL(body)->stmt);
-        // printf("%p\n", debug_tree(TREE_SIDE_EFFECTS(body)));
-        debug_tree(body);
-        // debug_tree(COMPOUND_STMT(body));
-        // if(body != 0){
-        //     printf("****\n");
-        //     //printf(":\t\t\t%s\n", get_tree_code_name(TREE_CODE(body)));
-        //     // tree chain = BLOCK_VARS(body);
-        //     // // chain = chain ? BLOCK_CHAIN(chain) : 0;
-        //     // printf("%s\n", chain == 0 ? "no chain": "chain");
-        //     // while (chain != 0){
-        //     //     printf("%s %p ", get_tree_code_name(TREE_CODE(chain)), chain);
-        //     //     chain = TREE_CHAIN(chain);
-        //     // }
-        //     printf("\n");
-        // }
-        
-
-        // while(1){ // Will only run once. Special attributes.
-        //     if (DECL_FUNCTION_SPECIFIC_TARGET (fndecl)){
-        //         printf("%s\n", "1");
-        //         break;
-        //     }
-        //     if (DECL_FUNCTION_SPECIFIC_OPTIMIZATION (fndecl)){
-        //         printf("%s\n", "2");
-        //         break;
-        //     }
-        //     if (DECL_DECLARED_INLINE_P (fndecl)){
-        //         printf("%s\n", "inlined");
-        //         break;
-        //     }
-        //     if (DECL_BUILT_IN (fndecl)){
-        //         printf("%s\n", "4");
-        //         break;
-        //         }
-        //     if (DECL_STATIC_CHAIN (fndecl)){
-        //         printf("%s\n", "5");
-        //         break;
-        //     }
-        //     if (decl_is_tm_clone (fndecl)){
-        //         printf("%s\n", "6");
-        //         break;
-        //     }
-        //     printf("No special Attributes\n");
-        //     break;
-        // }
-
-        // // while(body != 0 ){
-        // //     printf(":\t\t\t%s\n", IDENTIFIER_POINTER(DECL_NAME(body)));
-        // //     body = TREE_CHAIN(body);
-        // // }
-        // while(arguments!=0){ // Parse all arguments of the fndecltion
-        //     printf("%s\n", get_tree_code_name(TREE_CODE(DECL_ARG_TYPE(arguments))));
-        //     arguments = TREE_CHAIN(arguments);
-        // }
-        printf("\n");
-    }
-        // // int dExt = DECL_EXTERNAL(node->decl);
-        // // printf("fndecltion is undefined?\t\t\t%s\n", dExt == 1 ? "true" : dExt == 0 ? "false" : "cHash Error");
-        // // int tPub = TREE_PUBLIC(node->decl);
-        // // printf("fndecltion has external linkage?\t\t%s\n", tPub == 1 ? "true" : tPub == 0 ? "false" : "cHash Error");
-        // // int tStatic = TREE_STATIC(node->decl);
-        // // printf("fndecltion has been defined?\t\t%s\n", tStatic == 1 ? "true" : tStatic == 0 ? "false" : "cHash Error");
-        // // int tVol = TREE_THIS_VOLATILE(node->decl);
-        // // printf("fndecltion does not return normally?\t%s\n", tVol == 1 ? "true" : tVol == 0 ? "false" : "cHash Error");
-        // // int tRO = TREE_READONLY(node->decl);
-        // // printf("fndecltion can only read its arguments?\t%s\n", tRO == 1 ? "true" : tRO == 0 ? "false" : "cHash Error");
-        // // int dPureP = DECL_PURE_P(node->decl);
-        // // printf("fndecltion can only read its arguments, but may read globally?\t%s\n", dPureP == 1 ? "true" : dPureP == 0 ? "false" : "cHash Error");
-        // // int dVirP = DECL_VIRTUAL_P(node->decl);
-        // // printf("fndecltion is virtual?\t\t\t%s\n", dVirP == 1 ? "true" : dVirP == 0 ? "false" : "cHash Error");
-        // // int dArt = DECL_ARTIFICIAL(node->decl);
-        // // printf("fndecltion was implicitly generated by the compiler, rather than explicitly declared. In addition to implicitly generated class member fndecltions, this macro holds for the special fndecltions created to implement static initialization and destruction, to compute run-time type information, and so forth.\t%s\n", dArt == 1 ? "true" : dArt == 0 ? "false" : "o no");
-        // // printf("%p\n", DECL_fndeclTION_SPECIFIC_TARGET(node->decl)); // ??
-        // // printf("%p\n", DECL_fndeclTION_SPECIFIC_OPTIMIZATION(node->decl)); // ??
-        // // printf("Mangled name of the fndecltion.\t\t%p\n", DECL_ASSEMBLER_NAME(node->decl)); // ??
-        // // printf("First parameter type.\t\t\t%p\n", DECL_ARGUMENTS(node->decl)); // ??
-        // // printf("First parameter type.\t\t\t%p\n", DECL_ARGUMENTS(node->decl)); // ??
-        // // printf("fndecltion return type.\t\t\t%p\n", DECL_RESULT(node->decl)); // ??
-        // // printf("fndecltion return type.\t\t\t%p\n", TYPE_CANONICAL(DECL_RESULT(node->decl))); // ??
-        // // woher bekomme ich vergleichswerte?
-        // // printf("null: %i, enum: %i, bool: %i, int: %i, real: %i, pointer: %i, reference: %i, fixed point: %i, complex: %i, void: %i, fndecltion: %i\n", NULL_TREE, ENUMERAL_TYPE, BOOLEAN_TYPE, INTEGER_TYPE, REAL_TYPE, POINTER_TYPE, REFERENCE_TYPE, FIXED_POINT_TYPE, COMPLEX_TYPE, VOID_TYPE, fndeclTION_TYPE);
-        // // printf("fndecltion body.\t\t\t\t%p\n", DECL_SAVED_TREE(node->decl)); // ??
-        // // printf("fndecltion type.\t\t\t\t%p\n", &(TREE_TYPE(node->decl))); // ??
-        // printf("\n");
-
-       
-        //debug_tree(((union tree_node *)(const union tree_node *)(node->decl)));
-    //}
+    if (TREE_CODE(fndecl) != FUNCTION_DECL || !DECL_SAVED_TREE(fndecl))
+        return;
+
+    const chash_clock::time_point start = chash_clock::now();
+    chash_element element;
+    element.name = chash_symbol_name(fndecl);
+    element.file = chash_symbol_file(fndecl);
+    element.digest = chash_visitor.hashFunction(fndecl);
+    chash_elements.push_back(element);
+    chash_hash_time += chash_clock::now() - start;
+}
+
+/*
+ * GIMPLE pass to calculate the hash of every function after the early
+ * optimizations. Code that is folded away (dead code under constant
+ * conditions, unused static functions) does not influence the hash.
+ */
+static bool chash_gimple_hash_gate(void)
+{
+    return chash_options.gimple;
+}
+
+static unsigned int chash_gimple_hash_execute(void)
+{
+    const chash_clock::time_point start = chash_clock::now();
+    chash_element element;
+    element.name = chash_symbol_name(current_function_decl);
+    element.file = chash_symbol_file(current_function_decl);
+    element.digest = chash_visitor.hashGimpleFunction(current_function_decl, cfun);
+    chash_elements.push_back(element);
+    chash_hash_time += chash_clock::now() - start;
+    return 0;
+}
+
+#define PASS_NAME chash_gimple_hash
+#define PROPERTIES_REQUIRED PROP_cfg
+#include "gcc-generate-gimple-pass.h"
+
+static bool chash_is_function_local(tree decl)
+{
+    return DECL_CONTEXT(decl) && TREE_CODE(DECL_CONTEXT(decl)) == FUNCTION_DECL;
+}
+
+/*
+ * The definitions a symbol uses: called functions, functions whose
+ * address is taken, and referenced global variables.
+ */
+static std::set<std::string> chash_symbol_uses(symtab_node *node)
+{
+    std::set<std::string> uses;
+    if (cgraph_node *cnode = dyn_cast<cgraph_node *>(node)) {
+        for (cgraph_edge *edge = cnode->callees; edge; edge = edge->next_callee)
+            uses.insert(chash_symbol_name(NODE_DECL(edge->callee)));
+    }
+    ipa_ref *ref;
+    for (unsigned i = 0; node->iterate_reference(i, ref); i++) {
+        tree decl = NODE_DECL(ref->referred);
+        if (TREE_CODE(decl) == VAR_DECL && chash_is_function_local(decl))
+            continue;
+        uses.insert(chash_symbol_name(decl));
+    }
+    return uses;
 }
 
+/*
+ * Combine all function and variable hashes to the unit hash. This
+ * simple IPA pass runs before the early optimizations (AST hashing) or
+ * after them (hash-gimple), and therefore before any RTL has been
+ * generated. If the hash matches the cached one, we reuse the cached
+ * assembler output and exit.
+ *
+ * Since the call graph and the references are complete here, we also
+ * record the used definitions of every element for clang-hash-global.
+ */
+static unsigned int chash_unit_hash_execute(void)
+{
+    if (seen_error())
+        return 0;
+
+    const chash_clock::time_point start_hashing = chash_clock::now();
+
+    std::map<std::string, std::set<std::string>> uses;
+    cgraph_node_ptr cnode;
+    FOR_EACH_FUNCTION(cnode) {
+        uses[chash_symbol_name(NODE_DECL(cnode))] = chash_symbol_uses(cnode);
+    }
+    for (chash_element &element : chash_elements) {
+        element.uses = uses[element.name];
+    }
+
+    varpool_node_ptr node;
+    FOR_EACH_VARIABLE(node) {
+        tree decl = NODE_DECL(node);
+        // Function-local static variables are part of the function hash
+        if (DECL_EXTERNAL(decl) || chash_is_function_local(decl))
+            continue;
+        chash_element element;
+        element.name = chash_symbol_name(decl);
+        element.file = chash_symbol_file(decl);
+        element.digest = chash_visitor.hashVariable(decl);
+        element.uses = chash_symbol_uses(node);
+        chash_elements.push_back(element);
+    }
+    std::sort(chash_elements.begin(), chash_elements.end());
+
+    Hash unit_hash;
+    unsigned processed_bytes = 0;
+    for (const chash_element &element : chash_elements) {
+        unit_hash << element.digest;
+        processed_bytes += element.digest.Length;
+    }
+    DeclTable table;
+    for (const chash_element &element : chash_elements)
+        table.add(element.name, element.digest.asString(), element.file);
+    std::vector<std::string> command_line;
+    std::string command_line_file;
+    if (readHashedCommandLineArguments(command_line, command_line_file)) {
+        for (const std::string &arg : command_line) {
+            unit_hash << arg;
+            table.add_option(arg);
+        }
+    } else {
+        fprintf(stderr, "Warning: could not open file \"%s\", cannot hash "
+                "command line arguments.\n", command_line_file.c_str());
+    }
+    chash_hash_new = unit_hash.getDigest().asString();
+
+    const chash_clock::time_point finish_hashing = chash_clock::now();
+    chash_hash_time += finish_hashing - start_hashing;
+
+    std::ostream *terminal = chash_options.verbose ? &std::cerr : nullptr;
+    ObjectCache<std::ostream> cache =
+        ObjectCache<std::ostream>::from_environment(terminal, "s");
+
+    const bool can_cache = cache.has_cachedir() || chash_options.objectfile != "";
+    std::string copy;
+    if (can_cache)
+        copy = cache.find_object_from_hash(chash_options.objectfile, chash_hash_new);
+    const bool hash_equal = copy != "";
 
-void hash_expr(tree expr) {
-    if (TREE_CODE(expr) == BIND_EXPR) {
-        TREE_TYPE(expr);
-        
+    if (terminal) {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        *terminal << "hash-start-time-ns "
+                  << duration_cast<nanoseconds>(start_hashing.time_since_epoch()).count()
+                  << "\n";
+        *terminal << "top-level-hash: " << chash_hash_new << "\n";
+        *terminal << "processed-bytes: " << processed_bytes << "\n";
+        *terminal << "parse-time-ns: "
+                  << duration_cast<nanoseconds>(start_hashing - chash_start_compilation
+                                                - (chash_hash_time - (finish_hashing - start_hashing))).count()
+                  << "\n";
+        *terminal << "hash-time-ns: "
+                  << duration_cast<nanoseconds>(chash_hash_time).count() << "\n";
+        *terminal << "element-hashes: [";
+        for (const chash_element &element : chash_elements) {
+            *terminal << "(\"" << element.name << "\", \""
+                      << element.digest.asString() << "\", [";
+            for (const std::string &use : element.uses)
+                *terminal << "\"" << use << "\", ";
+            *terminal << "]), ";
+        }
+        *terminal << "]\n";
+        *terminal << "hash-equal:" << hash_equal << "\n";
+        *terminal << "skipped:" << (hash_equal && chash_options.stop_if_same_hash) << "\n";
     }
+
+    if (!chash_options.stop_if_same_hash || !can_cache)
+        return 0;
+
+    // Explain a miss by the differences to the last compilation
+    std::vector<std::string> miss_reasons;
+    if (chash_options.objectfile != "") {
+        table.m_hash = chash_hash_new;
+        miss_reasons = table.update(chash_options.objectfile, !hash_equal, terminal);
+    }
+
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    chash_stats.set_objectfile(chash_options.objectfile);
+    chash_stats.m_parse_time = duration_cast<nanoseconds>(
+        start_hashing - chash_start_compilation
+        - (chash_hash_time - (finish_hashing - start_hashing))).count();
+    chash_stats.m_hash_time = duration_cast<nanoseconds>(chash_hash_time).count();
+
+    if (hash_equal) {
+        FILE *cached = fopen(copy.c_str(), "r");
+        bool replayed = false;
+        if (cached && asm_out_file && fflush(asm_out_file) == 0
+            && ftruncate(fileno(asm_out_file), 0) == 0
+            && fseek(asm_out_file, 0, SEEK_SET) == 0) {
+            replayed = chash_copy_stream(cached, asm_out_file);
+        }
+        if (cached)
+            fclose(cached);
+
+        if (replayed) {
+            chash_log_event("H");
+            cache.record_hit(chash_hash_new);
+            struct stat st;
+            chash_stats.m_event = 'H';
+            chash_stats.m_time = StatsRecord::now_ns();
+            chash_stats.m_compile_time = duration_cast<nanoseconds>(
+                chash_clock::now() - chash_start_compilation).count();
+            chash_stats.m_saved_time = ObjectCache<std::ostream>::read_duration(copy);
+            if (stat(copy.c_str(), &st) == 0)
+                chash_stats.m_object_size = st.st_size;
+            chash_stats.append(StatsRecord::log_filename());
+            // The remaining compilation is skipped. Therefore, we do
+            // the last steps of finalize() on our own: close the
+            // assembler output and let the frontend write its
+            // dependency file (-MD).
+            fclose(asm_out_file);
+            asm_out_file = NULL;
+            lang_hooks.finish();
+            exit(0);
+        }
+        // The assembler output was already passed on (-pipe).
+        // Continue with the compilation.
+    }
+
+    char *hashfile = cache.hash_filename(chash_options.objectfile);
+    if (hashfile) {
+        chash_hashfile = hashfile;
+        free(hashfile);
+    }
+    char *objectcopy = cache.objectcopy_filename(chash_options.objectfile,
+                                                 chash_hash_new);
+    chash_objectcopy = objectcopy;
+    free(objectcopy);
+    chash_statsfile = cache.stats_filename(chash_hash_new);
+    chash_stats.set_reason(miss_reasons);
+    return 0;
 }
+
+#define PASS_NAME chash_unit_hash
+#define NO_GATE
+#include "gcc-generate-simple_ipa-pass.h"
+
 /*
- * Initialization fndecltion of this plugin: the very heart & soul.
+ * On a miss, the assembler output is complete after the compilation.
+ * We store a copy and the hash in the cache.
+ */
+extern "C" void chash_finish_execute(void *, void *) {
+    if (chash_objectcopy == "" || seen_error())
+        return;
+    if (!asm_file_name || strcmp(asm_file_name, "-") == 0)
+        return;
+
+    chash_log_event("M");
+
+    FILE *in = fopen(asm_file_name, "r");
+    if (!in) {
+        perror("gcc-hash: assembler output does not exist");
+        return;
+    }
+    const long long compile_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        chash_clock::now() - chash_start_compilation).count();
+    ObjectCache<std::ostream>::store_duration(chash_objectcopy, compile_time);
+
+    // Copy, since a hardlink would be truncated by the next compilation
+    // with -save-temps
+    unlink(chash_objectcopy.c_str());
+    FILE *out = fopen(chash_objectcopy.c_str(), "w");
+    if (!out) {
+        perror("gcc-hash: assembler output copy failed");
+        fclose(in);
+        return;
+    }
+    const bool copied = chash_copy_stream(in, out);
+    fclose(in);
+    if (fclose(out) != 0 || !copied) {
+        unlink(chash_objectcopy.c_str());
+        return;
+    }
+
+    // Write Hash to hashfile
+    if (chash_hashfile != "") {
+        FILE *f = fopen(chash_hashfile.c_str(), "w+");
+        if (f) {
+            fwrite(chash_hash_new.c_str(), chash_hash_new.size(), 1, f);
+            fclose(f);
+        }
+    }
+    ObjectCache<std::ostream>::record_store(chash_statsfile, chash_objectcopy);
+    ObjectCache<std::ostream>::from_environment(nullptr, "s").upload(chash_hash_new);
+
+    struct stat st;
+    chash_stats.m_event = 'M';
+    chash_stats.m_time = StatsRecord::now_ns();
+    chash_stats.m_compile_time = compile_time;
+    if (stat(chash_objectcopy.c_str(), &st) == 0)
+        chash_stats.m_object_size = st.st_size;
+    chash_stats.append(StatsRecord::log_filename());
+}
+
+/*
+ * Initialization function of this plugin: the very heart & soul.
  */
 int plugin_init(struct plugin_name_args *info, struct plugin_gcc_version *version)
 {
     const char * plugin_name = info->base_name;
-    struct register_pass_info chash_ast_hash_info;
-    (void) chash_ast_hash_info;
 
+    chash_start_compilation = chash_clock::now();
 
     if (!plugin_default_version_check(version, &gcc_version)) {
         error(G_("incompatible gcc/plugin versions"));
         return 1;
     }
 
-    // Initialize types and the multiverse info structures.
-    // FIXME: Initialize Strucutres at beginning of Translation Unit
-    // register_callback(plugin_name, PLUGIN_START_UNIT, mv_info_init, &mv_ctx);
+    for (int i = 0; i < info->argc; ++i) {
+        const char *key = info->argv[i].key;
+        if (strcmp(key, "hash-verbose") == 0) {
+            chash_options.verbose = true;
+        } else if (strcmp(key, "hash-gimple") == 0) {
+            chash_options.gimple = true;
+        } else if (strcmp(key, "stop-if-same-hash") == 0) {
+            chash_options.stop_if_same_hash = true;
+        } else if (strcmp(key, "objectfile") == 0 && info->argv[i].value) {
+            chash_options.objectfile = info->argv[i].value;
+        } else {
+            error(G_("unknown argument for %s: %s"), plugin_name, key);
+            return 1;
+        }
+    }
+    if (chash_options.objectfile == "/dev/null")
+        chash_options.objectfile = "";
 
     // Register plugin information
     register_callback(plugin_name, PLUGIN_INFO, NULL, &chash_plugin_info);
 
+    // Register pass: hash GIMPLE after the early optimizations
+    PASS_INFO(chash_gimple_hash, "early_optimizations", 1, PASS_POS_INSERT_AFTER);
+    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL,
+                      &chash_gimple_hash_pass_info);
+
+    // Register pass: unit hash as first IPA pass or after the GIMPLE hashes
+    PASS_INFO(chash_unit_hash,
+              chash_options.gimple ? "early_local_cleanups" : "*free_lang_data", 1,
+              chash_options.gimple ? PASS_POS_INSERT_AFTER : PASS_POS_INSERT_BEFORE);
+    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL,
+                      &chash_unit_hash_pass_info);
+
     // Register callbacks.
     register_callback (plugin_name,
-		        PLUGIN_PRE_GENERICIZE,
-		        &chash_ast_hash_execute,
-                NULL);
-    // Register pass: generate chash pass
-    //chash_ast_hash_info.pass = make_chash_ast_hash_pass();
-    //chash_ast_hash_info.reference_pass_name = "gimplify";
-    //chash_ast_hash_info.ref_pass_instance_number = 0;
-    //chash_ast_hash_info.pos_op = PASS_POS_INSERT_BEFORE;
-    //register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &chash_ast_hash_info);
-
-    // Finish off the generation of multiverse info
-    // register_callback(plugin_name, PLUGIN_FINISH_UNIT, mv_info_finish, &mv_ctx);
+                       PLUGIN_PRE_GENERICIZE,
+                       &chash_ast_hash_execute,
+                       NULL);
+    register_callback (plugin_name,
+                       PLUGIN_FINISH,
+                       &chash_finish_execute,
+                       NULL);
 
     return 0;
 }
@@ -0,0 +1,495 @@
+/*
+ * Copyright 2017 by Christian Dietrich <dietrich@sra.uni-hannover.de>
+ *
+ * Stable hashing of GENERIC trees and GIMPLE bodies. This is the GCC
+ * counterpart of the CHashVisitor in the clang plugin.
+ *
+ * - Source locations, UIDs, SSA versions, and addresses of tree nodes
+ *   never enter the hash. Local declarations (variables, parameters,
+ *   labels) and SSA names are numbered in the order of their first
+ *   appearance.
+ * - References to global variables and functions only contribute
+ *   their name and their type, not their initializer or body.
+ * - Type hashes are memoized in the TypeSilo.
+ *
+ * This header must be included after gcc-common.h.
+ */
+
+#ifndef __GCC_PLUGIN_HASH_VISITOR_H
+#define __GCC_PLUGIN_HASH_VISITOR_H
+
+#include "tree-iterator.h"
+#include "real.h"
+
+class CHashVisitor {
+public:
+  typedef ::Hash::Digest HashResult;
+
+  /// Hashes a function definition (signature, attributes, and body)
+  HashResult hashFunction(tree FnDecl) {
+    LocalIds.clear();
+    Hash H;
+    H << (uint32_t)TREE_CODE(FnDecl);
+    hashName(H, FnDecl);
+    hashDeclFlags(H, FnDecl);
+    H << hashType(TREE_TYPE(FnDecl));
+    for (tree Arg = DECL_ARGUMENTS(FnDecl); Arg; Arg = DECL_CHAIN(Arg)) {
+      hashTree(H, Arg);
+    }
+    hashTree(H, DECL_SAVED_TREE(FnDecl));
+    return H.getDigest();
+  }
+
+  /// Hashes the definition of a global variable (with initializer)
+  HashResult hashVariable(tree VarDecl) {
+    LocalIds.clear();
+    Hash H;
+    H << (uint32_t)TREE_CODE(VarDecl);
+    hashName(H, VarDecl);
+    hashDeclFlags(H, VarDecl);
+    H << hashType(TREE_TYPE(VarDecl));
+    hashTree(H, DECL_INITIAL(VarDecl));
+    return H.getDigest();
+  }
+
+  /// Hashes the GIMPLE body of a function. Basic blocks are numbered
+  /// in their order in the function, SSA names in the order of their
+  /// first appearance. Debug statements are ignored.
+  HashResult hashGimpleFunction(tree FnDecl, function *Fn) {
+    LocalIds.clear();
+    BlockIds.clear();
+    Hash H;
+    H << (uint32_t)TREE_CODE(FnDecl);
+    hashName(H, FnDecl);
+    hashDeclFlags(H, FnDecl);
+    H << hashType(TREE_TYPE(FnDecl));
+    for (tree Arg = DECL_ARGUMENTS(FnDecl); Arg; Arg = DECL_CHAIN(Arg)) {
+      hashTree(H, Arg);
+    }
+
+    basic_block BB;
+    FOR_ALL_BB_FN(BB, Fn) {
+      uint32_t Id = BlockIds.size();
+      BlockIds[BB] = Id;
+    }
+    FOR_ALL_BB_FN(BB, Fn) {
+      hashBasicBlock(H, BB);
+    }
+    return H.getDigest();
+  }
+
+  HashResult hashType(tree Type) {
+    if (!Type) {
+      return Hash().getDigest();
+    }
+    std::map<tree, HashResult>::const_iterator It = TypeSilo.find(Type);
+    if (It != TypeSilo.end()) {
+      return It->second;
+    }
+
+    Hash H;
+    H << (uint32_t)TREE_CODE(Type);
+    H << (uint32_t)TYPE_QUALS(Type);
+    hashTypeName(H, Type);
+
+    // Recursive types (struct list { struct list *next; }) only
+    // contribute their name on the back edge.
+    if (TypesInProgress.count(Type)) {
+      return H.getDigest();
+    }
+    TypesInProgress.insert(Type);
+
+    if (TYPE_MAIN_VARIANT(Type) != Type) {
+      // Qualified variant: hash the unqualified type
+      H << hashType(TYPE_MAIN_VARIANT(Type));
+    } else {
+      hashTypeStructure(H, Type);
+    }
+
+    TypesInProgress.erase(Type);
+    HashResult Result = H.getDigest();
+    TypeSilo[Type] = Result;
+    return Result;
+  }
+
+protected:
+  std::map<tree, HashResult> TypeSilo;
+  std::set<tree> TypesInProgress;
+
+  // Local declarations and SSA names are numbered in order of their
+  // first appearance
+  std::map<tree, uint32_t> LocalIds;
+  std::map<basic_block, uint32_t> BlockIds;
+
+  void hashString(Hash &H, const char *Str, size_t Length) {
+    H << (uint64_t)Length;
+    H.processBytes(Str, Length);
+  }
+
+  void hashName(Hash &H, tree Decl) {
+    tree Name = DECL_NAME(Decl);
+    if (Name && TREE_CODE(Name) == IDENTIFIER_NODE) {
+      hashString(H, IDENTIFIER_POINTER(Name), IDENTIFIER_LENGTH(Name));
+    } else {
+      H << (uint64_t)0;
+    }
+  }
+
+  void hashTypeName(Hash &H, tree Type) {
+    tree Name = TYPE_NAME(Type);
+    if (Name && TREE_CODE(Name) == TYPE_DECL) {
+      Name = DECL_NAME(Name);
+    }
+    if (Name && TREE_CODE(Name) == IDENTIFIER_NODE) {
+      hashString(H, IDENTIFIER_POINTER(Name), IDENTIFIER_LENGTH(Name));
+    } else {
+      H << (uint64_t)0;
+    }
+  }
+
+  /// The flags that influence the code generation for a declaration
+  void hashDeclFlags(Hash &H, tree Decl) {
+    H << (uint8_t)TREE_PUBLIC(Decl);
+    H << (uint8_t)TREE_STATIC(Decl);
+    H << (uint8_t)DECL_EXTERNAL(Decl);
+    H << (uint8_t)DECL_WEAK(Decl);
+    H << (uint8_t)TREE_THIS_VOLATILE(Decl);
+    H << (uint8_t)TREE_READONLY(Decl);
+    if (TREE_CODE(Decl) == FUNCTION_DECL) {
+      H << (uint8_t)DECL_DECLARED_INLINE_P(Decl);
+    }
+    H << (uint32_t)DECL_ALIGN(Decl);
+    hashTree(H, DECL_ATTRIBUTES(Decl));
+  }
+
+  void hashTypeStructure(Hash &H, tree Type) {
+    H << (uint32_t)TYPE_ALIGN(Type);
+    hashTree(H, TYPE_SIZE(Type));
+    hashTree(H, TYPE_ATTRIBUTES(Type));
+
+    switch (TREE_CODE(Type)) {
+    case INTEGER_TYPE:
+    case BOOLEAN_TYPE:
+    case REAL_TYPE:
+    case FIXED_POINT_TYPE:
+      H << (uint32_t)TYPE_PRECISION(Type);
+      H << (uint8_t)TYPE_UNSIGNED(Type);
+      break;
+    case ENUMERAL_TYPE:
+      H << (uint32_t)TYPE_PRECISION(Type);
+      H << (uint8_t)TYPE_UNSIGNED(Type);
+      for (tree Value = TYPE_VALUES(Type); Value; Value = TREE_CHAIN(Value)) {
+        hashTree(H, TREE_PURPOSE(Value));
+        tree Init = TREE_VALUE(Value);
+        if (Init && TREE_CODE(Init) == CONST_DECL)
+          Init = DECL_INITIAL(Init);
+        hashTree(H, Init);
+      }
+      break;
+    case POINTER_TYPE:
+    case REFERENCE_TYPE:
+    case COMPLEX_TYPE:
+    case VECTOR_TYPE:
+      H << hashType(TREE_TYPE(Type));
+      break;
+    case ARRAY_TYPE:
+      H << hashType(TREE_TYPE(Type));
+      if (TYPE_DOMAIN(Type)) {
+        hashTree(H, TYPE_MAX_VALUE(TYPE_DOMAIN(Type)));
+      }
+      break;
+    case RECORD_TYPE:
+    case UNION_TYPE:
+    case QUAL_UNION_TYPE:
+      for (tree Field = TYPE_FIELDS(Type); Field; Field = DECL_CHAIN(Field)) {
+        if (TREE_CODE(Field) != FIELD_DECL)
+          continue;
+        hashName(H, Field);
+        H << hashType(TREE_TYPE(Field));
+        H << (uint8_t)DECL_BIT_FIELD(Field);
+        hashTree(H, DECL_SIZE(Field));
+        hashTree(H, DECL_ATTRIBUTES(Field));
+      }
+      break;
+    case FUNCTION_TYPE:
+    case METHOD_TYPE:
+      H << hashType(TREE_TYPE(Type));
+      for (tree Arg = TYPE_ARG_TYPES(Type); Arg; Arg = TREE_CHAIN(Arg)) {
+        H << hashType(TREE_VALUE(Arg));
+      }
+      if (TREE_CODE(Type) == METHOD_TYPE) {
+        H << hashType(TYPE_METHOD_BASETYPE(Type));
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  /// References to declarations. Locals are numbered, globals are
+  /// referenced by name and type.
+  void hashDeclRef(Hash &H, tree Decl) {
+    const enum tree_code Code = TREE_CODE(Decl);
+    const bool IsLocal =
+        Code == PARM_DECL || Code == RESULT_DECL || Code == LABEL_DECL ||
+        (Code == VAR_DECL && !is_global_var(Decl));
+
+    if (IsLocal) {
+      std::map<tree, uint32_t>::iterator It = LocalIds.find(Decl);
+      if (It == LocalIds.end()) {
+        uint32_t Id = LocalIds.size();
+        LocalIds[Decl] = Id;
+        H << Id;
+        H << hashType(TREE_TYPE(Decl));
+        H << (uint8_t)TREE_THIS_VOLATILE(Decl);
+        H << (uint8_t)TREE_ADDRESSABLE(Decl);
+      } else {
+        H << It->second;
+      }
+      return;
+    }
+
+    if (Code == VAR_DECL && DECL_ARTIFICIAL(Decl) && !TREE_PUBLIC(Decl)) {
+      // Compiler-generated constants (C.42) are named after their UID
+      H << hashType(TREE_TYPE(Decl));
+      hashTree(H, DECL_INITIAL(Decl));
+      return;
+    }
+
+    hashName(H, Decl);
+    switch (Code) {
+    case FIELD_DECL:
+      H << hashType(TREE_TYPE(Decl));
+      H << (uint8_t)DECL_BIT_FIELD(Decl);
+      break;
+    case CONST_DECL:
+      hashTree(H, DECL_INITIAL(Decl));
+      break;
+    case TYPE_DECL:
+      H << hashType(TREE_TYPE(Decl));
+      break;
+    default: // Global variables and functions
+      H << hashType(TREE_TYPE(Decl));
+      H << (uint8_t)TREE_PUBLIC(Decl);
+      break;
+    }
+  }
+
+  void hashConstant(Hash &H, tree Cst) {
+    H << hashType(TREE_TYPE(Cst));
+    switch (TREE_CODE(Cst)) {
+    case INTEGER_CST:
+#if BUILDING_GCC_VERSION >= 5000
+      for (int I = 0; I < TREE_INT_CST_NUNITS(Cst); ++I) {
+        H << (int64_t)TREE_INT_CST_ELT(Cst, I);
+      }
+#else
+      H << (int64_t)TREE_INT_CST_LOW(Cst);
+      H << (int64_t)TREE_INT_CST_HIGH(Cst);
+#endif
+      break;
+    case REAL_CST: {
+      char Buffer[64];
+      real_to_hexadecimal(Buffer, TREE_REAL_CST_PTR(Cst), sizeof(Buffer), 0, 1);
+      hashString(H, Buffer, strlen(Buffer));
+      break;
+    }
+    case STRING_CST:
+      hashString(H, TREE_STRING_POINTER(Cst), TREE_STRING_LENGTH(Cst));
+      break;
+    case COMPLEX_CST:
+      hashTree(H, TREE_REALPART(Cst));
+      hashTree(H, TREE_IMAGPART(Cst));
+      break;
+    case VECTOR_CST:
+#if BUILDING_GCC_VERSION >= 8000
+      for (unsigned I = 0; I < vector_cst_encoded_nelts(Cst); ++I) {
+        hashTree(H, VECTOR_CST_ENCODED_ELT(Cst, I));
+      }
+#else
+      for (unsigned I = 0; I < VECTOR_CST_NELTS(Cst); ++I) {
+        hashTree(H, VECTOR_CST_ELT(Cst, I));
+      }
+#endif
+      break;
+    default:
+      break;
+    }
+  }
+
+  void hashTree(Hash &H, tree T) {
+    if (!T) {
+      H << (uint32_t)0xffffffff;
+      return;
+    }
+    const enum tree_code Code = TREE_CODE(T);
+    H << (uint32_t)Code;
+
+    switch (TREE_CODE_CLASS(Code)) {
+    case tcc_type:
+      H << hashType(T);
+      return;
+    case tcc_declaration:
+      hashDeclRef(H, T);
+      return;
+    case tcc_constant:
+      hashConstant(H, T);
+      return;
+    case tcc_exceptional:
+      hashExceptional(H, T);
+      return;
+    default:
+      break;
+    }
+
+    // Expressions, references, and statements
+    H << hashType(TREE_TYPE(T));
+    H << (uint8_t)TREE_THIS_VOLATILE(T);
+    H << (uint8_t)TREE_SIDE_EFFECTS(T);
+
+    if (Code == DECL_EXPR) {
+      // The definition of a local variable (with its initializer)
+      tree Decl = DECL_EXPR_DECL(T);
+      hashTree(H, Decl);
+      if (TREE_CODE(Decl) == VAR_DECL) {
+        hashDeclFlags(H, Decl);
+        hashTree(H, DECL_INITIAL(Decl));
+      }
+      return;
+    }
+    if (Code == BIND_EXPR) {
+      // BIND_EXPR_BLOCK only contains debug information
+      for (tree Var = BIND_EXPR_VARS(T); Var; Var = DECL_CHAIN(Var)) {
+        hashTree(H, Var);
+      }
+      hashTree(H, BIND_EXPR_BODY(T));
+      return;
+    }
+
+    const int Length = TREE_OPERAND_LENGTH(T);
+    H << (uint32_t)Length;
+    for (int I = 0; I < Length; ++I) {
+      hashTree(H, TREE_OPERAND(T, I));
+    }
+  }
+
+  void hashBasicBlock(Hash &H, basic_block BB) {
+    H << BlockIds[BB];
+
+    for (gphi_iterator I = gsi_start_phis(BB); !gsi_end_p(I); gsi_next(&I)) {
+      gphi *Phi = I.phi();
+      hashTree(H, gimple_phi_result(Phi));
+      H << (uint32_t)gimple_phi_num_args(Phi);
+      for (unsigned Arg = 0; Arg < gimple_phi_num_args(Phi); ++Arg) {
+        H << BlockIds[gimple_phi_arg_edge(Phi, Arg)->src];
+        hashTree(H, gimple_phi_arg_def(Phi, Arg));
+      }
+    }
+
+    for (gimple_stmt_iterator I = gsi_start_bb(BB); !gsi_end_p(I); gsi_next(&I)) {
+      hashStatement(H, gsi_stmt(I));
+    }
+
+    edge E;
+    edge_iterator EI;
+    H << (uint32_t)EDGE_COUNT(BB->succs);
+    FOR_EACH_EDGE(E, EI, BB->succs) {
+      H << BlockIds[E->dest];
+      H << (uint32_t)(E->flags & (EDGE_FALLTHRU | EDGE_ABNORMAL | EDGE_EH |
+                                  EDGE_TRUE_VALUE | EDGE_FALSE_VALUE));
+    }
+  }
+
+  void hashStatement(Hash &H, gimple_ptr Stmt) {
+    if (is_gimple_debug(Stmt)) {
+      return;
+    }
+    const enum gimple_code Code = gimple_code(Stmt);
+    H << (uint32_t)Code;
+    H << (uint8_t)gimple_has_volatile_ops(Stmt);
+
+    switch (Code) {
+    case GIMPLE_ASSIGN:
+    case GIMPLE_COND:
+      H << (uint32_t)gimple_expr_code(Stmt);
+      break;
+    case GIMPLE_CALL:
+      if (gimple_call_internal_p(Stmt)) {
+        H << (uint32_t)gimple_call_internal_fn(Stmt);
+      }
+      H << (uint32_t)gimple_call_flags(Stmt);
+      break;
+    case GIMPLE_ASM: {
+      const char *Str = gimple_asm_string(as_a<gasm *>(Stmt));
+      hashString(H, Str, strlen(Str));
+      H << (uint8_t)gimple_asm_volatile_p(as_a<gasm *>(Stmt));
+      break;
+    }
+    default:
+      break;
+    }
+
+    H << (uint32_t)gimple_num_ops(Stmt);
+    for (unsigned I = 0; I < gimple_num_ops(Stmt); ++I) {
+      hashTree(H, gimple_op(Stmt, I));
+    }
+  }
+
+  void hashExceptional(Hash &H, tree T) {
+    switch (TREE_CODE(T)) {
+    case IDENTIFIER_NODE:
+      hashString(H, IDENTIFIER_POINTER(T), IDENTIFIER_LENGTH(T));
+      break;
+    case SSA_NAME: {
+      // The SSA version is not hashed
+      std::map<tree, uint32_t>::iterator It = LocalIds.find(T);
+      if (It == LocalIds.end()) {
+        uint32_t Id = LocalIds.size();
+        LocalIds[T] = Id;
+        H << Id;
+        H << hashType(TREE_TYPE(T));
+        H << (uint8_t)SSA_NAME_IS_DEFAULT_DEF(T);
+        tree Var = SSA_NAME_VAR(T);
+        if (Var && DECL_P(Var)) {
+          hashTree(H, Var);
+        }
+      } else {
+        H << It->second;
+      }
+      break;
+    }
+    case TREE_LIST:
+      for (; T; T = TREE_CHAIN(T)) {
+        hashTree(H, TREE_PURPOSE(T));
+        hashTree(H, TREE_VALUE(T));
+      }
+      break;
+    case TREE_VEC:
+      H << (uint32_t)TREE_VEC_LENGTH(T);
+      for (int I = 0; I < TREE_VEC_LENGTH(T); ++I) {
+        hashTree(H, TREE_VEC_ELT(T, I));
+      }
+      break;
+    case STATEMENT_LIST:
+      for (tree_stmt_iterator I = tsi_start(T); !tsi_end_p(I); tsi_next(&I)) {
+        hashTree(H, tsi_stmt(I));
+      }
+      break;
+    case CONSTRUCTOR: {
+      unsigned HOST_WIDE_INT Idx;
+      tree Index, Value;
+      H << hashType(TREE_TYPE(T));
+      FOR_EACH_CONSTRUCTOR_ELT(CONSTRUCTOR_ELTS(T), Idx, Index, Value) {
+        hashTree(H, Index);
+        hashTree(H, Value);
+      }
+      break;
+    }
+    default:
+      // BLOCKs (lexical scopes) and other nodes without semantics
+      break;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# check-name: Share cached objects between checkouts with CLANG_HASH_BASEDIR
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_CACHE=$WORK_DIR/cache
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <checkout> [<basedir>]: compiles the same source in another
+# directory, by default below the checkout as base directory
+function compile() {
+    mkdir -p $WORK_DIR/$1/include
+    echo '#define VALUE 42' > $WORK_DIR/$1/include/value.h
+    echo '#include "value.h"
+static int value() { return VALUE; }
+int main() { return value(); }' > $WORK_DIR/$1/test.c
+    CLANG_HASH_BASEDIR=${2-$WORK_DIR/$1} \
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    -I$WORK_DIR/$1/include -g \
+                    -c $WORK_DIR/$1/test.c -o $WORK_DIR/$1/test.o 2>&1 >/dev/null \
+        | grep '^skipped:' | tr -d ' '
+}
+
+[ "$(compile a)" = "skipped:0" ] || fail ${0}:${LINENO} "initial compilation skipped"
+echo "  OK: ${0}:${LINENO}"
+
+# Same source below another base directory; the debug information
+# names neither checkout
+[ "$(compile b)" = "skipped:1" ] || fail ${0}:${LINENO} "not skipped for other checkout"
+for checkout in a b; do
+    ! grep -qa "$WORK_DIR/[ab]" $WORK_DIR/$checkout/test.o \
+        || fail ${0}:${LINENO} "debug information of $checkout names a checkout"
+done
+echo "  OK: ${0}:${LINENO}"
+
+# Without a base directory, the debug information names the checkout,
+# so the paths are part of the hash
+[ "$(compile c '')" = "skipped:0" ] || fail ${0}:${LINENO} "skipped without base directory"
+grep -qa "$WORK_DIR/c" $WORK_DIR/c/test.o || fail ${0}:${LINENO} "debug information without checkout"
+echo "  OK: ${0}:${LINENO}"
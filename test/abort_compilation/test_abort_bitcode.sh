@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# check-name: Reuse the cached frontend output for other backend options
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_CACHE=$WORK_DIR/cache CLANG_HASH_BITCODE=1
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <object> <options>...
+function compile() {
+    local object=$1
+    shift
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    "$@" -c test.c -o $object 2>&1 >/dev/null \
+        | grep -c '^bitcode-hit:'
+}
+
+cd $WORK_DIR
+cat > test.c <<'C'
+int square(int x) { return x * x; }
+int main(void) { return square(3) - 9; }
+C
+
+[ "$(compile a.o -O1)" = 0 ] || fail ${0}:${LINENO} "bitcode without a compilation"
+[ "$(ls cache/*/*.bc | wc -l)" = 1 ] || fail ${0}:${LINENO} "no bitcode stored"
+echo "  OK: ${0}:${LINENO}"
+
+# Another optimization level compiles the bitcode
+[ "$(compile b.o -O2)" = 1 ] || fail ${0}:${LINENO} "bitcode not reused"
+clang b.o -o b || fail ${0}:${LINENO} "object from bitcode not linkable"
+./b || fail ${0}:${LINENO} "object from bitcode is wrong"
+echo "  OK: ${0}:${LINENO}"
+
+# The object is stored like the one of a miss
+rm b.o
+clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                -O2 -c test.c -o b.o 2>&1 >/dev/null | grep -q '^skipped:1' \
+    || fail ${0}:${LINENO} "object not stored"
+echo "  OK: ${0}:${LINENO}"
+
+# Debug information is generated by the frontend
+[ "$(compile c.o -O2 -g)" = 0 ] || fail ${0}:${LINENO} "bitcode reused with -g"
+echo "  OK: ${0}:${LINENO}"
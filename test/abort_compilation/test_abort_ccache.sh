@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# check-name: Abort compilation with objects in the ccache directory
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_CCACHE=1
+export CCACHE_DIR=$WORK_DIR/ccache
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <object> <source>
+function compile() {
+    echo "$2" > $WORK_DIR/test.c
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    -c $WORK_DIR/test.c -o $WORK_DIR/$1 2>&1 >/dev/null \
+        | grep '^skipped:' | tr -d ' '
+}
+
+# stat_counter <number>: sum of a counter over all ccache stats files
+function stat_counter() {
+    cat $CCACHE_DIR/?/stats 2>/dev/null | awk "NR % 32 == $(($1 + 1)) % 32 { n += \$1 } END { print n + 0 }"
+}
+
+[ "$(compile a.o 'int main() {return 0;}')" = "skipped:0" ] || fail ${0}:${LINENO} "initial compilation skipped"
+[ "$(ls $CCACHE_DIR/?/?/*.o | wc -l)" = 1 ] || fail ${0}:${LINENO} "no object in ccache layout"
+[ "$(stat_counter 4)" = 1 ] || fail ${0}:${LINENO} "miss not counted"
+[ "$(stat_counter 11)" = 1 ] || fail ${0}:${LINENO} "file not counted"
+echo "  OK: ${0}:${LINENO}"
+
+# A comment-only change is a hit, even for another object file
+[ "$(compile b.o 'int main() {return 0;} /* comment */')" = "skipped:1" ] || fail ${0}:${LINENO} "not skipped"
+cmp -s $WORK_DIR/a.o $WORK_DIR/b.o || fail ${0}:${LINENO} "objects differ"
+[ "$(stat_counter 8)" = 1 ] || fail ${0}:${LINENO} "hit not counted"
+echo "  OK: ${0}:${LINENO}"
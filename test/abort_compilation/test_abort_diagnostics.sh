@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# check-name: Replay the backend diagnostics on a hit
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <object> <source>: prints the plugin decision and the warnings
+function compile() {
+    echo "$2" > $WORK_DIR/test.c
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    -Wframe-larger-than=64 \
+                    -c $WORK_DIR/test.c -o $WORK_DIR/$1 2>&1 >/dev/null \
+        | grep -E '^skipped:|warning:' | sed 's/^.*warning: //' | tr -d ' '
+}
+
+SOURCE='void g(char *);
+void f() { char buffer[4096]; g(buffer); }'
+
+# The frame size is checked by the backend
+FIRST=$(compile a.o "$SOURCE")
+echo "$FIRST" | grep -q 'skipped:0' || fail ${0}:${LINENO} "initial compilation skipped"
+echo "$FIRST" | grep -q 'stackframesize' || fail ${0}:${LINENO} "no backend warning"
+echo "  OK: ${0}:${LINENO}"
+
+SECOND=$(compile a.o "$SOURCE /* comment */")
+echo "$SECOND" | grep -q 'skipped:1' || fail ${0}:${LINENO} "not skipped"
+echo "$SECOND" | grep -q 'stackframesize' || fail ${0}:${LINENO} "backend warning not replayed"
+echo "  OK: ${0}:${LINENO}"
+
+# Without warnings, nothing is replayed
+compile a.o 'int main() {return 0;}' > /dev/null
+[ "$(compile a.o 'int main() {return 0;} /* comment */')" = "skipped:1" ] || fail ${0}:${LINENO} "stale warning replayed"
+echo "  OK: ${0}:${LINENO}"
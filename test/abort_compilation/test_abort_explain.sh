@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# check-name: Explain misses by the changed declarations and options
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_EXPLAIN=$WORK_DIR/explain.log
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <header> [<flags>]: prints the reasons of a miss
+function compile() {
+    echo "$1" > $WORK_DIR/header.h
+    echo '#include "header.h"
+int main() { return answer(); }' > $WORK_DIR/test.c
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose $2 \
+                    -c $WORK_DIR/test.c -o $WORK_DIR/test.o 2>&1 >/dev/null \
+        | grep '^miss-reason:' | sed 's/^miss-reason: //'
+}
+
+[ "$(compile 'static inline int answer() { return 42; }')" = "no previous compilation" ] \
+    || fail ${0}:${LINENO} "first compilation not explained"
+echo "  OK: ${0}:${LINENO}"
+
+# The changed function is named with its header
+compile 'static inline int answer() { return 23; }' | grep -q "^changed static function:answer:.*header.h (.*header.h)$" \
+    || fail ${0}:${LINENO} "changed function not explained"
+echo "  OK: ${0}:${LINENO}"
+
+compile 'static inline int answer() { return 23; }' -std=c11 | grep -q "^added option:-std (-std=c11)$" \
+    || fail ${0}:${LINENO} "added option not explained"
+compile 'static inline int answer() { return 23; }' -std=c99 | grep -q "^changed option:-std (-std=c11 -> -std=c99)$" \
+    || fail ${0}:${LINENO} "changed option not explained"
+echo "  OK: ${0}:${LINENO}"
+
+# Hits are not explained, all misses are logged
+[ "$(compile 'static inline int answer() { return 23; } /* comment */' -std=c99)" = "" ] \
+    || fail ${0}:${LINENO} "hit explained"
+grep -q "^$WORK_DIR/test.o: no previous compilation$" $CLANG_HASH_EXPLAIN || fail ${0}:${LINENO} "miss not logged"
+grep -q "^$WORK_DIR/test.o: changed option:-std (-std=c11 -> -std=c99)$" $CLANG_HASH_EXPLAIN || fail ${0}:${LINENO} "miss not logged"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,65 @@
+#!/bin/bash
+set -e
+
+# check-name: Abort compilation on second invocation (gcc, GIMPLE)
+
+function cleanup() {
+    rm -f test_abort_gimple.c test_abort_gimple.o*
+}
+trap cleanup EXIT
+
+function recompile() {
+    src="$1"; shift
+
+    echo "${src}" > test_abort_gimple.c
+    skipped=false
+    gcc-hash-stop -O2 -fplugin-arg-libgcc-hash-hash-verbose -fplugin-arg-libgcc-hash-hash-gimple -c test_abort_gimple.c -o test_abort_gimple.o \
+                    2>&1 >/dev/null |  grep -q '^skipped: *1'
+
+    if [ $? -eq 0 ]; then
+        echo "true";
+    else
+        echo "false"
+    fi
+}
+
+function check_is_recompiled() {
+    loc="$1"; shift
+    expected="$1"; shift
+    src_a="$1"; shift
+    src_b="$1"; shift
+
+    cleanup
+    re_a=$(recompile "$src_a")
+    re_b=$(recompile "$src_b")
+
+    if [ ${re_a} = "true" ]; then
+        echo "!!!Failure ${loc}: initial compilation was skipped"
+        exit 1
+    fi
+    if [ ${re_b} != ${expected} ]; then
+        echo "!!!Failure ${loc}: wrong skip status (${re_b})"
+        echo "${src_a} -> ${src_b}"
+        exit 1
+    fi
+
+    echo "  OK: ${loc} skipped=${re_b}"
+}
+
+# Not skipped checks
+check_is_recompiled ${0}:${LINENO} false \
+                    "int main() {return 0;}" \
+                    "int main() {return 1;}"
+
+# Skipped checks: the difference is removed by the early optimizations
+check_is_recompiled ${0}:${LINENO} true \
+                    "int main() {return 0;}" \
+                    "int main() {if (0) return 2; return 0;}"
+
+check_is_recompiled ${0}:${LINENO} true \
+                    "int main() {return 0;}" \
+                    "static int unused(int x) {return x;} int main() {return 0;}"
+
+check_is_recompiled ${0}:${LINENO} true \
+                    "int main() {int a = 1; return a - 1;}" \
+                    "int main() {int b = 1; int c = b; return c - 1;}"
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# check-name: Hash the declarations of a precompiled header
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+function top_level_hash() {
+    rm -f test.o*
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    "$@" -c test.c -o test.o 2>&1 >/dev/null | grep '^top-level-hash:'
+}
+
+cd $WORK_DIR
+cat > prefix.h <<'C'
+#ifndef PREFIX_H
+#define PREFIX_H
+struct point { int x, y; };
+int counter = 0;
+static inline int norm(struct point p) { return p.x * p.x + p.y * p.y; }
+#endif
+C
+cat > test.c <<'C'
+#include "prefix.h"
+int main(void) { struct point p = { 1, 2 }; return norm(p) + counter; }
+C
+
+# The declarations of the header are hashed like parsed ones
+PLAIN=$(top_level_hash)
+[ -n "$PLAIN" ] || fail ${0}:${LINENO} "no hash"
+clang -x c-header prefix.h -o prefix.h.pch || fail ${0}:${LINENO} "no precompiled header"
+[ "$(top_level_hash -include-pch prefix.h.pch)" = "$PLAIN" ] \
+    || fail ${0}:${LINENO} "precompiled header changes the hash"
+echo "  OK: ${0}:${LINENO}"
+
+# A definition that is emitted, but not used by the source, counts
+sed -i 's/int counter = 0;/int counter = 0;\nint unused = 1;/' prefix.h
+clang -x c-header prefix.h -o prefix.h.pch || fail ${0}:${LINENO} "no precompiled header"
+[ "$(top_level_hash -include-pch prefix.h.pch)" != "$PLAIN" ] \
+    || fail ${0}:${LINENO} "change of the precompiled header not noticed"
+echo "  OK: ${0}:${LINENO}"
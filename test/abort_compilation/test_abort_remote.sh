@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# check-name: Abort compilation with objects from the remote cache
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_CACHE_SERVER="${CHASH_CACHE_SERVER:-${DIR}/../../build/tools/chash-cache-server}"
+
+WORK_DIR=`mktemp -d`
+mkdir $WORK_DIR/server
+$CHASH_CACHE_SERVER -d $WORK_DIR/server -b 127.0.0.1 -p 0 > $WORK_DIR/port &
+SERVER=$!
+trap "kill $SERVER; rm -rf $WORK_DIR" EXIT
+for i in $(seq 50); do [ -s $WORK_DIR/port ] && break; sleep 0.1; done
+export CLANG_HASH_REMOTE=http://127.0.0.1:$(cat $WORK_DIR/port)/test
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <cache> <object> <source>: each cache is another build machine
+function compile() {
+    echo "$3" > $WORK_DIR/test.c
+    CLANG_HASH_CACHE=$WORK_DIR/$1 \
+        clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                        -c $WORK_DIR/test.c -o $WORK_DIR/$2 2>&1 >/dev/null \
+        | grep '^skipped:' | tr -d ' '
+}
+
+[ "$(compile a a.o 'int main() {return 0;}')" = "skipped:0" ] || fail ${0}:${LINENO} "initial compilation skipped"
+# The upload is asynchronous
+for i in $(seq 50); do [ -n "$(ls $WORK_DIR/server/test)" ] && break; sleep 0.1; done
+[ "$(ls $WORK_DIR/server/test | wc -l)" = 1 ] || fail ${0}:${LINENO} "object not uploaded"
+echo "  OK: ${0}:${LINENO}"
+
+[ "$(compile b b.o 'int main() {return 0;}')" = "skipped:1" ] || fail ${0}:${LINENO} "remote object not used"
+cmp -s $WORK_DIR/a.o $WORK_DIR/b.o || fail ${0}:${LINENO} "objects differ"
+echo "  OK: ${0}:${LINENO}"
+
+# An unreachable server is a miss
+CLANG_HASH_REMOTE=http://127.0.0.1:1/test
+[ "$(compile c c.o 'int main() {return 0;}')" = "skipped:0" ] || fail ${0}:${LINENO} "skipped without object"
+echo "  OK: ${0}:${LINENO}"
+
+# A host name that does not resolve is a miss, and the resolver does
+# not hold up the compilation beyond the time limit
+CLANG_HASH_REMOTE=http://chash-test.invalid/test
+start=$(date +%s)
+[ "$(CLANG_HASH_REMOTE_TIMEOUT=200 compile d d.o 'int main() {return 0;}')" = "skipped:0" ] || fail ${0}:${LINENO} "skipped without object"
+[ $(( $(date +%s) - start )) -lt 10 ] || fail ${0}:${LINENO} "resolver exceeded the time limit"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# check-name: Narrow the dependency file to the headers that influence the hash
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_SEMANTIC_DEPS=1
+CHASH_AFFECTED="${CHASH_AFFECTED:-$(dirname $0)/../../build/tools/chash-affected}"
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+cd $WORK_DIR
+cat > used.h <<'H'
+#ifndef USED_H
+#define USED_H
+struct point { int x, y; };
+H
+echo '#endif' >> used.h
+cat > unused.h <<'H'
+#ifndef UNUSED_H
+#define UNUSED_H
+int unused(int);
+#endif
+H
+echo '#define VALUE 42' > macro.h
+echo '#include "used.h"
+#include "unused.h"
+#include "macro.h"
+int main() { struct point p = { VALUE, 0 }; return p.x; }' > test.c
+
+clang-hash-stop -MD -MP -c test.c -o test.o || fail ${0}:${LINENO} "compilation failed"
+[ -f test.o.hash.deps ] || fail ${0}:${LINENO} "no semantic dependencies"
+grep -q "^$WORK_DIR/used.h$" test.o.hash.deps || fail ${0}:${LINENO} "used header missing"
+grep -q "^$WORK_DIR/macro.h$" test.o.hash.deps || fail ${0}:${LINENO} "macro header missing"
+grep -q "unused.h" test.o.hash.deps && fail ${0}:${LINENO} "unused header recorded"
+echo "  OK: ${0}:${LINENO}"
+
+# The dependency file of -MD is narrowed, with phony targets
+grep -q "used.h" test.d || fail ${0}:${LINENO} "used header not in depfile"
+grep -q "unused.h" test.d && fail ${0}:${LINENO} "depfile not narrowed"
+grep -q "^macro.h:$" test.d || fail ${0}:${LINENO} "no phony target"
+echo "  OK: ${0}:${LINENO}"
+
+# The affected objects are known without the compiler
+[ "$($CHASH_AFFECTED -h used.h test.o)" = "test.o" ] || fail ${0}:${LINENO} "used header not affecting"
+$CHASH_AFFECTED -h unused.h test.o && fail ${0}:${LINENO} "unused header affecting"
+echo "  OK: ${0}:${LINENO}"
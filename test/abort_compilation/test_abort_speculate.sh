@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# check-name: Look up the hash while the backend runs
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_SPECULATE=1
+# A local lookup finishes long before the optimizer is done with the
+# many functions below, so a hit reaches its last checkpoint
+export CLANG_HASH_CACHE=$WORK_DIR/cache
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# The backend warns about the frame of big(), during the code generation
+function compile() {
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    -O2 -Wframe-larger-than=128 -c test.c -o test.o 2>&1 >/dev/null
+}
+
+# generate <value>: many functions that keep the optimizer busy
+function generate() {
+    for i in $(seq 1 400); do
+        echo "int f$i(int *a, int n) { int s = $1; for (int i = 0; i < n; i++) s += a[i] * $i + (s >> 3); return s; }"
+    done
+    echo 'int big(int i) { volatile char buffer[1024]; buffer[i] = 1; return buffer[0]; }'
+}
+
+cd $WORK_DIR
+generate 42 > test.c
+
+out=$(compile)
+echo "$out" | grep -q '^skipped:0' || fail ${0}:${LINENO} "first compilation skipped"
+[ "$(echo "$out" | grep -c 'stack frame size')" = 1 ] || fail ${0}:${LINENO} "no backend warning"
+[ -f test.o ] || fail ${0}:${LINENO} "no object"
+cp test.o first.o
+echo "  OK: ${0}:${LINENO}"
+
+# The hit stops the backend at a checkpoint of the optimizer. A warning
+# does not prevent it; the backend warning, which was not emitted yet,
+# is replayed once from the cache.
+touch test.c
+out=$(compile) || fail ${0}:${LINENO} "hit failed"
+echo "$out" | grep -q '^skipped:1' || fail ${0}:${LINENO} "hit not skipped"
+[ "$(echo "$out" | grep -c 'stack frame size')" = 1 ] || fail ${0}:${LINENO} "backend warning not replayed once"
+cmp -s test.o first.o || fail ${0}:${LINENO} "object differs"
+ls test.o-* 2>/dev/null && fail ${0}:${LINENO} "unfinished output left"
+echo "  OK: ${0}:${LINENO}"
+
+# A miss keeps the output of the backend and its warning
+generate 23 > test.c
+out=$(compile)
+echo "$out" | grep -q '^skipped:0' || fail ${0}:${LINENO} "miss skipped"
+[ "$(echo "$out" | grep -c 'stack frame size')" = 1 ] || fail ${0}:${LINENO} "no backend warning"
+cmp -s test.o first.o && fail ${0}:${LINENO} "object not compiled"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# check-name: Record hits and misses in the statistics log
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_STATS="${CHASH_STATS:-${DIR}/../../build/tools/chash-stats}"
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+export CLANG_HASH_STATS=$WORK_DIR/stats.log
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# compile <source>
+function compile() {
+    echo "$1" > $WORK_DIR/test.c
+    clang-hash-stop -c $WORK_DIR/test.c -o $WORK_DIR/test.o
+}
+
+compile 'int main() {return 0;}'
+compile 'int main() {return 0;} /* comment */'
+compile 'int main() {return 1;}'
+
+$CHASH_STATS > $WORK_DIR/summary || fail ${0}:${LINENO} "no report"
+grep -q '^cache hits  *1 ' $WORK_DIR/summary || fail ${0}:${LINENO} "hit not counted"
+grep -q '^cache misses  *2 ' $WORK_DIR/summary || fail ${0}:${LINENO} "misses not counted"
+echo "  OK: ${0}:${LINENO}"
+
+# The second miss is explained, and grouped by its object file
+$CHASH_STATS -g reason | grep -q 'changed function:main' || fail ${0}:${LINENO} "miss reason not recorded"
+$CHASH_STATS -g tu | grep -q " 1  *2 .*$WORK_DIR/test.o$" || fail ${0}:${LINENO} "object not grouped"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# check-name: Hash the top-level declarations on several threads
+
+WORK_DIR=`mktemp -d`
+trap "rm -rf $WORK_DIR" EXIT
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+function top_level_hash() {
+    clang-hash-stop -Xclang -plugin-arg-clang-hash -Xclang -hash-verbose \
+                    -c test.c -o test.o 2>&1 >/dev/null | grep '^top-level-hash:'
+}
+
+cd $WORK_DIR
+cat > test.c <<'C'
+struct list;
+static int helper(void);
+int length(struct list *l);
+struct list { struct list *next; int value; };
+int length(struct list *l) { return l ? 1 + length(l->next) : helper(); }
+static int helper(void) { return 0; }
+struct { int a; } anonymous;
+int main(void) { struct list l = { 0, 1 }; return length(&l) + anonymous.a; }
+C
+
+# The threads must see the same AST as the parser did
+SERIAL=$(top_level_hash)
+[ -n "$SERIAL" ] || fail ${0}:${LINENO} "no hash"
+rm -f test.o*
+THREADED=$(CLANG_HASH_THREADS=4 top_level_hash)
+[ "$SERIAL" = "$THREADED" ] || fail ${0}:${LINENO} "hash depends on the threads"
+echo "  OK: ${0}:${LINENO}"
+
+# A change is still noticed
+sed -i 's/int value;/long value;/' test.c
+[ "$(CLANG_HASH_THREADS=4 top_level_hash)" != "$SERIAL" ] || fail ${0}:${LINENO} "change not noticed"
+echo "  OK: ${0}:${LINENO}"
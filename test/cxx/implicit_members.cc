@@ -0,0 +1,12 @@
+struct S {
+  int a; {{A}}
+  long a; {{B}}
+  char b;
+};
+
+S copy(const S &s) { return s; }
+
+/*
+ * check-name: implicit copy constructor
+ * assert-obj: A != B
+ */
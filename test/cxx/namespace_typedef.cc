@@ -0,0 +1,11 @@
+namespace ns {
+typedef int unused_t; {{A}}
+{{B}}
+
+int foo() { return 1; }
+}
+
+/*
+ * check-name: unused typedef within namespace
+ * assert-ast: A == B
+ */
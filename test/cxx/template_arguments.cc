@@ -0,0 +1,15 @@
+template <typename T>
+struct Box {
+  T value;
+  T get() const { return value; }
+};
+
+Box<int> box; {{A}}
+Box<long> box; {{B}}
+
+int foo() { return box.get(); }
+
+/*
+ * check-name: class template arguments
+ * assert-obj: A != B
+ */
@@ -0,0 +1,12 @@
+template <typename T>
+T twice(T x) {
+  return x + x; {{A}}
+  return 2 * x; {{B}}
+}
+
+int foo() { return twice(21); }
+
+/*
+ * check-name: function template body
+ * assert-obj: A != B
+ */
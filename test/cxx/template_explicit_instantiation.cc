@@ -0,0 +1,18 @@
+template <typename T>
+struct Counter {
+  T next() const;
+};
+
+template <typename T>
+T Counter<T>::next() const {
+  return T(1); {{A}}
+  return T(2); {{B}}
+}
+
+template struct Counter<int>;
+
+/*
+ * check-name: explicit instantiation of an unreferenced class template
+ * assert-obj: A != B
+ * assert-ast: A != B
+ */
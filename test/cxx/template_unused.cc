@@ -0,0 +1,24 @@
+/* Stands for a template in an included header that is never used */
+template <typename T>
+T unused(T x) {
+  return x + x; {{A}}
+  return 2 * x; {{B}}
+}
+
+template <typename T>
+struct Unused {
+  T get() const;
+};
+
+template <typename T>
+T Unused<T>::get() const {
+  return T(); {{A}}
+  return T(1); {{B}}
+}
+
+int foo() { return 42; }
+
+/*
+ * check-name: unused template patterns
+ * assert-ast: A == B
+ */
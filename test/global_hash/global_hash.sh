@@ -6,7 +6,7 @@ fn=test_use_global # placeholder
 DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
 WORK_DIR=""
 
-CLANG_HASH_COLLECT="${DIR}/../../build/wrappers/clang-hash-collect"
+CLANG_HASH_COLLECT="${CLANG_HASH_COLLECT:-${DIR}/../../build/wrappers/clang-hash-collect}"
 CLANG_HASH_GLOBAL="${DIR}/../../clang-hash-global"
 
 do_copy=true
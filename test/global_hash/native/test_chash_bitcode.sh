@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# check-name: chash-collect: cached bitcode for other backend options
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_COLLECT="${CHASH_COLLECT:-${DIR}/../../../build/tools/chash-collect}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake compiler runs the frontend like the plugin with the bitcode
+# cache: it reports its inputs and the frontend hash, and stores the
+# bitcode. Given bitcode, it only runs the backend.
+cat > fakecc <<'CC'
+#!/bin/bash
+args="$*"
+while [ "$1" != "-o" ]; do shift; done
+if [[ "$args" == *.bc ]]; then
+    echo "backend $args" >> runs
+    echo "backend" > "$2"
+    exit 0
+fi
+echo frontend >> runs
+echo "a.c:1: warning: frontend" >&2
+hash=$(cat a.c | md5sum | cut -d' ' -f1)
+echo "hash-start-time-ns 1" >&2
+echo "top-level-hash: $hash" >&2
+echo "frontend-hash: $hash" >&2
+echo "$PWD/a.c" > "$CLANG_HASH_INPUTS"
+mkdir -p "$CLANG_HASH_CACHE/${hash:0:2}"
+echo bitcode > "$CLANG_HASH_CACHE/${hash:0:2}/${hash:2}.bc"
+echo "object" > "$2"
+echo "a.c:1: warning: backend" >&2
+true
+CC
+chmod +x fakecc
+echo "int main() {}" > a.c
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+export CLANG_HASH_BITCODE=1 CLANG_HASH_CACHE=$WORK_DIR/cache
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -O1 -c a.c -o a.o 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+echo "  OK: ${0}:${LINENO}"
+
+# Another optimization level only runs the backend on the bitcode
+err=$($CHASH_COLLECT ./fakecc -stop-if-same-hash -O2 -c a.c -o a.o 2>&1) \
+    || fail ${0}:${LINENO} "backend failed"
+[ "$(grep -c frontend runs)" = 1 ] || fail ${0}:${LINENO} "frontend was run"
+last=$(tail -n1 runs)
+[[ "$last" == *" -O2 "*".bc" ]] || fail ${0}:${LINENO} "wrong backend command: $last"
+[[ "$last" == *"a.c"* || "$last" == *"plugin"* ]] && fail ${0}:${LINENO} "frontend arguments: $last"
+[ "$(cat a.o)" = backend ] || fail ${0}:${LINENO} "no object"
+[ "$err" = "a.c:1: warning: frontend" ] || fail ${0}:${LINENO} "wrong diagnostics: $err"
+echo "  OK: ${0}:${LINENO}"
+
+# Options of the frontend and changed inputs run the frontend
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -O2 -march=native -c a.c -o a.o 2>/dev/null
+[ "$(grep -c frontend runs)" = 2 ] || fail ${0}:${LINENO} "frontend option not noticed"
+echo "int x;" >> a.c
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -O3 -c a.c -o a.o 2>/dev/null
+[ "$(grep -c frontend runs)" = 3 ] || fail ${0}:${LINENO} "changed input not noticed"
+echo "  OK: ${0}:${LINENO}"
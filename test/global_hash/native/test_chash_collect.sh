@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# check-name: chash-collect: native collection of .info records
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_COLLECT="${CHASH_COLLECT:-${DIR}/../../../build/tools/chash-collect}"
+CHASH_GLOBAL="${CHASH_GLOBAL:-${DIR}/../../../build/tools/chash-global}"
+CHASH_OBJHASH="${CHASH_OBJHASH:-${DIR}/../../../build/tools/chash-objhash}"
+CC="${CC:-gcc}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake compiler prints the lines of the plugin and a diagnostic
+cat > fakecc <<'CC'
+#!/bin/bash
+case "$*" in *-fplugin=*-hash-verbose*) ;; *) echo "no plugin"; exit 2;; esac
+while [ "$1" != "-o" ]; do shift; done
+# With OBJECT set, the output is that object file
+if [ -n "$OBJECT" ]; then cp "$OBJECT" "$2"; else echo object > "$2"; fi
+exec 1>&2
+echo "warning: something"
+echo "top-level-hash: 0123abcd"
+echo "processed-bytes: 42"
+echo "element-hashes: [('function:main', '01', ['function:helper']), ('function:helper', '02', [])]"
+echo "skipped:0"
+[ -z "$FAIL" ]
+CC
+chmod +x fakecc
+echo "int main() {}" > a.c
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+err=$(CLANG_HASH_OUTPUT_DIR=$PWD $CHASH_COLLECT ./fakecc -c a.c -o a.o 2>&1 >/dev/null) \
+    || fail ${0}:${LINENO} "compilation failed"
+echo "$err" | grep -q "^warning: something" || fail ${0}:${LINENO} "diagnostics lost"
+[ "$(wc -l < a.o.info)" = 1 ] || fail ${0}:${LINENO} "no record"
+grep -q "'ast-hash': '0123abcd'" a.o.info || fail ${0}:${LINENO} "no ast-hash"
+grep -q "'return-code': 0" a.o.info || fail ${0}:${LINENO} "no return-code"
+grep -q "'skipped'" a.o.info && fail ${0}:${LINENO} "not skipped"
+echo "  OK: ${0}:${LINENO}"
+
+# The record can be read by chash-global
+main=$($CHASH_GLOBAL --definition main $PWD)
+[ -n "$main" ] || fail ${0}:${LINENO} "no global hash"
+echo "  OK: ${0}:${LINENO}"
+
+# The return code is passed through, and records are appended
+FAIL=1 CLANG_HASH_OUTPUT_DIR=$PWD $CHASH_COLLECT ./fakecc -c a.c -o a.o 2>/dev/null \
+    && fail ${0}:${LINENO} "failure not passed through"
+[ "$(wc -l < a.o.info)" = 2 ] || fail ${0}:${LINENO} "record not appended"
+tail -n 1 a.o.info | grep -q "'return-code': 1" || fail ${0}:${LINENO} "wrong return-code"
+echo "  OK: ${0}:${LINENO}"
+
+# The object-hash is that of chash-objhash, also for names with quotes
+$CC -c a.c -o real.o || fail ${0}:${LINENO} "compilation failed"
+mkdir "it's"
+OBJECT=real.o CLANG_HASH_OUTPUT_DIR=$PWD $CHASH_COLLECT ./fakecc -c a.c -o "it's/a.o" 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+hash=$($CHASH_OBJHASH "it's/a.o")
+[ -n "$hash" ] || fail ${0}:${LINENO} "no object hash"
+grep -q "'object-hash': '$hash'" "it's/a.o.info" || fail ${0}:${LINENO} "wrong object-hash"
+echo "  OK: ${0}:${LINENO}"
+
+# With gcc, an absolute base directory maps the debug information; a
+# relative one is ignored, like in the plugins
+sed '1a echo "$*" > args' fakecc > fakegcc
+chmod +x fakegcc
+CLANG_HASH_BASEDIR=$PWD/ CLANG_HASH_OUTPUT_DIR=$PWD $CHASH_COLLECT ./fakegcc -c a.c -o a.o 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+grep -q -- "-fdebug-prefix-map=$PWD=\. " args || fail ${0}:${LINENO} "no prefix map"
+CLANG_HASH_BASEDIR=relative CLANG_HASH_OUTPUT_DIR=$PWD $CHASH_COLLECT ./fakegcc -c a.c -o a.o 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+grep -q -- "-fdebug-prefix-map" args && fail ${0}:${LINENO} "relative base directory used"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# check-name: chash-collect: direct mode skips the compiler
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_COLLECT="${CHASH_COLLECT:-${DIR}/../../../build/tools/chash-collect}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake compiler stores its object like the plugin in stop mode and
+# reports the files it read. Every run is counted.
+cat > fakecc <<'CC'
+#!/bin/bash
+echo run >> runs
+while [ "$1" != "-o" ]; do shift; done
+hash=$(cat a.c a.h | md5sum | cut -d' ' -f1)
+cat a.c a.h > "$2"
+echo "$hash" > "$2.hash"
+ln -f "$2" "$2.hash.copy"
+[ -n "$CLANG_HASH_INPUTS" ] && printf "$PWD/a.c\n$PWD/a.h\n" > "$CLANG_HASH_INPUTS"
+echo "a.c:1: warning: something" >&2
+echo "top-level-hash: $hash" >&2
+echo "element-hashes: [('function:main', '01', [])]" >&2
+true
+CC
+chmod +x fakecc
+echo "#include \"a.h\"" > a.c
+echo "int main() {}" >> a.c
+echo "int x;" > a.h
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+export CLANG_HASH_DIRECT=1
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+[ -f a.o.hash.manifest ] || fail ${0}:${LINENO} "no manifest"
+echo "  OK: ${0}:${LINENO}"
+
+# Unchanged inputs: the object comes from the manifest, with the diagnostics
+rm a.o
+err=$($CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>&1) \
+    || fail ${0}:${LINENO} "direct hit failed"
+[ "$(wc -l < runs)" = 1 ] || fail ${0}:${LINENO} "compiler was run"
+cmp -s a.o a.o.hash.copy || fail ${0}:${LINENO} "object not restored"
+[ "$err" = "a.c:1: warning: something" ] || fail ${0}:${LINENO} "wrong diagnostics: $err"
+echo "  OK: ${0}:${LINENO}"
+
+# A changed header or another argument runs the compiler
+echo "int y;" >> a.h
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>/dev/null
+[ "$(wc -l < runs)" = 2 ] || fail ${0}:${LINENO} "changed header not detected"
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -O2 -c a.c -o a.o 2>/dev/null
+[ "$(wc -l < runs)" = 3 ] || fail ${0}:${LINENO} "changed arguments not detected"
+echo "  OK: ${0}:${LINENO}"
+
+# Without CLANG_HASH_DIRECT, the compiler always runs
+CLANG_HASH_DIRECT= $CHASH_COLLECT ./fakecc -stop-if-same-hash -O2 -c a.c -o a.o 2>/dev/null
+[ "$(wc -l < runs)" = 4 ] || fail ${0}:${LINENO} "direct mode without CLANG_HASH_DIRECT"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# check-name: chash-global: SCC-based global hashes on .info records
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_GLOBAL="${CHASH_GLOBAL:-${DIR}/../../../build/tools/chash-global}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+
+# record <info file> <element-hashes>
+function record() {
+    mkdir -p "$(dirname "$WORK_DIR/$1")"
+    echo "{'obj-file': '${1%.info}', 'element-hashes': [$2]}" >> "$WORK_DIR/$1"
+}
+
+function global_hash() {
+    $CHASH_GLOBAL --definition "$1" "$WORK_DIR"
+}
+
+function check() {
+    loc="$1"; shift
+    expected="$1"; shift
+    a="$1"; shift
+    b="$1"; shift
+
+    [[ "$a" == "$b" ]] && differ=false || differ=true
+    if [ -z "$a" -o -z "$b" -o $differ != $expected ]; then
+        echo "!!!Failure ${loc}: hashes differ=${differ} ($a, $b)"
+        exit 1
+    fi
+    echo "  OK: ${loc}"
+}
+
+# even -> odd -> even is a cycle, main -> even, other is unrelated
+record a.o.info "('function:even', '01', ['function:odd', 'function:puts']), ('function:main', '02', ['function:even'])"
+record sub/b.o.info "('function:odd', '03', ['function:even']), ('function:other', '04', [])"
+even_1=$(global_hash even)
+odd_1=$(global_hash odd)
+main_1=$(global_hash main)
+other_1=$(global_hash other)
+check ${0}:${LINENO} true "$even_1" "$odd_1"
+
+# Independent of the order of the records within the cycle
+rm -rf $WORK_DIR/*
+record a.o.info "('function:odd', '03', ['function:even']), ('function:main', '02', ['function:even'])"
+record sub/b.o.info "('function:other', '04', []), ('function:even', '01', ['function:puts', 'function:odd'])"
+check ${0}:${LINENO} false "$even_1" "$(global_hash even)"
+check ${0}:${LINENO} false "$odd_1" "$(global_hash odd)"
+check ${0}:${LINENO} false "$main_1" "$(global_hash main)"
+
+# Only the most recent record of an .info file counts. A change within
+# the cycle changes all users, but not unrelated symbols.
+record a.o.info "('function:odd', '05', ['function:even']), ('function:main', '02', ['function:even'])"
+check ${0}:${LINENO} true "$even_1" "$(global_hash even)"
+check ${0}:${LINENO} true "$odd_1" "$(global_hash odd)"
+check ${0}:${LINENO} true "$main_1" "$(global_hash main)"
+check ${0}:${LINENO} false "$other_1" "$(global_hash other)"
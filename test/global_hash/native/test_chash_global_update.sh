@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# check-name: chash-global: incremental update from the symbol store
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_GLOBAL="${CHASH_GLOBAL:-${DIR}/../../../build/tools/chash-global}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+mkdir $WORK_DIR/src
+
+# record <info file> <element-hashes>
+function record() {
+    echo "{'element-hashes': [$2]}" >> "$WORK_DIR/src/$1"
+}
+
+# check_update <loc> <expected output>
+function check_update() {
+    loc="$1"; shift
+    expected="$1"; shift
+
+    out=$($CHASH_GLOBAL --update $WORK_DIR/store $WORK_DIR/src 2>/dev/null | tr '\n' ' ')
+    if [ "$out" != "$expected" ]; then
+        echo "!!!Failure ${loc}: '$out' != '$expected'"
+        exit 1
+    fi
+    echo "  OK: ${loc}"
+}
+
+record a.o.info "('function:main', '01', ['function:helper', 'function:puts'])"
+record b.o.info "('function:helper', '02', []), ('function:other', '03', [])"
+check_update ${0}:${LINENO} "added function:helper added function:main added function:other "
+check_update ${0}:${LINENO} ""
+
+# A new record with the same hashes does not change anything
+record b.o.info "('function:helper', '02', []), ('function:other', '03', [])"
+check_update ${0}:${LINENO} ""
+
+# A changed definition changes all its users
+record b.o.info "('function:helper', '04', []), ('function:other', '03', [])"
+check_update ${0}:${LINENO} "changed function:helper changed function:main "
+
+# Removing a definition changes its users
+rm $WORK_DIR/src/b.o.info
+check_update ${0}:${LINENO} "removed function:helper changed function:main removed function:other "
+
+# The store is equivalent to a fresh calculation
+record b.o.info "('function:helper', '02', []), ('function:other', '03', [])"
+check_update ${0}:${LINENO} "added function:helper changed function:main added function:other "
+main=$($CHASH_GLOBAL --definition main $WORK_DIR/src)
+grep -q "^S	function:main	.*	$main\$" $WORK_DIR/store || { echo "!!!Failure: store differs"; exit 1; }
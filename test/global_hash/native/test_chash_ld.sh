@@ -0,0 +1,74 @@
+#!/bin/bash
+
+# check-name: chash-ld: skip links with unchanged global hashes
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_LD="${CHASH_LD:-${DIR}/../../../build/tools/chash-ld}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake linker counts its invocations
+cat > ld.sh <<'LD'
+#!/bin/bash
+echo link >> links
+cat $(printf "%s\n" "${@:3}" | grep -v "^-") > "$2"
+LD
+chmod +x ld.sh
+
+# object <file> <content> <element-hashes>
+function object() {
+    echo "$2" > $1
+    echo "{'ast-hash': '$2', 'element-hashes': [$3]}" >> $1.info
+}
+
+# check_link <loc> <expected number of links> [flags]
+function check_link() {
+    loc="$1"; shift
+    expected="$1"; shift
+
+    $CHASH_LD ./ld.sh -o prog a.o b.o "$@" || { echo "!!!Failure ${loc}: link failed"; exit 1; }
+    if [ "$(wc -l < links)" != "$expected" ]; then
+        echo "!!!Failure ${loc}: $(wc -l < links) links, expected $expected"
+        exit 1
+    fi
+    echo "  OK: ${loc}"
+}
+
+touch links
+object a.o A "('function:main', '01', ['function:helper'])"
+object b.o B "('function:helper', '02', [])"
+check_link ${0}:${LINENO} 1
+check_link ${0}:${LINENO} 1
+
+# New objects with the same hashes are not linked again
+sleep 0.01
+object a.o A "('function:main', '01', ['function:helper'])"
+check_link ${0}:${LINENO} 1
+
+# A changed definition, changed flags, and a modified output are linked
+object b.o B "('function:helper', '03', [])"
+check_link ${0}:${LINENO} 2
+check_link ${0}:${LINENO} 3 -static
+check_link ${0}:${LINENO} 3 -static
+echo modified >> prog
+check_link ${0}:${LINENO} 4 -static
+
+# Objects without up-to-date record contribute their contents
+echo B2 > b.o
+check_link ${0}:${LINENO} 5 -static
+check_link ${0}:${LINENO} 5 -static
+echo B3 > b.o
+check_link ${0}:${LINENO} 6 -static
+
+# Files named by linker options contribute their contents
+echo "VERS_1 { global: *; };" > vers.map
+check_link ${0}:${LINENO} 7 -static -Wl,--version-script=vers.map
+check_link ${0}:${LINENO} 7 -static -Wl,--version-script=vers.map
+echo "VERS_2 { global: *; };" > vers.map
+check_link ${0}:${LINENO} 8 -static -Wl,--version-script=vers.map
+echo "SECTIONS { }" > link.ld
+check_link ${0}:${LINENO} 9 -static -Xlinker -T -Xlinker link.ld
+echo "SECTIONS { .text : { } }" > link.ld
+check_link ${0}:${LINENO} 10 -static -Xlinker -T -Xlinker link.ld
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# check-name: chash-objhash: normalized object-file hashes
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_OBJHASH="${CHASH_OBJHASH:-${DIR}/../../../build/tools/chash-objhash}"
+CC="${CC:-gcc}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+echo 'static int x; int f(void) { static int y; return ++x + ++y; }' > a.c
+cp a.c b.c
+echo 'int f(void) { return 2; }' > c.c
+mkdir sub
+$CC -c a.c -o a.o && $CC -c b.c -o b.o && $CC -c c.c -o c.o && $CC -c a.c -o sub/a.o \
+    || fail ${0}:${LINENO} "compilation failed"
+
+# The name of the source file does not change the hash
+a=$($CHASH_OBJHASH a.o)
+b=$($CHASH_OBJHASH b.o)
+c=$($CHASH_OBJHASH c.o)
+[ -n "$a" ] || fail ${0}:${LINENO} "no hash"
+[ "$a" = "$b" ] || fail ${0}:${LINENO} "$a != $b"
+[ "$a" != "$c" ] || fail ${0}:${LINENO} "different objects, same hash"
+echo "  OK: ${0}:${LINENO}"
+
+# Directories are hashed in parallel, with the paths
+out=$($CHASH_OBJHASH -j 2 . | tr '\n' ' ')
+[ "$out" = "$a ./a.o $b ./b.o $c ./c.o $a ./sub/a.o " ] || fail ${0}:${LINENO} "$out"
+echo "  OK: ${0}:${LINENO}"
+
+# Other files are an error
+$CHASH_OBJHASH a.c 2>/dev/null && fail ${0}:${LINENO} "no error"
+echo "  OK: ${0}:${LINENO}"
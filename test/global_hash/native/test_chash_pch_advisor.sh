@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# check-name: chash-pch-advisor: prefix header from the recorded parse times
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_PCH_ADVISOR="${CHASH_PCH_ADVISOR:-${DIR}/../../../build/tools/chash-pch-advisor}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+# record <source> <parse time>
+function record() {
+    echo "{'filename': '$1', 'obj-file': '${1%.c}.o', 'parse-duration': $2}" > ${1%.c}.o.info
+}
+
+touch util.h
+printf '/* a */\n#include <stdio.h>\n#include "util.h"\n#include <math.h>\nint a;\n' > a.c
+printf '#include <stdio.h>\n// b\n#include "util.h"\n\nint b;\n' > b.c
+printf '#include <stdio.h>\n#include "util.h"\n#include <math.h>\nint c;\n' > c.c
+printf '#include <string.h>\nint d;\n' > d.c
+record a.c 3000000000
+record b.c 1000000000
+record c.c 2000000000
+record d.c 5000000000
+
+# stdio.h and util.h save 2 x 1 s, the prefix with math.h saves 1 x 2 s;
+# the longer one wins
+out=$($CHASH_PCH_ADVISOR -v -o prefix.h .) || fail ${0}:${LINENO} "no advice"
+[ "$(grep -c '^#include' prefix.h)" = 3 ] || fail ${0}:${LINENO} "wrong prefix: $(cat prefix.h)"
+grep -q "^#include \"$PWD/util.h\"$" prefix.h || fail ${0}:${LINENO} "quoted include not resolved"
+echo "$out" | grep -q "^flags: -include-pch $PWD/prefix.h.pch$" || fail ${0}:${LINENO} "no flags: $out"
+echo "$out" | grep -q "^estimated saving: 2.000 s" || fail ${0}:${LINENO} "wrong saving: $out"
+echo "  OK: ${0}:${LINENO}"
+
+# A faster unit with the long prefix makes the short one better
+record c.c 500000000
+$CHASH_PCH_ADVISOR -o prefix.h . > /dev/null || fail ${0}:${LINENO} "no advice"
+[ "$(grep -c '^#include' prefix.h)" = 2 ] || fail ${0}:${LINENO} "wrong prefix: $(cat prefix.h)"
+echo "  OK: ${0}:${LINENO}"
+
+# Without a shared prefix, there is no advice
+rm a.o.info b.o.info
+$CHASH_PCH_ADVISOR -o prefix.h . > /dev/null && fail ${0}:${LINENO} "advice without a shared prefix"
+echo "  OK: ${0}:${LINENO}"
+
+# A precompiled header is specific to its language, C and C++ units
+# with the same prefix do not share it
+printf '#include <string.h>\nint e;\n' > e.cc
+record e.cc 5000000000
+$CHASH_PCH_ADVISOR -o prefix.h . > /dev/null && fail ${0}:${LINENO} "advice for C and C++ units"
+printf '#include <string.h>\nint f;\n' > f.cc
+record f.cc 5000000000
+out=$($CHASH_PCH_ADVISOR -o prefix.h .) || fail ${0}:${LINENO} "no advice"
+echo "$out" | grep -q "^build: clang \$CFLAGS -x c++-header" || fail ${0}:${LINENO} "not for C++: $out"
+echo "$out" | grep -q "^translation units: 2 of 4$" || fail ${0}:${LINENO} "wrong units: $out"
+echo "  OK: ${0}:${LINENO}"
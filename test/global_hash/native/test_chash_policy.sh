@@ -0,0 +1,69 @@
+#!/bin/bash
+
+# check-name: chash-collect: adaptive policy leaves out the plugin
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_COLLECT="${CHASH_COLLECT:-${DIR}/../../../build/tools/chash-collect}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake compiler logs whether it ran with the plugin. With the
+# plugin, a.c always misses and b.c always hits.
+cat > fakecc <<'CC'
+#!/bin/bash
+src=$(for a in "$@"; do [[ "$a" == *.c ]] && echo "$a"; done)
+if [[ " $* " == *" -fplugin="* ]]; then
+    echo plugin >> "$src.runs"
+    echo "parse-time-ns: 1000" >&2
+    echo "hash-time-ns: 1000" >&2
+    [ "$src" = b.c ] && echo "skipped: 1" >&2
+else
+    echo plain >> "$src.runs"
+fi
+while [ "$1" != "-o" ]; do shift; done
+touch "$2"
+CC
+chmod +x fakecc
+echo "int main() {}" > a.c
+echo "int f() {}" > b.c
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+function compile() {
+    for i in $(seq $2); do
+        $CHASH_COLLECT ./fakecc -stop-if-same-hash -c $1 -o ${1%.c}.o 2>/dev/null \
+            || fail ${0}:${LINENO} "compilation failed"
+    done
+}
+
+export CLANG_HASH_POLICY=$WORK_DIR/policy
+unset CLANG_HASH_OUTPUT_DIR
+
+# After four misses, the plugin is left out
+compile a.c 5
+[ -f policy ] || fail ${0}:${LINENO} "no history"
+[ "$(grep -c plugin a.c.runs)" = 4 ] || fail ${0}:${LINENO} "plugin not left out"
+[ "$(tail -n1 a.c.runs)" = plain ] || fail ${0}:${LINENO} "no plain compilation"
+echo "  OK: ${0}:${LINENO}"
+
+# Sixteen compilations later, the plugin is probed again
+compile a.c 16
+[ "$(grep -c plain a.c.runs)" = 16 ] || fail ${0}:${LINENO} "wrong number of bypasses"
+[ "$(tail -n1 a.c.runs)" = plugin ] || fail ${0}:${LINENO} "no probe"
+echo "  OK: ${0}:${LINENO}"
+
+# Hits keep the plugin
+compile b.c 8
+grep -q plain b.c.runs && fail ${0}:${LINENO} "plugin left out for hits"
+echo "  OK: ${0}:${LINENO}"
+
+# Without the history, the plugin always runs
+unset CLANG_HASH_POLICY
+compile a.c 2
+[ "$(tail -n2 a.c.runs | grep -c plugin)" = 2 ] || fail ${0}:${LINENO} "policy without history"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# check-name: chash-collect: token prefilter skips the compiler
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+CHASH_COLLECT="${CHASH_COLLECT:-${DIR}/../../../build/tools/chash-collect}"
+
+WORK_DIR=`mktemp -d -p "$DIR"`
+trap "rm -rf $WORK_DIR" EXIT
+cd $WORK_DIR
+
+# The fake compiler preprocesses by dropping comments and the include,
+# and stores its object like the plugin in stop mode. Every
+# compilation is counted.
+cat > fakecc <<'CC'
+#!/bin/bash
+if [[ " $* " == *" -E "* ]]; then
+    echo '# 1 "a.c"'
+    sed -e 's,//.*,,' -e '/^#include/d' a.h a.c
+    exit 0
+fi
+echo run >> runs
+while [ "$1" != "-o" ]; do shift; done
+hash=$(sed -e 's,//.*,,' a.h a.c | md5sum | cut -d' ' -f1)
+sed -e 's,//.*,,' a.h a.c > "$2"
+echo "$hash" > "$2.hash"
+ln -f "$2" "$2.hash.copy"
+echo "a.c:1: warning: something" >&2
+echo "top-level-hash: $hash" >&2
+echo "element-hashes: [('function:main', '01', [])]" >&2
+true
+CC
+chmod +x fakecc
+echo "#include \"a.h\"" > a.c
+echo "int main() {}" >> a.c
+echo "int x;" > a.h
+
+function fail() {
+    echo "!!!Failure $1: $2"
+    exit 1
+}
+
+export CLANG_HASH_PREFILTER=1
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>/dev/null \
+    || fail ${0}:${LINENO} "compilation failed"
+[ -f a.o.hash.tokens ] || fail ${0}:${LINENO} "no token digest"
+echo "  OK: ${0}:${LINENO}"
+
+# A comment does not change the tokens: the object comes from the cache
+echo "// comment" >> a.h
+rm a.o
+err=$($CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>&1) \
+    || fail ${0}:${LINENO} "prefilter hit failed"
+[ "$(wc -l < runs)" = 1 ] || fail ${0}:${LINENO} "compiler was run"
+cmp -s a.o a.o.hash.copy || fail ${0}:${LINENO} "object not restored"
+[ "$err" = "a.c:1: warning: something" ] || fail ${0}:${LINENO} "wrong diagnostics: $err"
+echo "  OK: ${0}:${LINENO}"
+
+# Different tokens run the compiler
+echo "int y;" >> a.h
+$CHASH_COLLECT ./fakecc -stop-if-same-hash -c a.c -o a.o 2>/dev/null
+[ "$(wc -l < runs)" = 2 ] || fail ${0}:${LINENO} "changed tokens not detected"
+echo "  OK: ${0}:${LINENO}"
@@ -0,0 +1,90 @@
+#!/bin/bash
+
+# check-name: dependency_analyzer: indexed queries match the recursive search
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PYTHON2="${PYTHON2:-python2}"
+
+$PYTHON2 - "$DIR/../../experiments" <<'EOF' || exit 1
+import random
+import sys
+
+sys.path.insert(0, sys.argv[1])
+sys.path.insert(0, sys.argv[1] + "/..")
+import dependency_analyzer as da
+
+
+# The recursive search that the index replaced
+def old_dependents(symbol, call_graph, processed):
+    if symbol in processed:
+        return set()
+    processed.add(symbol)
+    dependents = {s for s in call_graph if symbol in call_graph[s]}
+    for sym in set(dependents):
+        dependents |= old_dependents(sym, call_graph, processed)
+    processed.remove(symbol)
+    return dependents
+
+
+def old_dependees(symbol, call_graph, processed):
+    if symbol in processed:
+        return set()
+    processed.add(symbol)
+    dependees = {s for s in call_graph if s in call_graph[symbol]}
+    for sym in set(dependees):
+        dependees |= old_dependees(sym, call_graph, processed)
+    processed.remove(symbol)
+    return dependees
+
+
+def check(name, call_graph):
+    symbols = set(call_graph)
+    for callees in call_graph.values():
+        symbols |= set(callees)
+    for symbol in sorted(symbols):
+        expected = old_dependents(symbol, call_graph, set())
+        result = da.get_dependents(symbol, call_graph)
+        if result != expected:
+            print "!!!Failure %s: dependents of %s: %s, expected %s" % \
+                (name, symbol, sorted(result), sorted(expected))
+            sys.exit(1)
+        if symbol not in call_graph:
+            continue
+        expected = old_dependees(symbol, call_graph, set())
+        result = da.get_dependees(symbol, call_graph)
+        if result != expected:
+            print "!!!Failure %s: dependees of %s: %s, expected %s" % \
+                (name, symbol, sorted(result), sorted(expected))
+            sys.exit(1)
+    # A batch query is the union of the single ones
+    changed = sorted(call_graph)[:2]
+    expected = set(changed)
+    for symbol in changed:
+        expected |= old_dependents(symbol, call_graph, set())
+    if da.get_impacted_funcs(set(changed), call_graph) != expected:
+        print "!!!Failure %s: impacted functions of %s" % (name, changed)
+        sys.exit(1)
+
+
+# main -> parse -> {lex, error}, recursion between eval and apply,
+# a self-recursive walk, and the undefined library function printf
+check("small graph", {
+    'main': ['parse', 'eval', 'printf'],
+    'parse': ['lex', 'error'],
+    'lex': ['error'],
+    'error': ['printf'],
+    'eval': ['apply', 'walk'],
+    'apply': ['eval'],
+    'walk': ['walk'],
+})
+print "  OK: small graph"
+
+random.seed(42)
+for n in range(50):
+    names = ['f%d' % i for i in range(8)]
+    call_graph = {}
+    for name in names[:6]:
+        call_graph[name] = random.sample(names, random.randint(0, 3))
+    check("random graph %d" % n, call_graph)
+print "  OK: random graphs"
+EOF
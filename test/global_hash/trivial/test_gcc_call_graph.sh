@@ -0,0 +1,22 @@
+#!/bin/bash
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+
+# The gcc plugin exports the call graph in the same record format
+CLANG_HASH_COLLECT="${DIR}/../../../build/wrappers/gcc-hash-collect"
+source "$DIR/../global_hash.sh"
+
+# check-name: clang-hash-global with the call graph of the gcc plugin
+
+out=$(check_global_hash_changed ${0}:${LINENO} \
+                          "int callee_g1() {return 0;} int caller_g1() {return callee_g1();} int other_g1() {return 0;}" \
+                          "int callee_g1() {return 1;} int caller_g1() {return callee_g1();} int other_g1() {return 0;}" \
+                          "callee_g1" true \
+                          "caller_g1" true \
+                          "other_g1" false)
+
+out=$(check_global_hash_changed ${0}:${LINENO} \
+                          "int var_g2 = 1; int user_g2() {return var_g2;} int other_g2() {return 0;}" \
+                          "int var_g2 = 2; int user_g2() {return var_g2;} int other_g2() {return 0;}" \
+                          "user_g2" true \
+                          "other_g2" false)
@@ -0,0 +1,17 @@
+typedef struct point point_t;
+
+int is_null(point_t *p) { return p == 0; }
+
+struct point {
+  int x;
+  int y;  {{A}}
+  long y; {{B}}
+};
+
+point_t origin;
+
+/*
+ * check-name: struct completed after its first use
+ * assert-ast: A != B
+ * assert-obj: A != B
+ */
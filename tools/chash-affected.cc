@@ -0,0 +1,114 @@
+/*
+ * chash-affected: which objects does a header change affect?
+ *
+ *   chash-affected [-v] -h <changed file> [-h <changed file>]... <object or directory>...
+ *
+ * Answers from the semantic dependencies that the clang plugin records
+ * with CLANG_HASH_SEMANTIC_DEPS (<object>.hash.deps, see
+ * common/semantic-deps.h), without starting the compiler. The affected
+ * objects are printed, with -v together with the changed file they
+ * depend on. Objects without recorded dependencies count as affected.
+ * Directories are searched for *.o files.
+ *
+ * The exit code is 0 if an object is affected, and 1 otherwise.
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <map>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "semantic-deps.h"
+
+/// Recursively collects all object files below a directory
+static void listObjectFiles(const std::string &Directory,
+                            std::vector<std::string> &Result) {
+  DIR *D = opendir(Directory.c_str());
+  if (!D)
+    return;
+  while (struct dirent *Entry = readdir(D)) {
+    const std::string Name = Entry->d_name;
+    if (Name == "." || Name == "..")
+      continue;
+    const std::string Path = Directory + "/" + Name;
+    struct stat Stat;
+    if (stat(Path.c_str(), &Stat) != 0)
+      continue;
+    if (S_ISDIR(Stat.st_mode))
+      listObjectFiles(Path, Result);
+    else if (Name.size() > 2 && Name.compare(Name.size() - 2, 2, ".o") == 0)
+      Result.push_back(Path);
+  }
+  closedir(D);
+}
+
+/// The canonical path, as the dependencies name the files like they
+/// were included
+static std::string canonicalPath(const std::string &Path) {
+  static std::map<std::string, std::string> Cache;
+  auto It = Cache.find(Path);
+  if (It != Cache.end())
+    return It->second;
+  char Buffer[PATH_MAX];
+  const std::string Result = realpath(Path.c_str(), Buffer) ? Buffer : Path;
+  Cache[Path] = Result;
+  return Result;
+}
+
+static void usage(const char *Name) {
+  fprintf(stderr,
+          "usage: %s [-v] -h <changed file> [-h <changed file>]... "
+          "<object or directory>...\n",
+          Name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  bool Verbose = false;
+  std::set<std::string> Changed;
+  std::vector<std::string> Objects;
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    struct stat Stat;
+    if (Arg == "-v")
+      Verbose = true;
+    else if (Arg == "-h" && I + 1 < argc)
+      Changed.insert(canonicalPath(argv[++I]));
+    else if (Arg[0] == '-')
+      usage(argv[0]);
+    else if (stat(Arg.c_str(), &Stat) == 0 && S_ISDIR(Stat.st_mode))
+      listObjectFiles(Arg, Objects);
+    else
+      Objects.push_back(Arg);
+  }
+  if (Changed.empty() || Objects.empty())
+    usage(argv[0]);
+
+  bool Affected = false;
+  for (const std::string &Object : Objects) {
+    SemanticDeps Deps;
+    std::string Reason = "no semantic dependencies";
+    if (Deps.read(SemanticDeps::filename(Object))) {
+      Reason = "";
+      for (const std::string &File : Deps.m_files) {
+        if (Changed.count(canonicalPath(File))) {
+          Reason = File;
+          break;
+        }
+      }
+    }
+    if (Reason == "")
+      continue;
+    Affected = true;
+    if (Verbose)
+      printf("%s: %s\n", Object.c_str(), Reason.c_str());
+    else
+      printf("%s\n", Object.c_str());
+  }
+  return Affected ? 0 : 1;
+}
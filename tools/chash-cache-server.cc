@@ -0,0 +1,205 @@
+/*
+ * chash-cache-server: reference server for the remote object cache
+ * (see common/remote-cache.h).
+ *
+ *   chash-cache-server [-d <directory>] [-b <address>] [-p <port>]
+ *
+ * Objects are stored as files below the directory (default: the
+ * current directory): PUT /<prefix>/<key> writes, GET reads. Every
+ * connection is served by its own thread. With port 0, a free port is
+ * chosen; the port is printed on stdout when the server is ready.
+ */
+
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "process.h"
+
+static std::string StorageDirectory = ".";
+
+/// Request paths may only consist of harmless path components
+static bool isValidPath(const std::string &Path) {
+  if (Path.size() < 2 || Path[0] != '/')
+    return false;
+  size_t Start = 1;
+  while (Start <= Path.size()) {
+    size_t End = Path.find('/', Start);
+    if (End == std::string::npos)
+      End = Path.size();
+    const std::string Component = Path.substr(Start, End - Start);
+    if (Component.empty() || Component[0] == '.')
+      return false;
+    for (char C : Component) {
+      if (!isalnum((unsigned char)C) && C != '.' && C != '_' && C != '-')
+        return false;
+    }
+    Start = End + 1;
+  }
+  return true;
+}
+
+static void sendResponse(int Fd, const char *Status, const std::string &Body = "") {
+  const std::string Header = std::string("HTTP/1.0 ") + Status +
+                             "\r\nContent-Length: " +
+                             std::to_string(Body.size()) + "\r\n\r\n";
+  writeAll(Fd, Header.data(), Header.size());
+  writeAll(Fd, Body.data(), Body.size());
+}
+
+static bool readFile(const std::string &Path, std::string &Data) {
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F)
+    return false;
+  char Buffer[65536];
+  size_t Length;
+  while ((Length = fread(Buffer, 1, sizeof(Buffer), F)) > 0)
+    Data.append(Buffer, Length);
+  const bool Ok = !ferror(F);
+  fclose(F);
+  return Ok;
+}
+
+/// Writes the file atomically, so that readers never see a partial object
+static bool writeFile(const std::string &Path, const std::string &Data) {
+  for (size_t Slash = Path.find('/', StorageDirectory.size() + 1);
+       Slash != std::string::npos; Slash = Path.find('/', Slash + 1))
+    mkdir(Path.substr(0, Slash).c_str(), 0755);
+  const std::string Temporary =
+      Path + ".tmp." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  FILE *F = fopen(Temporary.c_str(), "wb");
+  if (!F)
+    return false;
+  const bool Written = fwrite(Data.data(), 1, Data.size(), F) == Data.size();
+  if (fclose(F) != 0 || !Written || rename(Temporary.c_str(), Path.c_str()) != 0) {
+    unlink(Temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+static void serve(int Fd) {
+  // Request line and headers
+  std::string Request;
+  char Buffer[65536];
+  size_t HeaderEnd;
+  while ((HeaderEnd = Request.find("\r\n\r\n")) == std::string::npos) {
+    const ssize_t N = read(Fd, Buffer, sizeof(Buffer));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0 || Request.size() > 65536) {
+      close(Fd);
+      return;
+    }
+    Request.append(Buffer, N);
+  }
+
+  char Method[16], Path[1024];
+  if (sscanf(Request.c_str(), "%15s %1023s", Method, Path) != 2 ||
+      !isValidPath(Path)) {
+    sendResponse(Fd, "400 Bad Request");
+    close(Fd);
+    return;
+  }
+  const std::string File = StorageDirectory + Path;
+
+  if (strcmp(Method, "GET") == 0) {
+    std::string Data;
+    if (readFile(File, Data))
+      sendResponse(Fd, "200 OK", Data);
+    else
+      sendResponse(Fd, "404 Not Found");
+  } else if (strcmp(Method, "PUT") == 0) {
+    const char *LengthHeader = strcasestr(Request.c_str(), "\r\nContent-Length:");
+    if (!LengthHeader || LengthHeader > Request.c_str() + HeaderEnd) {
+      sendResponse(Fd, "411 Length Required");
+      close(Fd);
+      return;
+    }
+    const size_t Length = strtoull(LengthHeader + 17, nullptr, 10);
+    std::string Data = Request.substr(HeaderEnd + 4);
+    while (Data.size() < Length) {
+      const ssize_t N = read(Fd, Buffer, sizeof(Buffer));
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N <= 0)
+        break;
+      Data.append(Buffer, N);
+    }
+    if (Data.size() != Length)
+      sendResponse(Fd, "400 Bad Request");
+    else if (writeFile(File, Data))
+      sendResponse(Fd, "201 Created");
+    else
+      sendResponse(Fd, "500 Internal Server Error");
+  } else {
+    sendResponse(Fd, "405 Method Not Allowed");
+  }
+  close(Fd);
+}
+
+int main(int argc, char **argv) {
+  std::string Address = "0.0.0.0";
+  int Port = 8080;
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    if (Arg == "-d" && I + 1 < argc) {
+      StorageDirectory = argv[++I];
+    } else if (Arg == "-b" && I + 1 < argc) {
+      Address = argv[++I];
+    } else if (Arg == "-p" && I + 1 < argc) {
+      Port = atoi(argv[++I]);
+    } else {
+      fprintf(stderr, "usage: %s [-d <directory>] [-b <address>] [-p <port>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  while (StorageDirectory.size() > 1 &&
+         StorageDirectory[StorageDirectory.size() - 1] == '/')
+    StorageDirectory.erase(StorageDirectory.size() - 1);
+  signal(SIGPIPE, SIG_IGN);
+
+  int Listener = socket(AF_INET, SOCK_STREAM, 0);
+  const int One = 1;
+  setsockopt(Listener, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+  struct sockaddr_in Addr;
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(Port);
+  if (inet_pton(AF_INET, Address.c_str(), &Addr.sin_addr) != 1) {
+    fprintf(stderr, "invalid address: %s\n", Address.c_str());
+    return 1;
+  }
+  socklen_t Length = sizeof(Addr);
+  if (bind(Listener, (struct sockaddr *)&Addr, sizeof(Addr)) != 0 ||
+      listen(Listener, 128) != 0 ||
+      getsockname(Listener, (struct sockaddr *)&Addr, &Length) != 0) {
+    perror("chash-cache-server");
+    return 1;
+  }
+  printf("%d\n", ntohs(Addr.sin_port));
+  fflush(stdout);
+
+  for (;;) {
+    int Fd = accept(Listener, nullptr, nullptr);
+    if (Fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept");
+      return 1;
+    }
+    std::thread(serve, Fd).detach();
+  }
+}
@@ -0,0 +1,718 @@
+/*
+ * chash-collect: native replacement for the clang-hash-collect and
+ * gcc-hash-collect wrappers. It can be used as compiler launcher
+ *
+ *   chash-collect <compiler> <arguments>...     (CMAKE_C_COMPILER_LAUNCHER)
+ *
+ * or, installed as gcc-... or clang-..., as the compiler itself. The
+ * compiler runs with the hashing plugin (the gcc plugin, if the name of
+ * the compiler contains gcc or g++). Its stdout is inherited and its
+ * stderr is passed through as it arrives, while the lines of the
+ * plugin are collected. Afterwards, a record is appended to
+ * $CLANG_HASH_OUTPUT_DIR/<objectfile>.info, like the Python wrapper
+ * does.
+ *
+ * The wrapper options (-stop-if-same-hash, -hash-verbose) and
+ * environment variables (STOP_IF_SAME_HASH, NO_COMPILE, PROJECT,
+ * RUN_ID) are the same as for clang-hash-collect. The object-hash is
+ * calculated by chash-objhash, like hash-objectfile does it for the
+ * Python wrapper; it is None if the object cannot be hashed.
+ *
+ * With CLANG_HASH_DIRECT set, stop-if-same-hash compilations with
+ * clang use the direct mode (see direct-mode.h): if the files that the
+ * last compilation read are unchanged, the object comes from the
+ * cache without starting the compiler. With CLANG_HASH_PREFILTER set,
+ * the same happens if the preprocessed token stream is unchanged.
+ *
+ * With CLANG_HASH_BITCODE set (and a cache directory), the plugin
+ * caches the frontend output of clang. If the files that the last
+ * compilation with the same frontend arguments read are unchanged, the
+ * cached bitcode is compiled with the backend options of this
+ * compilation (see frontend-options.h), without parsing.
+ *
+ * With CLANG_HASH_POLICY=<file>, stop-if-same-hash compilations keep a
+ * history per object file in that file (see policy.h). Translation
+ * units that do not hit often enough to pay for the hashing are
+ * compiled without the plugin, and probed again from time to time.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <vector>
+
+#include "command-line.h"
+#include "direct-mode.h"
+#include "frontend-options.h"
+#include "info-file.h"
+#include "object-cache.h"
+#include "policy.h"
+#include "process.h"
+#include "stats-log.h"
+
+#ifndef CHASH_CLANG_COMPILER
+#define CHASH_CLANG_COMPILER "clang"
+#endif
+#ifndef CHASH_GCC_COMPILER
+#define CHASH_GCC_COMPILER "gcc"
+#endif
+#ifndef CHASH_CLANG_PLUGIN
+#define CHASH_CLANG_PLUGIN "libclang-hash.so"
+#endif
+#ifndef CHASH_GCC_PLUGIN
+#define CHASH_GCC_PLUGIN "libgcc-hash.so"
+#endif
+#ifndef CHASH_HASH_OBJECTFILE
+#define CHASH_HASH_OBJECTFILE "chash-objhash"
+#endif
+
+static std::string baseName(const std::string &Path) {
+  const size_t Slash = Path.rfind('/');
+  return Slash == std::string::npos ? Path : Path.substr(Slash + 1);
+}
+
+static bool endsWith(const std::string &S, const char *Suffix) {
+  const size_t Length = strlen(Suffix);
+  return S.size() >= Length && S.compare(S.size() - Length, Length, Suffix) == 0;
+}
+
+static bool removeArgument(std::vector<std::string> &Args, const char *Arg) {
+  for (auto It = Args.begin(); It != Args.end(); ++It) {
+    if (*It == Arg) {
+      Args.erase(It);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool hasArgument(const std::vector<std::string> &Args, const char *Arg) {
+  for (const std::string &A : Args) {
+    if (A == Arg)
+      return true;
+  }
+  return false;
+}
+
+/// The argument after Option, or an empty string
+static std::string argumentValue(const std::vector<std::string> &Args,
+                                 const char *Option) {
+  for (size_t I = 0; I + 1 < Args.size(); ++I) {
+    if (Args[I] == Option)
+      return Args[I + 1];
+  }
+  return "";
+}
+
+static void makePath(const std::string &Path) {
+  for (size_t Slash = Path.find('/', 1); ; Slash = Path.find('/', Slash + 1)) {
+    mkdir(Path.substr(0, Slash).c_str(), 0777);
+    if (Slash == std::string::npos)
+      break;
+  }
+}
+
+/// The first word after the prefix in a line of the plugin output
+static std::string lineValue(const std::string &Line, size_t PrefixLength) {
+  std::stringstream Stream(Line.substr(PrefixLength));
+  std::string Value;
+  Stream >> Value;
+  return Value;
+}
+
+/// Whether a switch of the environment is set
+static bool isEnabled(const char *Name) {
+  const char *Value = getenv(Name);
+  return Value && *Value;
+}
+
+/// The dependency file that -MD or -MMD writes, or an empty string
+static std::string dependencyFile(const std::vector<std::string> &Args,
+                                  const std::string &ObjectFile) {
+  bool Dependencies = false;
+  std::string DepFile;
+  for (size_t I = 0; I < Args.size(); ++I) {
+    if (Args[I] == "-MD" || Args[I] == "-MMD")
+      Dependencies = true;
+    else if (Args[I] == "-MF" && I + 1 < Args.size())
+      DepFile = Args[I + 1];
+    else if (Args[I].compare(0, 3, "-MF") == 0 && Args[I].size() > 3)
+      DepFile = Args[I].substr(3);
+  }
+  if (!Dependencies)
+    return "";
+  if (DepFile == "") {
+    const size_t Dot = ObjectFile.rfind('.');
+    DepFile = (Dot == std::string::npos || Dot < ObjectFile.rfind('/') + 1
+                   ? ObjectFile
+                   : ObjectFile.substr(0, Dot)) + ".d";
+  }
+  return DepFile;
+}
+
+/// Searches a program in PATH, like execvp
+static std::string findProgram(const std::string &Name) {
+  if (Name.find('/') != std::string::npos)
+    return Name;
+  const char *Path = getenv("PATH");
+  std::stringstream Dirs(Path ? Path : "");
+  std::string Dir;
+  while (std::getline(Dirs, Dir, ':')) {
+    const std::string Candidate = (Dir == "" ? "." : Dir) + "/" + Name;
+    if (access(Candidate.c_str(), X_OK) == 0)
+      return Candidate;
+  }
+  return Name;
+}
+
+/// The key of a compiler invocation in direct mode: everything besides
+/// the input files that determines the compiler output
+static std::string invocationKey(const std::string &Compiler,
+                                 const std::vector<std::string> &Command) {
+  Hash H;
+  H << std::string("chash-direct 1");
+  for (const std::string &Program : {findProgram(Compiler),
+                                     std::string(CHASH_CLANG_PLUGIN)}) {
+    struct stat Stat;
+    H << (uint32_t)Program.size() << Program;
+    if (stat(Program.c_str(), &Stat) == 0) {
+      H << (uint64_t)Stat.st_size << (uint64_t)Stat.st_mtim.tv_sec
+        << (uint64_t)Stat.st_mtim.tv_nsec;
+    }
+  }
+  for (const std::string &Arg : Command)
+    H << (uint32_t)Arg.size() << Arg;
+  char Cwd[4096];
+  if (getcwd(Cwd, sizeof(Cwd)))
+    H << std::string("cwd ") << std::string(Cwd);
+  for (const char *Name : {"CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+                           "SOURCE_DATE_EPOCH", "CLANG_HASH_BASEDIR"}) {
+    const char *Value = getenv(Name);
+    H << (uint8_t)(Value != nullptr) << std::string(Value ? Value : "")
+      << (uint8_t)0;
+  }
+  return H.getDigest().asString();
+}
+
+/// Lines of the plugin in the compiler output, which do not belong to
+/// the diagnostics
+static bool isPluginLine(const std::string &Line) {
+  for (const char *Prefix :
+       {"hash-start-time-ns", "top-level-hash:", "processed-bytes:",
+        "parse-time-ns:", "hash-time-ns:", "element-hashes:", "hash-equal:",
+        "skipped:", "miss-reason:", "remote-hit:", "frontend-hash:",
+        "bitcode-hit:"}) {
+    if (Line.compare(0, strlen(Prefix), Prefix) == 0)
+      return true;
+  }
+  return Line.find(": old hash string: ") != std::string::npos ||
+         (Line.compare(0, 30, "Warning: could not open file \"") == 0 &&
+          endsWith(Line, "cannot read previous hash."));
+}
+
+static bool readFile(const std::string &Path, std::string &Data) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In.good())
+    return false;
+  Data.assign(std::istreambuf_iterator<char>(In), std::istreambuf_iterator<char>());
+  return !In.bad();
+}
+
+/// Places the cached object at the output path
+static bool materializeObject(const std::string &Copy,
+                              const std::string &ObjectFile) {
+  unlink(ObjectFile.c_str());
+  if (link(Copy.c_str(), ObjectFile.c_str()) != 0) {
+    // Another file system
+    std::string Data;
+    std::ofstream Out(ObjectFile, std::ios::binary);
+    if (!readFile(Copy, Data) || !(Out << Data)) {
+      unlink(ObjectFile.c_str());
+      return false;
+    }
+  }
+  utime(ObjectFile.c_str(), nullptr);
+  return true;
+}
+
+/// Uses the cached object of a manifest, if the inputs of the recorded
+/// compilation are unchanged. Returns true on a hit.
+static bool manifestHit(ObjectCache<std::ostream> &Cache, const Manifest &M,
+                      const std::string &ObjectFile, std::string &Stderr) {
+  const auto Start = std::chrono::steady_clock::now();
+  if (!M.inputsUnchanged())
+    return false;
+  const std::string Copy = Cache.find_object_from_hash(ObjectFile, M.AstHash);
+  if (Copy == "" || !materializeObject(Copy, ObjectFile))
+    return false;
+  if (M.DepFile != "") {
+    std::ofstream Out(M.DepFile, std::ios::binary);
+    if (!(Out << M.DepContents))
+      return false;
+  }
+  writeAll(STDERR_FILENO, M.Diagnostics.data(), M.Diagnostics.size());
+  Cache.record_hit(M.AstHash);
+
+  StatsRecord Stats;
+  Stats.m_event = 'H';
+  Stats.m_time = StatsRecord::now_ns();
+  Stats.m_compile_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - Start).count();
+  Stats.m_saved_time = ObjectCache<std::ostream>::read_duration(Copy);
+  Stats.set_objectfile(ObjectFile);
+  struct stat Stat;
+  if (stat(ObjectFile.c_str(), &Stat) == 0)
+    Stats.m_object_size = Stat.st_size;
+  Stats.append(StatsRecord::log_filename());
+
+  // The plugin output for the .info record
+  Stderr = "top-level-hash: " + M.AstHash + "\n" + M.Elements + "\nskipped: 1\n";
+  return true;
+}
+
+/// Takes the AST hash, the element hashes and the diagnostics of a
+/// compilation from its output
+static void parseCompilerOutput(Manifest &M, const std::string &Stderr) {
+  std::stringstream Lines(Stderr);
+  std::string Line;
+  while (std::getline(Lines, Line)) {
+    if (Line.compare(0, 15, "top-level-hash:") == 0)
+      M.AstHash = lineValue(Line, 15);
+    else if (Line.compare(0, 15, "element-hashes:") == 0)
+      M.Elements = Line;
+    else if (!isPluginLine(Line))
+      M.Diagnostics += Line + "\n";
+  }
+}
+
+/// The files that the plugin reported as read
+static std::vector<std::string> readInputs(const std::string &InputsFile) {
+  std::vector<std::string> Inputs;
+  std::ifstream In(InputsFile);
+  std::string Path;
+  while (std::getline(In, Path)) {
+    if (Path != "")
+      Inputs.push_back(Path);
+  }
+  return Inputs;
+}
+
+/// Records the manifest of a successful compilation for direct mode
+static void recordManifest(ObjectCache<std::ostream> &Cache, Manifest &M,
+                           const std::string &ManifestFile,
+                           const std::string &InputsFile,
+                           const std::string &ObjectFile,
+                           const std::string &DepFile,
+                           const std::string &Stderr) {
+  const std::vector<std::string> Inputs = readInputs(InputsFile);
+  parseCompilerOutput(M, Stderr);
+  M.DepFile = DepFile;
+  if (Inputs.empty() || M.AstHash == "" || !M.recordInputs(Inputs) ||
+      (DepFile != "" && !readFile(DepFile, M.DepContents)) ||
+      Cache.find_object_from_hash(ObjectFile, M.AstHash) == "")
+    return;
+  M.write(ManifestFile);
+}
+
+/// The command line without the arguments of the backend, for the key
+/// of the frontend output
+static std::vector<std::string>
+frontendCommand(const std::vector<std::string> &Command) {
+  std::vector<std::string> Result = frontendArguments(Command);
+  Result.push_back("-chash-bitcode");
+  return Result;
+}
+
+/// The command that compiles bitcode with the backend options of an
+/// invocation: without the sources, the plugin and the dependency file
+static std::vector<std::string>
+backendCommand(const std::string &Compiler, const std::vector<std::string> &Args,
+               const std::string &Bitcode) {
+  std::vector<std::string> Command{Compiler, "-Wno-unused-command-line-argument"};
+  for (size_t I = 0; I < Args.size(); ++I) {
+    const std::string &Arg = Args[I];
+    if (Arg == "-Xclang" && I + 1 < Args.size() &&
+        Args[I + 1] == "-plugin-arg-clang-hash")
+      I += 3; // and the argument
+    else if (Arg == "-x" || Arg == "-MF" || Arg == "-MT" || Arg == "-MQ")
+      ++I;
+    else if (!isSourceFile(Arg) && Arg.compare(0, 2, "-x") != 0 &&
+             Arg.compare(0, 2, "-M") != 0)
+      Command.push_back(Arg);
+  }
+  Command.push_back(Bitcode);
+  return Command;
+}
+
+/// Compiles the cached frontend output of a manifest with the backend,
+/// if the inputs of the recorded compilation are unchanged. Returns
+/// true, if the frontend was skipped; ReturnCode is the one of the
+/// backend.
+static bool bitcodeHit(const std::string &Compiler,
+                       const std::vector<std::string> &Args, const Manifest &M,
+                       const std::string &ObjectFile, std::string &Stderr,
+                       int &ReturnCode) {
+  if (!M.inputsUnchanged())
+    return false;
+  ObjectCache<std::ostream> Bitcode =
+      ObjectCache<std::ostream>::from_environment(nullptr, "bc");
+  const std::string Path = Bitcode.find_object_from_hash(ObjectFile, M.AstHash);
+  if (Path == "")
+    return false;
+  if (M.DepFile != "") {
+    std::ofstream Out(M.DepFile, std::ios::binary);
+    if (!(Out << M.DepContents))
+      return false;
+  }
+  writeAll(STDERR_FILENO, M.Diagnostics.data(), M.Diagnostics.size());
+  ReturnCode = runProcess(backendCommand(Compiler, Args, Path), &Stderr);
+  return true;
+}
+
+/// Records the manifest of the frontend output of a successful
+/// compilation. The frontend hash of the plugin names the cached
+/// bitcode; the diagnostics of the frontend precede the plugin output.
+static void recordFrontendManifest(Manifest &M, const std::string &ManifestFile,
+                                   const std::string &InputsFile,
+                                   const std::string &ObjectFile,
+                                   const std::string &DepFile,
+                                   const std::string &Stderr) {
+  std::stringstream Lines(Stderr);
+  std::string Line;
+  bool Frontend = true;
+  while (std::getline(Lines, Line)) {
+    if (Line.compare(0, 14, "frontend-hash:") == 0)
+      M.AstHash = lineValue(Line, 14);
+    if (isPluginLine(Line))
+      Frontend = false;
+    else if (Frontend)
+      M.Diagnostics += Line + "\n";
+  }
+  M.DepFile = DepFile;
+  const std::vector<std::string> Inputs = readInputs(InputsFile);
+  ObjectCache<std::ostream> Bitcode =
+      ObjectCache<std::ostream>::from_environment(nullptr, "bc");
+  if (Inputs.empty() || M.AstHash == "" || !M.recordInputs(Inputs) ||
+      (DepFile != "" && !readFile(DepFile, M.DepContents)) ||
+      Bitcode.find_object_from_hash(ObjectFile, M.AstHash) == "")
+    return;
+  M.write(ManifestFile);
+}
+
+/// The key of the token prefilter: the invocation and the token stream
+/// of the preprocessed translation unit. The preprocessor writes the
+/// dependency file, so that a hit needs no recorded one. Returns an
+/// empty string, if the preprocessor fails.
+static std::string tokenKey(const std::string &Compiler,
+                            const std::vector<std::string> &Command,
+                            const std::vector<std::string> &Args,
+                            const std::string &ObjectFile) {
+  std::vector<std::string> Preprocess{Compiler};
+  bool DepTarget = false, DepOutput = false;
+  for (size_t I = 0; I < Args.size(); ++I) {
+    if (Args[I] == "-c") {
+      Preprocess.push_back("-E");
+    } else if (Args[I] == "-o") {
+      ++I;
+    } else {
+      DepTarget |= Args[I].compare(0, 3, "-MT") == 0 ||
+                   Args[I].compare(0, 3, "-MQ") == 0;
+      DepOutput |= Args[I].compare(0, 3, "-MF") == 0;
+      Preprocess.push_back(Args[I]);
+    }
+  }
+  const std::string DepFile = dependencyFile(Args, ObjectFile);
+  if (DepFile != "" && !DepOutput) {
+    Preprocess.push_back("-MF");
+    Preprocess.push_back(DepFile);
+  }
+  if (DepFile != "" && !DepTarget) {
+    Preprocess.push_back("-MT");
+    Preprocess.push_back(ObjectFile);
+  }
+
+  std::string Preprocessed;
+  if (runProcessOutput(Preprocess, Preprocessed) != 0)
+    return "";
+  Hash H;
+  H << std::string("chash-tokens 1") << invocationKey(Compiler, Command);
+  hashPreprocessedTokens(Preprocessed, H);
+  return H.getDigest().asString();
+}
+
+typedef std::vector<std::pair<std::string, std::string>> PyDict;
+
+/// Sets an entry of the record; later lines overwrite earlier ones
+static void setEntry(PyDict &Record, const std::string &Key, const std::string &Value) {
+  for (auto &Entry : Record) {
+    if (Entry.first == Key) {
+      Entry.second = Value;
+      return;
+    }
+  }
+  Record.emplace_back(Key, Value);
+}
+
+/// Builds the record from the plugin output. The entries are
+/// Python literals.
+static void parsePluginOutput(const std::string &Stderr, PyDict &Record) {
+  std::stringstream Lines(Stderr);
+  std::string Line;
+  while (std::getline(Lines, Line)) {
+    if (Line.compare(0, 14, "top-level-hash") == 0) {
+      setEntry(Record, "ast-hash", pyRepr(lineValue(Line, 15)));
+    } else if (Line.compare(0, 16, "processed-bytes:") == 0) {
+      setEntry(Record, "processed-bytes", std::to_string(atoll(lineValue(Line, 16).c_str())));
+    } else if (Line.compare(0, 13, "hash-time-ns:") == 0) {
+      setEntry(Record, "hash-duration", std::to_string(atoll(lineValue(Line, 13).c_str())));
+    } else if (Line.compare(0, 14, "parse-time-ns:") == 0) {
+      setEntry(Record, "parse-duration", std::to_string(atoll(lineValue(Line, 14).c_str())));
+    } else if (Line.compare(0, 8, "skipped:") == 0) {
+      const std::string Value = lineValue(Line, 8);
+      if (Value == "1" || Value == "true")
+        setEntry(Record, "skipped", "True");
+    } else if (Line.compare(0, 15, "element-hashes:") == 0) {
+      // Only take over well-formed lists
+      const std::string Data = Line.substr(15);
+      PyValue Elements;
+      if (PyLiteralParser(Data).parse(Elements) && Elements.isList())
+        setEntry(Record, "element-hashes", Data.substr(Data.find_first_not_of(' ')));
+    } else if (Line.compare(0, 18, "hash-start-time-ns") == 0) {
+      setEntry(Record, "hash-start-time", std::to_string(atoll(lineValue(Line, 18).c_str())));
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  // Launcher (chash-collect clang -c ...) or compiler (gcc-hash-collect -c ...)
+  std::string Compiler;
+  std::vector<std::string> Args;
+  bool UseGcc;
+  if (argc > 1 && argv[1][0] != '-' && !isSourceFile(argv[1])) {
+    Compiler = argv[1];
+    Args.assign(argv + 2, argv + argc);
+    const std::string Name = baseName(Compiler);
+    UseGcc = Name.find("gcc") != std::string::npos ||
+             Name.find("g++") != std::string::npos;
+  } else {
+    Args.assign(argv + 1, argv + argc);
+    UseGcc = baseName(argv[0]).compare(0, 3, "gcc") == 0;
+    Compiler = UseGcc ? CHASH_GCC_COMPILER : CHASH_CLANG_COMPILER;
+  }
+
+  auto PluginArg = [&](const std::string &Arg) {
+    if (UseGcc) {
+      Args.push_back("-fplugin-arg-libgcc-hash-" + Arg);
+    } else {
+      Args.push_back("-Xclang");
+      Args.push_back("-plugin-arg-clang-hash");
+      Args.push_back("-Xclang");
+      Args.push_back("-" + Arg);
+    }
+  };
+
+  const bool StopIfSameHash =
+      removeArgument(Args, "-stop-if-same-hash") || getenv("STOP_IF_SAME_HASH");
+  removeArgument(Args, "-hash-verbose");
+  const std::string ObjectFile = argumentValue(Args, "-o");
+
+  // The records of CLANG_HASH_OUTPUT_DIR need the plugin
+  PolicyTable Policy;
+  PolicyEntry *History = nullptr;
+  const char *PolicyFile = getenv("CLANG_HASH_POLICY");
+  if (StopIfSameHash && PolicyFile && *PolicyFile && !getenv("NO_COMPILE") &&
+      !getenv("CLANG_HASH_OUTPUT_DIR") && hasArgument(Args, "-c") &&
+      !ObjectFile.empty() && Policy.open(PolicyFile))
+    History = Policy.lookup(policyKey(ObjectFile));
+  const bool Bypass = History && policyBypass(*History);
+
+  if (StopIfSameHash && !Bypass) {
+    PluginArg("stop-if-same-hash");
+    if (UseGcc && !ObjectFile.empty())
+      PluginArg("objectfile=" + ObjectFile);
+  }
+  // The clang plugin maps the debug information itself
+  const std::string Dir = getBaseDir();
+  if ((UseGcc || Bypass) && !Dir.empty())
+    Args.push_back("-fdebug-prefix-map=" + Dir + "=.");
+  if (!Bypass)
+    PluginArg("hash-verbose");
+  if (getenv("NO_COMPILE")) {
+    Args.push_back("-c");
+    Args.push_back("-fsyntax-only");
+  }
+
+  std::vector<std::string> Command;
+  Command.push_back(Compiler);
+  if (!Bypass) {
+    Command.push_back(std::string("-fplugin=") +
+                      (UseGcc ? CHASH_GCC_PLUGIN : CHASH_CLANG_PLUGIN));
+  }
+  Command.insert(Command.end(), Args.begin(), Args.end());
+
+  const auto StartTime = std::chrono::system_clock::now();
+  const auto Start = std::chrono::steady_clock::now();
+  std::string Stderr;
+  int ReturnCode = 0;
+  bool Hit = false;
+
+  // Hits without the compiler need the stop mode of clang
+  const bool CompilerlessHits = StopIfSameHash && !UseGcc && !Bypass &&
+                                !getenv("NO_COMPILE") &&
+                                hasArgument(Args, "-c") && !ObjectFile.empty();
+  ObjectCache<std::ostream> Cache = ObjectCache<std::ostream>::from_environment(nullptr);
+  Manifest M;
+  std::string ManifestFile, InputsFile;
+  if (CompilerlessHits && isEnabled("CLANG_HASH_DIRECT")) {
+    M.Key = invocationKey(Compiler, Command);
+    ManifestFile = Cache.manifest_filename(ObjectFile, M.Key);
+    Manifest Recorded;
+    Hit = Recorded.read(ManifestFile) && Recorded.Key == M.Key &&
+          manifestHit(Cache, Recorded, ObjectFile, Stderr);
+    // The plugin writes the files that the compilation read
+    InputsFile = ManifestFile + ".inputs." + std::to_string(getpid());
+    setenv("CLANG_HASH_INPUTS", InputsFile.c_str(), 1);
+  }
+
+  Manifest Tokens;
+  std::string TokensFile;
+  if (!Hit && CompilerlessHits && isEnabled("CLANG_HASH_PREFILTER")) {
+    Tokens.Key = tokenKey(Compiler, Command, Args, ObjectFile);
+    if (Tokens.Key != "") {
+      TokensFile = Cache.manifest_filename(ObjectFile, Tokens.Key, "tokens");
+      Manifest Recorded;
+      Hit = Recorded.read(TokensFile) && Recorded.Key == Tokens.Key &&
+            manifestHit(Cache, Recorded, ObjectFile, Stderr);
+    }
+  }
+
+  // The frontend output of a compilation with other backend options
+  Manifest Frontend;
+  std::string FrontendFile;
+  if (!Hit && CompilerlessHits && isEnabled("CLANG_HASH_BITCODE") &&
+      Cache.has_cachedir()) {
+    Frontend.Key = invocationKey(Compiler, frontendCommand(Command));
+    FrontendFile = Cache.manifest_filename(ObjectFile, Frontend.Key, "frontend");
+    Manifest Recorded;
+    Hit = Recorded.read(FrontendFile) && Recorded.Key == Frontend.Key &&
+          bitcodeHit(Compiler, Args, Recorded, ObjectFile, Stderr, ReturnCode);
+    if (!Hit && InputsFile.empty()) {
+      InputsFile = FrontendFile + ".inputs." + std::to_string(getpid());
+      setenv("CLANG_HASH_INPUTS", InputsFile.c_str(), 1);
+    }
+  }
+
+  if (!Hit)
+    ReturnCode = runProcess(Command, &Stderr);
+  const long long CompileTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - Start).count();
+
+  if (!InputsFile.empty() && !Hit) {
+    if (ReturnCode == 0 && !ManifestFile.empty()) {
+      recordManifest(Cache, M, ManifestFile, InputsFile, ObjectFile,
+                     dependencyFile(Args, ObjectFile), Stderr);
+    }
+    if (ReturnCode == 0 && !FrontendFile.empty()) {
+      recordFrontendManifest(Frontend, FrontendFile, InputsFile, ObjectFile,
+                             dependencyFile(Args, ObjectFile), Stderr);
+    }
+    unlink(InputsFile.c_str());
+  }
+  // The AST hash decides on a different token stream; its result is
+  // recorded for the next compilation with this one
+  if (!TokensFile.empty() && !Hit && ReturnCode == 0) {
+    parseCompilerOutput(Tokens, Stderr);
+    if (Tokens.AstHash != "" &&
+        Cache.find_object_from_hash(ObjectFile, Tokens.AstHash) != "")
+      Tokens.write(TokensFile);
+  }
+
+  if (History && Bypass) {
+    policySkipped(*History, CompileTime);
+  } else if (History && ReturnCode == 0) {
+    // A miss took the time of a compilation plus the hashing
+    PyDict Times;
+    parsePluginOutput(Stderr, Times);
+    bool Skipped = Hit;
+    long long ParseTime = 0, HashTime = 0;
+    for (const auto &Entry : Times) {
+      if (Entry.first == "parse-duration")
+        ParseTime = atoll(Entry.second.c_str());
+      else if (Entry.first == "hash-duration")
+        HashTime = atoll(Entry.second.c_str());
+      else if (Entry.first == "skipped")
+        Skipped = true;
+    }
+    policyRecord(*History, Skipped, ParseTime, HashTime,
+                 Skipped ? 0 : std::max(CompileTime - HashTime, 1LL));
+  }
+
+  const char *OutputDir = getenv("CLANG_HASH_OUTPUT_DIR");
+  struct stat Stat;
+  if (!hasArgument(Args, "-c") || ObjectFile.empty() ||
+      hasArgument(Args, "/dev/null") || !OutputDir ||
+      stat(OutputDir, &Stat) != 0)
+    return ReturnCode;
+
+  std::string FileName;
+  for (const std::string &Arg : Args) {
+    if (isSourceFile(Arg)) {
+      FileName = Arg;
+      break;
+    }
+  }
+  if (FileName.empty()) // don't need non-C/C++-files
+    return ReturnCode;
+
+  std::string ObjectHash = "None";
+  const bool HaveObject = stat(ObjectFile.c_str(), &Stat) == 0;
+  if (HaveObject) {
+    std::string Output;
+    if (runProcessOutput({CHASH_HASH_OBJECTFILE, ObjectFile}, Output) == 0)
+      ObjectHash = pyRepr(Output.substr(0, Output.find_last_not_of(" \t\r\n") + 1));
+  }
+
+  const char *Project = getenv("PROJECT");
+  const char *RunId = getenv("RUN_ID");
+  char StartTimeString[32];
+  snprintf(StartTimeString, sizeof(StartTimeString), "%.6f",
+           std::chrono::duration<double>(StartTime.time_since_epoch()).count());
+
+  PyDict Record;
+  Record.emplace_back("project", Project ? pyRepr(Project) : "None");
+  Record.emplace_back("filename", pyRepr(FileName));
+  Record.emplace_back("obj-file", pyRepr(ObjectFile));
+  Record.emplace_back("return-code", std::to_string(ReturnCode));
+  Record.emplace_back("compile-duration", std::to_string(CompileTime));
+  Record.emplace_back("object-hash", ObjectHash);
+  Record.emplace_back("start-time", StartTimeString);
+  Record.emplace_back("run_id", std::to_string(RunId ? atoi(RunId) : 0));
+  if (HaveObject)
+    Record.emplace_back("object-file-size", std::to_string(Stat.st_size));
+  parsePluginOutput(Stderr, Record);
+
+  std::string Line = "{";
+  for (const auto &Entry : Record) {
+    if (Line.size() > 1)
+      Line += ", ";
+    Line += pyRepr(Entry.first) + ": " + Entry.second;
+  }
+  Line += "}\n";
+
+  const std::string InfoFile = std::string(OutputDir) + "/" + ObjectFile + ".info";
+  makePath(InfoFile.substr(0, InfoFile.rfind('/')));
+  std::ofstream Out(InfoFile, std::ios::app);
+  Out << Line;
+  if (!Out.good())
+    perror(InfoFile.c_str());
+  return ReturnCode;
+}
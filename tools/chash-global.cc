@@ -0,0 +1,313 @@
+/*
+ * chash-global: calculate global hashes from the .info records of a
+ * project. This is a native replacement for clang-hash-global with the
+ * same command line interface.
+ *
+ * All records are loaded in parallel, the def-use graph is condensed
+ * into strongly connected components, and each component is hashed
+ * exactly once in topological order (see symbol-graph.h).
+ *
+ * With --update <store>, the graph and the hashes of the last run are
+ * kept in a store (see symbol-store.h). Only changed .info files are
+ * read, only components downstream of a change are hashed again, and
+ * the symbols whose global hash changed are printed.
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "info-file.h"
+#include "symbol-graph.h"
+#include "symbol-store.h"
+
+static void usage(const char *Argv0) {
+  fprintf(stderr,
+          "%s --definition <symbol> [directory] [-o <outfile>] [-j <jobs>]\n"
+          "%s --object-file <file> [directory] [-o <outfile>] [-j <jobs>]\n"
+          "%s --local <symbol> [directory] [-o <outfile>] [-j <jobs>]\n"
+          "%s --all [directory] [-o <outfile>] [-j <jobs>]\n"
+          "%s --update <store> [directory] [-j <jobs>]\n",
+          Argv0, Argv0, Argv0, Argv0, Argv0);
+}
+
+/// The prefix-less names of all functions and variables in an object
+/// file (get_symbols_to_check() of clang-hash-global)
+static bool getSymbolsToCheck(const std::string &InfoFile,
+                              std::vector<std::string> &Symbols) {
+  InfoRecord Record;
+  std::string Error;
+  if (!readInfoFile(InfoFile, Record, &Error)) {
+    fprintf(stderr, "Error: %s: %s\n", InfoFile.c_str(), Error.c_str());
+    return false;
+  }
+  for (const InfoElement &Element : Record.Elements) {
+    const size_t Colon = Element.Name.find(':');
+    const std::string Prefix = Element.Name.substr(0, Colon);
+    if (Prefix == "function" || Prefix == "variable")
+      Symbols.push_back(Element.Name.substr(Colon + 1));
+  }
+  return true;
+}
+
+static std::vector<std::string> sortedUses(const SymbolGraph &Graph,
+                                           SymbolGraph::SymbolId Id) {
+  std::vector<std::string> Uses;
+  for (SymbolGraph::SymbolId W : Graph.uses(Id))
+    Uses.push_back(Graph.name(W));
+  std::sort(Uses.begin(), Uses.end());
+  return Uses;
+}
+
+static std::vector<std::string> sortedUses(const InfoElement &Element) {
+  std::vector<std::string> Uses(Element.Uses);
+  std::sort(Uses.begin(), Uses.end());
+  Uses.erase(std::unique(Uses.begin(), Uses.end()), Uses.end());
+  return Uses;
+}
+
+/// Incremental update of the global hashes in the store. Prints one
+/// line (added, changed, removed) for every symbol whose global hash
+/// changed since the last update.
+static int updateStore(const std::string &StorePath, unsigned Jobs) {
+  SymbolStore Store;
+  std::string Error;
+  if (!Store.load(StorePath, &Error)) {
+    fprintf(stderr, "Error: %s: %s\n", StorePath.c_str(), Error.c_str());
+    return 1;
+  }
+
+  std::vector<std::string> Paths, ChangedPaths;
+  listInfoFiles(".", Paths);
+  std::sort(Paths.begin(), Paths.end());
+
+  std::map<std::string, StoredFile> Files;
+  for (const std::string &Path : Paths) {
+    struct stat Stat;
+    if (stat(Path.c_str(), &Stat) != 0)
+      continue;
+    if (Store.isUpToDate(Path, Stat)) {
+      Files[Path] = Store.Files[Path];
+    } else {
+      StoredFile &File = Files[Path];
+      File.MTime = SymbolStore::modificationTime(Stat);
+      File.Size = Stat.st_size;
+      ChangedPaths.push_back(Path);
+    }
+  }
+
+  std::vector<InfoRecord> Records;
+  std::vector<std::string> Errors;
+  readInfoFiles(ChangedPaths, Jobs, Records, Errors);
+  for (const std::string &Error : Errors)
+    fprintf(stderr, "Warning: %s\n", Error.c_str());
+  for (size_t I = 0; I < ChangedPaths.size(); ++I)
+    Files[ChangedPaths[I]].Record = std::move(Records[I]);
+
+  // The state of every symbol after the last update
+  std::unordered_map<std::string, const InfoElement *> OldElements;
+  for (const auto &File : Store.Files) {
+    for (const InfoElement &Element : File.second.Record.Elements)
+      OldElements[Element.Name] = &Element;
+  }
+
+  SymbolGraph Graph;
+  for (const auto &File : Files) {
+    std::string Conflict;
+    if (!Graph.addRecord(File.second.Record, &Conflict)) {
+      fprintf(stderr, "Error: symbol '%s' has different local hashes (%s)\n",
+              Conflict.c_str(), File.first.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<std::string> Previous(Graph.size());
+  std::vector<bool> Dirty(Graph.size(), false);
+  for (SymbolGraph::SymbolId Id = 0; Id < Graph.size(); ++Id) {
+    const std::string &Name = Graph.name(Id);
+    auto Old = OldElements.find(Name);
+    auto Stored = Store.Symbols.find(Name);
+    if (Stored != Store.Symbols.end())
+      Previous[Id] = Stored->second.ComponentHash;
+    if (Old == OldElements.end()) {
+      Dirty[Id] = Graph.isDefined(Id);
+    } else if (!Graph.isDefined(Id)) {
+      Dirty[Id] = true;
+    } else {
+      Dirty[Id] = Old->second->LocalHash != Graph.localHash(Id) ||
+                  sortedUses(*Old->second) != sortedUses(Graph, Id);
+    }
+  }
+
+  const size_t Hashed = Graph.computeGlobalHashes(&Previous, &Dirty);
+
+  std::map<std::string, StoredSymbol> Symbols;
+  std::map<std::string, const char *> Report;
+  for (SymbolGraph::SymbolId Id = 0; Id < Graph.size(); ++Id) {
+    if (!Graph.isDefined(Id))
+      continue;
+    StoredSymbol &Symbol = Symbols[Graph.name(Id)];
+    Symbol.ComponentHash = Graph.componentHash(Id);
+    Symbol.GlobalHash = Graph.globalHash(Id);
+
+    auto Stored = Store.Symbols.find(Graph.name(Id));
+    if (Stored == Store.Symbols.end())
+      Report[Graph.name(Id)] = "added";
+    else if (Stored->second.GlobalHash != Symbol.GlobalHash)
+      Report[Graph.name(Id)] = "changed";
+  }
+  for (const auto &Stored : Store.Symbols) {
+    if (!Symbols.count(Stored.first))
+      Report[Stored.first] = "removed";
+  }
+  for (const auto &Entry : Report)
+    printf("%s %s\n", Entry.second, Entry.first.c_str());
+
+  fprintf(stderr, "chash-global: read %zu of %zu .info files, "
+                  "hashed %zu of %zu components\n",
+          ChangedPaths.size(), Paths.size(), Hashed,
+          Graph.components().size());
+
+  Store.Files.swap(Files);
+  Store.Symbols.swap(Symbols);
+  if (!Store.save(StorePath, &Error)) {
+    fprintf(stderr, "Error: %s\n", Error.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  enum { NONE, DEFINITION, OBJECT_FILE, LOCAL, ALL, UPDATE } Mode = NONE;
+  std::string Param, Directory, OutFile;
+  unsigned Jobs = 0;
+
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    if (Arg == "-h" || Arg == "--help") {
+      usage(argv[0]);
+      return 0;
+    } else if (Arg == "--all") {
+      Mode = ALL;
+    } else if ((Arg == "--definition" || Arg == "--object-file" ||
+                Arg == "--local" || Arg == "--update") && I + 1 < argc) {
+      Mode = Arg == "--definition" ? DEFINITION
+             : Arg == "--local"    ? LOCAL
+             : Arg == "--update"   ? UPDATE
+                                   : OBJECT_FILE;
+      Param = argv[++I];
+    } else if (Arg == "-o" && I + 1 < argc) {
+      OutFile = argv[++I];
+    } else if (Arg == "-j" && I + 1 < argc) {
+      Jobs = atoi(argv[++I]);
+    } else if (Arg[0] != '-' && Directory.empty()) {
+      Directory = Arg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (Mode == NONE) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (Mode == UPDATE && Param[0] != '/') {
+    // The store is relative to the current directory
+    char Cwd[PATH_MAX];
+    if (getcwd(Cwd, sizeof(Cwd)))
+      Param = std::string(Cwd) + "/" + Param;
+  }
+  if (!Directory.empty() && chdir(Directory.c_str()) != 0) {
+    perror(Directory.c_str());
+    return 1;
+  }
+  if (Mode == UPDATE)
+    return updateStore(Param, Jobs);
+
+  std::vector<std::string> Paths;
+  listInfoFiles(".", Paths);
+  std::sort(Paths.begin(), Paths.end());
+
+  std::vector<InfoRecord> Records;
+  std::vector<std::string> Errors;
+  readInfoFiles(Paths, Jobs, Records, Errors);
+  for (const std::string &Error : Errors)
+    fprintf(stderr, "Warning: %s\n", Error.c_str());
+
+  SymbolGraph Graph;
+  for (const InfoRecord &Record : Records) {
+    std::string Conflict;
+    if (!Graph.addRecord(Record, &Conflict)) {
+      fprintf(stderr, "Error: symbol '%s' has different local hashes (%s)\n",
+              Conflict.c_str(), Record.Path.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<std::string> Symbols;
+  switch (Mode) {
+  case DEFINITION:
+    Symbols.push_back(Param);
+    break;
+  case OBJECT_FILE:
+    if (!getSymbolsToCheck(Param + ".info", Symbols))
+      return 1;
+    break;
+  case LOCAL: {
+    SymbolGraph::SymbolId Id = Graph.find(Param);
+    if (Id == SymbolGraph::InvalidId) {
+      fprintf(stderr, "%s not found\n", Param.c_str());
+      return 1;
+    }
+    printf("%s\n", Graph.localHash(Id).c_str());
+    return 0;
+  }
+  case ALL:
+    for (SymbolGraph::SymbolId Id = 0; Id < Graph.size(); ++Id) {
+      if (Graph.isDefined(Id))
+        Symbols.push_back(Graph.name(Id));
+    }
+    break;
+  default:
+    break;
+  }
+
+  Graph.computeGlobalHashes();
+
+  std::vector<std::pair<std::string, std::string>> Result;
+  for (const std::string &Symbol : Symbols) {
+    SymbolGraph::SymbolId Id = Graph.find(Symbol);
+    if (Id == SymbolGraph::InvalidId) {
+      printf("Error: symbol '%s' not found\n", Symbol.c_str());
+      return 1;
+    }
+    Result.push_back(std::make_pair(Symbol, Graph.globalHash(Id)));
+  }
+
+  if (Mode == DEFINITION && OutFile.empty()) {
+    printf("%s\n", Result[0].second.c_str());
+    return 0;
+  }
+
+  std::ofstream File;
+  if (!OutFile.empty()) {
+    File.open(OutFile);
+    if (!File.good()) {
+      perror(OutFile.c_str());
+      return 1;
+    }
+  }
+  std::ostream &Out = OutFile.empty() ? std::cout : File;
+  Out << "{" << (OutFile.empty() ? "\n" : "");
+  for (const auto &Entry : Result)
+    Out << "'" << Entry.first << "':'" << Entry.second << "',\n";
+  Out << "}" << (OutFile.empty() ? "\n" : "");
+  return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * chash-ld: linker wrapper that skips redundant links.
+ *
+ *   chash-ld <linker> <arguments>...
+ *
+ * The wrapper calculates a digest over the link: the linker, all
+ * flags, and all inputs. For an object file with an up-to-date .info
+ * record (written by clang-hash-collect), the input is represented by
+ * the global hashes of its symbols and its AST hash. All other inputs (archives, shared
+ * libraries, linker scripts, objects without record) contribute their
+ * contents, as do the files that options name: -T <script>,
+ * --version-script=<file>, --dynamic-list=<file>, also within -Wl,
+ * and -Xlinker. If the digest equals the digest of the last link and the
+ * output is unchanged since then, the linker is not invoked and the
+ * output only gets a new timestamp.
+ *
+ * The digest of the last link is stored in <output>.chash-ld.
+ * Libraries given with -l are only hashed if they are found in a -L
+ * directory; system libraries contribute their name.
+ *
+ * Set CHASH_LD_VERBOSE to print the decision on stderr.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "file-hash.h"
+#include "info-file.h"
+#include "process.h"
+#include "symbol-graph.h"
+
+static bool isRegularFile(const std::string &Path, struct stat *Stat = nullptr) {
+  struct stat S;
+  if (stat(Path.c_str(), &S) != 0 || !S_ISREG(S.st_mode))
+    return false;
+  if (Stat)
+    *Stat = S;
+  return true;
+}
+
+static long long modificationTime(const struct stat &Stat) {
+  return Stat.st_mtim.tv_sec * 1000000000LL + Stat.st_mtim.tv_nsec;
+}
+
+/// Expands @file response files (whitespace-separated, no quoting)
+static void expandResponseFiles(std::vector<std::string> &Args) {
+  std::vector<std::string> Result;
+  for (const std::string &Arg : Args) {
+    if (Arg.size() > 1 && Arg[0] == '@' && isRegularFile(Arg.substr(1))) {
+      std::ifstream In(Arg.substr(1));
+      std::string Word;
+      while (In >> Word)
+        Result.push_back(Word);
+    } else {
+      Result.push_back(Arg);
+    }
+  }
+  Args.swap(Result);
+}
+
+/// The files that the linker options of the arguments name, e.g.
+/// -T <script>, -Wl,--version-script=<file> or -Xlinker -T -Xlinker
+/// <script>. Plain inputs are not included.
+static std::vector<std::string>
+optionFiles(const std::vector<std::string> &Args) {
+  static const char *const FileOptions[] = {
+      "-T", "--script", "-version-script", "--version-script",
+      "-dynamic-list", "--dynamic-list"};
+  std::vector<std::string> Files;
+  bool ExpectFile = false;
+  for (size_t I = 0; I < Args.size(); ++I) {
+    // The words the linker sees
+    std::vector<std::string> Words;
+    bool Linker = true;
+    if (Args[I].compare(0, 4, "-Wl,") == 0) {
+      size_t Start = 4, Comma;
+      while ((Comma = Args[I].find(',', Start)) != std::string::npos) {
+        Words.push_back(Args[I].substr(Start, Comma - Start));
+        Start = Comma + 1;
+      }
+      Words.push_back(Args[I].substr(Start));
+    } else if (Args[I] == "-Xlinker" && I + 1 < Args.size()) {
+      Words.push_back(Args[++I]);
+    } else {
+      Words.push_back(Args[I]);
+      Linker = false;
+    }
+
+    for (const std::string &Word : Words) {
+      std::string File;
+      if (ExpectFile) {
+        // A plain argument after -T is an input anyway
+        if (Linker)
+          File = Word;
+        ExpectFile = false;
+      } else if (std::find(std::begin(FileOptions), std::end(FileOptions),
+                           Word) != std::end(FileOptions)) {
+        ExpectFile = true;
+      } else if (Word.compare(0, 2, "-T") == 0) {
+        File = Word.substr(2); // -Ttext=<address> is no file
+      } else {
+        const size_t Equal = Word.find('=');
+        if (Equal != std::string::npos &&
+            std::find(std::begin(FileOptions), std::end(FileOptions),
+                      Word.substr(0, Equal)) != std::end(FileOptions))
+          File = Word.substr(Equal + 1);
+        else if (Linker)
+          File = Word; // e.g. -Wl,--whole-archive,libfoo.a
+      }
+      if (!File.empty() && isRegularFile(File))
+        Files.push_back(File);
+    }
+  }
+  return Files;
+}
+
+/// The .info record of an object file, if it was written after the
+/// object file
+static bool readObjectRecord(const std::string &Object, InfoRecord &Record) {
+  struct stat ObjectStat, InfoStat;
+  const std::string Info = Object + ".info";
+  if (!isRegularFile(Object, &ObjectStat) || !isRegularFile(Info, &InfoStat))
+    return false;
+  if (modificationTime(InfoStat) < modificationTime(ObjectStat))
+    return false;
+  return readInfoFile(Info, Record) && !Record.Elements.empty();
+}
+
+struct LinkDigest {
+  std::string Digest;
+  long long OutputMTime = 0;
+  long long OutputSize = 0;
+
+  bool read(const std::string &Path) {
+    std::ifstream In(Path);
+    return (bool)(In >> Digest >> OutputMTime >> OutputSize);
+  }
+
+  bool write(const std::string &Path) const {
+    std::ofstream Out(Path);
+    Out << Digest << "\n" << OutputMTime << "\n" << OutputSize << "\n";
+    return Out.good();
+  }
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <linker> <arguments>...\n", argv[0]);
+    return 1;
+  }
+  const bool Verbose = getenv("CHASH_LD_VERBOSE") != nullptr;
+  std::vector<std::string> Command(argv + 1, argv + argc);
+  std::vector<std::string> Args(argv + 2, argv + argc);
+  expandResponseFiles(Args);
+
+  std::string Output = "a.out";
+  std::vector<std::string> LibraryPaths;
+  for (size_t I = 0; I < Args.size(); ++I) {
+    if (Args[I] == "-o" && I + 1 < Args.size())
+      Output = Args[I + 1];
+    else if (Args[I].compare(0, 2, "-o") == 0 && Args[I].size() > 2)
+      Output = Args[I].substr(2);
+    else if (Args[I] == "-L" && I + 1 < Args.size())
+      LibraryPaths.push_back(Args[I + 1]);
+    else if (Args[I].compare(0, 2, "-L") == 0 && Args[I].size() > 2)
+      LibraryPaths.push_back(Args[I].substr(2));
+  }
+
+  // Flags and inputs in command-line order
+  Hash H;
+  H << Command[0];
+  SymbolGraph Graph;
+  bool Hashable = true;
+  for (size_t I = 0; I < Args.size() && Hashable; ++I) {
+    const std::string &Arg = Args[I];
+    H << (uint32_t)Arg.size() << Arg;
+    if (Arg == Output || (Arg == "-o" && I + 1 < Args.size()))
+      continue;
+
+    std::string Input;
+    if (isRegularFile(Arg)) {
+      Input = Arg;
+    } else if (Arg.compare(0, 2, "-l") == 0) {
+      const std::string Name = Arg.size() > 2 ? Arg.substr(2)
+                               : I + 1 < Args.size() ? Args[I + 1] : "";
+      for (const std::string &Dir : LibraryPaths) {
+        if (isRegularFile(Dir + "/lib" + Name + ".so"))
+          Input = Dir + "/lib" + Name + ".so";
+        else if (isRegularFile(Dir + "/lib" + Name + ".a"))
+          Input = Dir + "/lib" + Name + ".a";
+        if (!Input.empty())
+          break;
+      }
+    }
+    if (Input.empty())
+      continue;
+
+    InfoRecord Record;
+    if (readObjectRecord(Input, Record)) {
+      // The AST hash covers the compiler flags of the object file
+      H << Record.AstHash;
+      std::string Conflict;
+      Hashable = Graph.addRecord(Record, &Conflict);
+    } else {
+      Hashable = hashFileContents(Input, H);
+    }
+  }
+
+  // Linker scripts, version scripts and other files of the options
+  for (const std::string &File : optionFiles(Args)) {
+    if (!Hashable)
+      break;
+    H << (uint32_t)File.size() << File;
+    Hashable = hashFileContents(File, H);
+  }
+
+  if (Hashable) {
+    Graph.computeGlobalHashes();
+    std::vector<std::string> Symbols;
+    for (SymbolGraph::SymbolId Id = 0; Id < Graph.size(); ++Id) {
+      if (Graph.isDefined(Id))
+        Symbols.push_back(Graph.name(Id) + "\t" + Graph.globalHash(Id));
+    }
+    std::sort(Symbols.begin(), Symbols.end());
+    H << (uint32_t)Symbols.size();
+    for (const std::string &Symbol : Symbols)
+      H << Symbol;
+  }
+
+  const std::string DigestFile = Output + ".chash-ld";
+  LinkDigest Current, Previous;
+  Current.Digest = H.getDigest().asString();
+
+  struct stat OutputStat;
+  if (Hashable && Previous.read(DigestFile) && Previous.Digest == Current.Digest &&
+      isRegularFile(Output, &OutputStat) &&
+      modificationTime(OutputStat) == Previous.OutputMTime &&
+      OutputStat.st_size == Previous.OutputSize) {
+    // Same link as last time: only update the timestamp
+    if (utimes(Output.c_str(), nullptr) == 0 && isRegularFile(Output, &OutputStat)) {
+      Current.OutputMTime = modificationTime(OutputStat);
+      Current.OutputSize = OutputStat.st_size;
+      Current.write(DigestFile);
+      if (Verbose)
+        fprintf(stderr, "chash-ld: %s is up to date (%s)\n", Output.c_str(),
+                Current.Digest.c_str());
+      return 0;
+    }
+  }
+
+  if (Verbose)
+    fprintf(stderr, "chash-ld: linking %s (%s)\n", Output.c_str(),
+            Hashable ? Current.Digest.c_str() : "not hashable");
+  unlink(DigestFile.c_str());
+  const int Status = runProcess(Command);
+  if (Status == 0 && Hashable && isRegularFile(Output, &OutputStat)) {
+    Current.OutputMTime = modificationTime(OutputStat);
+    Current.OutputSize = OutputStat.st_size;
+    Current.write(DigestFile);
+  }
+  return Status;
+}
@@ -0,0 +1,293 @@
+/*
+ * chash-objhash: native replacement for wrappers/hash-objectfile.
+ *
+ *   chash-objhash [-j <jobs>] <object file or directory>...
+ *
+ * Calculates a hash over an ELF object file that ignores names which
+ * change although the source did not: numeric suffixes (foo.1234) and
+ * names that contain the source file name (outside of text, data, and
+ * bss symbols). Such names are renamed like hash-objectfile renames
+ * them with objcopy, but in memory: the object is parsed once with
+ * LLVM's Object library and the sections are hashed in place.
+ *
+ * The hash covers the machine, all sections (name, type, flags,
+ * alignment, contents), their relocations, and the symbol table.
+ * Object files are printed as one hash per line. Directories are
+ * searched for *.o files, which are hashed in parallel and printed as
+ * "<hash> <path>".
+ *
+ * The hashes differ from the SHA1 of hash-objectfile, so they can only
+ * be compared with hashes of the same tool.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+
+#include "Hash.h"
+
+using namespace llvm;
+using namespace llvm::object;
+
+typedef std::map<std::string, std::string> RenameMap;
+
+/// Replaces all .NNNN suffixes (at least four digits) in Name by .Index
+static bool renameNumericSuffixes(std::string &Name, size_t Index) {
+  char Replacement[16];
+  snprintf(Replacement, sizeof(Replacement), ".%04zu", Index);
+  bool Renamed = false;
+  for (size_t Dot = Name.find('.'); Dot != std::string::npos;
+       Dot = Name.find('.', Dot + 1)) {
+    size_t End = Dot + 1;
+    while (End < Name.size() && isdigit((unsigned char)Name[End]))
+      ++End;
+    if (End - Dot - 1 >= 4) {
+      Name.replace(Dot, End - Dot, Replacement);
+      Dot += strlen(Replacement) - 1;
+      Renamed = true;
+    }
+  }
+  return Renamed;
+}
+
+/// normalize_names() of hash-objectfile: Names are (kind, name) pairs,
+/// where the file name is only replaced if the kind allows it.
+static void normalizeNames(std::vector<std::pair<bool, std::string>> Names,
+                           const std::string &SourceFile, RenameMap &Renames) {
+  std::sort(Names.begin(), Names.end());
+  Names.erase(std::unique(Names.begin(), Names.end()), Names.end());
+  size_t Count = 0;
+  for (const auto &Entry : Names) {
+    std::string New = Entry.second;
+    if (renameNumericSuffixes(New, Count)) {
+      Renames[Entry.second] = New;
+      ++Count;
+    }
+    if (Entry.first && Entry.second.find(SourceFile) != std::string::npos) {
+      Renames[Entry.second] = "FILE-" + std::to_string(Count);
+      ++Count;
+    }
+  }
+}
+
+static const std::string &renamed(const RenameMap &Renames,
+                                  const std::string &Name) {
+  auto It = Renames.find(Name);
+  return It == Renames.end() ? Name : It->second;
+}
+
+template <typename T> static T consume(Expected<T> Value, T Default = T()) {
+  if (!Value) {
+    consumeError(Value.takeError());
+    return Default;
+  }
+  return *Value;
+}
+
+static std::string sectionName(const SectionRef &Section) {
+#if LLVM_VERSION_MAJOR >= 10
+  return consume(Section.getName()).str();
+#else
+  StringRef Name;
+  Section.getName(Name);
+  return Name.str();
+#endif
+}
+
+static StringRef sectionContents(const SectionRef &Section) {
+#if LLVM_VERSION_MAJOR >= 9
+  return consume(Section.getContents());
+#else
+  StringRef Contents;
+  Section.getContents(Contents);
+  return Contents;
+#endif
+}
+
+/// Text, data, and bss symbols keep names with the file name (the
+/// symbol types T, t, D, d, B, b of nm).
+static bool mayContainFileName(const ELFSymbolRef &Symbol) {
+  if (Symbol.getBinding() == ELF::STB_WEAK)
+    return true;
+  const ObjectFile *Object = Symbol.getObject();
+  section_iterator Section = consume(Symbol.getSection(), Object->section_end());
+  if (Section == Object->section_end())
+    return true;
+  const uint64_t Flags = ELFSectionRef(*Section).getFlags();
+  return !(Flags & ELF::SHF_ALLOC) ||
+         !(Flags & (ELF::SHF_EXECINSTR | ELF::SHF_WRITE));
+}
+
+static std::string symbolName(const SymbolRef &Symbol) {
+  return consume(Symbol.getName()).str();
+}
+
+static void hashString(Hash &H, const std::string &S) {
+  H << (uint32_t)S.size() << S;
+}
+
+static bool hashObjectFile(const std::string &Path, std::string &Result,
+                           std::string &Error) {
+  Expected<OwningBinary<ObjectFile>> Binary = ObjectFile::createObjectFile(Path);
+  if (!Binary) {
+    Error = toString(Binary.takeError());
+    return false;
+  }
+  const auto *Object = dyn_cast<ELFObjectFileBase>(Binary->getBinary());
+  if (!Object) {
+    Error = "not an ELF object file";
+    return false;
+  }
+
+  // hash-objectfile: os.path.basename(fn_in).replace(".o", ".c")
+  std::string SourceFile = Path.substr(Path.rfind('/') + 1);
+  for (size_t Pos = SourceFile.find(".o"); Pos != std::string::npos;
+       Pos = SourceFile.find(".o", Pos + 2))
+    SourceFile[Pos + 1] = 'c';
+
+  std::vector<std::pair<bool, std::string>> SymbolNames, SectionNames;
+  for (const ELFSymbolRef &Symbol : Object->symbols())
+    SymbolNames.emplace_back(mayContainFileName(Symbol), symbolName(Symbol));
+  for (const SectionRef &Section : Object->sections())
+    SectionNames.emplace_back(true, sectionName(Section));
+  RenameMap SymbolRenames, SectionRenames;
+  normalizeNames(SymbolNames, SourceFile, SymbolRenames);
+  normalizeNames(SectionNames, SourceFile, SectionRenames);
+
+  auto SectionOf = [&](const SymbolRef &Symbol) -> std::string {
+    section_iterator Section = consume(Symbol.getSection(), Object->section_end());
+    if (Section == Object->section_end())
+      return "";
+    return renamed(SectionRenames, sectionName(*Section));
+  };
+
+  Hash H;
+  H << (uint32_t)Object->getArch() << (uint32_t)Object->getEType();
+  for (const ELFSectionRef Section : Object->sections()) {
+    hashString(H, renamed(SectionRenames, sectionName(Section)));
+    H << (uint32_t)Section.getType() << (uint64_t)Section.getFlags()
+      << (uint64_t)Section.getAlignment() << (uint64_t)Section.getSize();
+    if (Section.getType() != ELF::SHT_NOBITS &&
+        Section.getType() != ELF::SHT_SYMTAB &&
+        Section.getType() != ELF::SHT_STRTAB &&
+        Section.getType() != ELF::SHT_REL && Section.getType() != ELF::SHT_RELA) {
+      // Contents that refer to names are hashed below
+      const StringRef Contents = sectionContents(Section);
+      H.processBytes(Contents.data(), Contents.size());
+    }
+    for (const ELFRelocationRef Relocation : Section.relocations()) {
+      H << (uint64_t)Relocation.getOffset() << (uint64_t)Relocation.getType()
+        << (int64_t)consume(Relocation.getAddend(), (int64_t)0);
+      symbol_iterator Symbol = Relocation.getSymbol();
+      if (Symbol != Object->symbol_end()) {
+        hashString(H, renamed(SymbolRenames, symbolName(*Symbol)));
+        hashString(H, SectionOf(*Symbol));
+      }
+    }
+  }
+  for (const ELFSymbolRef &Symbol : Object->symbols()) {
+    hashString(H, renamed(SymbolRenames, symbolName(Symbol)));
+    hashString(H, SectionOf(Symbol));
+    H << (uint8_t)Symbol.getELFType() << (uint8_t)Symbol.getBinding()
+      << (uint8_t)Symbol.getOther() << (uint64_t)Symbol.getSize()
+      << (uint64_t)consume(Symbol.getValue(), (uint64_t)0);
+  }
+  Result = H.getDigest().asString();
+  return true;
+}
+
+/// Recursively collects all object files below a directory
+static void listObjectFiles(const std::string &Directory,
+                            std::vector<std::string> &Result) {
+  DIR *D = opendir(Directory.c_str());
+  if (!D)
+    return;
+  while (struct dirent *Entry = readdir(D)) {
+    const std::string Name = Entry->d_name;
+    if (Name == "." || Name == "..")
+      continue;
+    const std::string Path = Directory + "/" + Name;
+    struct stat Stat;
+    if (stat(Path.c_str(), &Stat) != 0)
+      continue;
+    if (S_ISDIR(Stat.st_mode))
+      listObjectFiles(Path, Result);
+    else if (Name.size() > 2 && Name.compare(Name.size() - 2, 2, ".o") == 0)
+      Result.push_back(Path);
+  }
+  closedir(D);
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> Paths;
+  unsigned Jobs = 0;
+  bool WithPaths = false;
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    struct stat Stat;
+    if (Arg == "-j" && I + 1 < argc) {
+      Jobs = atoi(argv[++I]);
+    } else if (Arg[0] == '-') {
+      fprintf(stderr, "usage: %s [-j <jobs>] <object file or directory>...\n",
+              argv[0]);
+      return 1;
+    } else if (stat(Arg.c_str(), &Stat) == 0 && S_ISDIR(Stat.st_mode)) {
+      std::vector<std::string> Objects;
+      listObjectFiles(Arg, Objects);
+      std::sort(Objects.begin(), Objects.end());
+      Paths.insert(Paths.end(), Objects.begin(), Objects.end());
+      WithPaths = true;
+    } else {
+      Paths.push_back(Arg);
+    }
+  }
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [-j <jobs>] <object file or directory>...\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> Results(Paths.size()), Errors(Paths.size());
+  std::vector<char> Ok(Paths.size(), false);
+  std::atomic<size_t> Next(0);
+  auto Worker = [&]() {
+    for (size_t I = Next++; I < Paths.size(); I = Next++)
+      Ok[I] = hashObjectFile(Paths[I], Results[I], Errors[I]);
+  };
+  if (Jobs == 0)
+    Jobs = WithPaths ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+  Jobs = std::min<size_t>(Jobs, std::max<size_t>(Paths.size(), 1));
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < Jobs; ++I)
+    Threads.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+
+  int Status = 0;
+  for (size_t I = 0; I < Paths.size(); ++I) {
+    if (!Ok[I]) {
+      fprintf(stderr, "%s: %s\n", Paths[I].c_str(), Errors[I].c_str());
+      Status = 1;
+    } else if (WithPaths) {
+      printf("%s %s\n", Results[I].c_str(), Paths[I].c_str());
+    } else {
+      printf("%s\n", Results[I].c_str());
+    }
+  }
+  return Status;
+}
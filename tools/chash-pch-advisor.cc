@@ -0,0 +1,228 @@
+/*
+ * chash-pch-advisor: proposes a precompiled prefix header from the
+ * .info records of a project.
+ *
+ *   chash-pch-advisor [-v] [-C <source dir>] [-o <header>] [-n <min units>] [directory]
+ *
+ * Even a hit parses the translation unit, and the parse time is
+ * dominated by the headers. For every recorded translation unit, the
+ * leading #include lines of its source file are read (relative source
+ * files are found in the source directory, "." by default). Among all
+ * sequences of includes that start the sources of at least <min
+ * units> (2) translation units of the same language, the one with the
+ * largest estimated saving is written as prefix header (chash-prefix.h
+ * by default). A precompiled header is specific to its language, so C
+ * and C++ units do not share one.
+ *
+ * The parse time of a prefix is estimated as the shortest recorded
+ * parse time of the translation units that start with it, as none of
+ * them parses faster than its prefix. Building the precompiled header
+ * parses the prefix once, all translation units save it. Loading the
+ * precompiled header is not accounted for.
+ *
+ * The precompiled header is only used in place of the includes, if
+ * the headers have include guards.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "info-file.h"
+
+struct Prefix {
+  size_t Length = 0; // number of includes
+  long long MinParseTime = LLONG_MAX;
+  std::vector<const InfoRecord *> Units;
+
+  long long saving() const {
+    return (long long)(Units.size() - 1) * MinParseTime;
+  }
+};
+
+static std::string directoryOf(const std::string &Path) {
+  const size_t Slash = Path.rfind('/');
+  return Slash == std::string::npos ? "." : Path.substr(0, Slash);
+}
+
+/// An #include line in a canonical form: quoted includes that are
+/// found next to the source are named by their absolute path, so that
+/// they are the same header in every directory
+static std::string canonicalInclude(const std::string &Name,
+                                    const std::string &SourceDir) {
+  if (Name[0] == '"') {
+    char Buffer[PATH_MAX];
+    const std::string Path =
+        SourceDir + "/" + Name.substr(1, Name.size() - 2);
+    if (realpath(Path.c_str(), Buffer))
+      return "#include \"" + std::string(Buffer) + "\"";
+  }
+  return "#include " + Name;
+}
+
+/// The #include lines at the start of a source file, up to the first
+/// line that is neither an include, a comment, nor empty
+static std::vector<std::string> leadingIncludes(const std::string &Source) {
+  std::vector<std::string> Result;
+  std::ifstream File(Source);
+  std::string Line;
+  bool Comment = false;
+  while (std::getline(File, Line)) {
+    size_t Pos = 0;
+    // Skip comments and white space before the directive
+    for (;;) {
+      if (Comment) {
+        const size_t End = Line.find("*/", Pos);
+        if (End == std::string::npos) {
+          Pos = Line.size();
+          break;
+        }
+        Comment = false;
+        Pos = End + 2;
+      }
+      Pos = Line.find_first_not_of(" \t\r", Pos);
+      if (Pos == std::string::npos || Line.compare(Pos, 2, "//") == 0) {
+        Pos = Line.size();
+        break;
+      }
+      if (Line.compare(Pos, 2, "/*") != 0)
+        break;
+      Comment = true;
+      Pos += 2;
+    }
+    if (Pos == Line.size())
+      continue;
+    if (Line[Pos] != '#')
+      break;
+    Pos = Line.find_first_not_of(" \t", Pos + 1);
+    if (Pos == std::string::npos || Line.compare(Pos, 7, "include") != 0)
+      break;
+    Pos = Line.find_first_not_of(" \t", Pos + 7);
+    if (Pos == std::string::npos || (Line[Pos] != '"' && Line[Pos] != '<'))
+      break;
+    const size_t End = Line.find(Line[Pos] == '"' ? '"' : '>', Pos + 1);
+    if (End == std::string::npos)
+      break;
+    Result.push_back(canonicalInclude(Line.substr(Pos, End + 1 - Pos),
+                                      directoryOf(Source)));
+  }
+  return Result;
+}
+
+static bool isCxxSource(const std::string &Path) {
+  for (const char *Ext : {".cc", ".cpp", ".cxx", ".C"}) {
+    const std::string Suffix = Ext;
+    if (Path.size() > Suffix.size() &&
+        Path.compare(Path.size() - Suffix.size(), Suffix.size(), Suffix) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void usage(const char *Name) {
+  fprintf(stderr,
+          "usage: %s [-v] [-C <source dir>] [-o <header>] [-n <min units>] "
+          "[directory]\n",
+          Name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  bool Verbose = false;
+  std::string SourceDir = ".", Header = "chash-prefix.h", Directory = ".";
+  size_t MinUnits = 2;
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    if (Arg == "-v")
+      Verbose = true;
+    else if (Arg == "-C" && I + 1 < argc)
+      SourceDir = argv[++I];
+    else if (Arg == "-o" && I + 1 < argc)
+      Header = argv[++I];
+    else if (Arg == "-n" && I + 1 < argc)
+      MinUnits = std::max(2, atoi(argv[++I]));
+    else if (Arg[0] == '-')
+      usage(argv[0]);
+    else
+      Directory = Arg;
+  }
+
+  std::vector<std::string> Paths;
+  listInfoFiles(Directory, Paths);
+  std::vector<InfoRecord> Records;
+  std::vector<std::string> Errors;
+  readInfoFiles(Paths, 0, Records, Errors);
+  for (const std::string &Error : Errors)
+    fprintf(stderr, "%s\n", Error.c_str());
+
+  // Every prefix of the include sequences, keyed by the language (C++)
+  // and its lines
+  std::map<std::pair<bool, std::string>, Prefix> Prefixes;
+  size_t Units = 0;
+  for (const InfoRecord &Record : Records) {
+    if (Record.SourceFile.empty() || Record.ParseTime < 0)
+      continue;
+    const std::string Source = Record.SourceFile[0] == '/'
+                                   ? Record.SourceFile
+                                   : SourceDir + "/" + Record.SourceFile;
+    ++Units;
+    const std::vector<std::string> Includes = leadingIncludes(Source);
+    const bool Cxx = isCxxSource(Record.SourceFile);
+    std::string Key;
+    for (size_t I = 0; I < Includes.size(); ++I) {
+      Key += Includes[I] + "\n";
+      Prefix &P = Prefixes[std::make_pair(Cxx, Key)];
+      P.Length = I + 1;
+      P.MinParseTime = std::min(P.MinParseTime, Record.ParseTime);
+      P.Units.push_back(&Record);
+    }
+  }
+
+  // The largest saving; the longer prefix on a tie
+  const std::pair<const std::pair<bool, std::string>, Prefix> *Best = nullptr;
+  for (const auto &Entry : Prefixes) {
+    const Prefix &P = Entry.second;
+    if (P.Units.size() < MinUnits)
+      continue;
+    if (!Best || P.saving() > Best->second.saving() ||
+        (P.saving() == Best->second.saving() && P.Length > Best->second.Length))
+      Best = &Entry;
+  }
+  if (!Best) {
+    printf("no common prefix of includes in %zu translation units\n", Units);
+    return 1;
+  }
+
+  const Prefix &P = Best->second;
+  const bool Cxx = Best->first.first;
+  std::ofstream Out(Header);
+  Out << "/* Prefix header of " << P.Units.size()
+      << " translation units, generated by chash-pch-advisor */\n"
+      << Best->first.second;
+  if (!Out.good()) {
+    perror(Header.c_str());
+    return 1;
+  }
+  Out.close();
+
+  char Buffer[PATH_MAX];
+  const std::string Path = realpath(Header.c_str(), Buffer) ? Buffer : Header;
+  printf("prefix header: %s (%zu includes)\n", Header.c_str(), P.Length);
+  printf("translation units: %zu of %zu\n", P.Units.size(), Units);
+  printf("estimated saving: %.3f s per build\n", P.saving() / 1e9);
+  printf("build: clang $CFLAGS -x %s %s -o %s.pch\n",
+         Cxx ? "c++-header" : "c-header", Path.c_str(),
+         Path.c_str());
+  printf("flags: -include-pch %s.pch\n", Path.c_str());
+  if (Verbose) {
+    for (const InfoRecord *Record : P.Units)
+      printf("unit: %s\n", Record->SourceFile.c_str());
+  }
+  return 0;
+}
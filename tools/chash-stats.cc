@@ -0,0 +1,200 @@
+/*
+ * chash-stats: report on the statistics log of the plugins
+ * (CLANG_HASH_STATS, see common/stats-log.h).
+ *
+ *   chash-stats [-f <log>] [-s <seconds>] [-g dir|tu|hour|day|reason] [-n <rows>]
+ *
+ * Like `ccache -s`, the summary counts hits and misses, but it also
+ * accounts for the time: a hit saves the compile time of the miss
+ * that stored the object, minus its own parse and hash time; a miss
+ * costs the hash time. With -g, the events are grouped by directory
+ * of the object file, by object file, by hour or day, or by the miss
+ * reason. Only the events of the last <seconds> are counted with -s.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "stats-log.h"
+
+struct Totals {
+  uint64_t Hits = 0;
+  uint64_t Misses = 0;
+  uint64_t Saved = 0;    // ns
+  uint64_t Overhead = 0; // ns
+  uint64_t HitBytes = 0;
+
+  void add(const StatsRecord &Record) {
+    if (Record.m_event == 'H') {
+      ++Hits;
+      HitBytes += Record.m_object_size;
+      // A hit still parses and hashes the source
+      if (Record.m_saved_time > Record.m_compile_time)
+        Saved += Record.m_saved_time - Record.m_compile_time;
+      else
+        Overhead += Record.m_compile_time - Record.m_saved_time;
+    } else {
+      ++Misses;
+      Overhead += Record.m_hash_time;
+    }
+  }
+
+  long long net() const { return (long long)Saved - (long long)Overhead; }
+};
+
+static std::string formatTime(long long Nanoseconds) {
+  const char *Sign = Nanoseconds < 0 ? "-" : "";
+  const double Seconds = std::abs(Nanoseconds) / 1e9;
+  char Buffer[64];
+  if (Seconds < 60)
+    snprintf(Buffer, sizeof(Buffer), "%s%.2f s", Sign, Seconds);
+  else if (Seconds < 3600)
+    snprintf(Buffer, sizeof(Buffer), "%s%dm %02ds", Sign, (int)Seconds / 60,
+             (int)Seconds % 60);
+  else
+    snprintf(Buffer, sizeof(Buffer), "%s%dh %02dm", Sign, (int)Seconds / 3600,
+             (int)Seconds / 60 % 60);
+  return Buffer;
+}
+
+static std::string formatRate(uint64_t Hits, uint64_t Total) {
+  char Buffer[32];
+  snprintf(Buffer, sizeof(Buffer), "%.1f %%", Total ? 100.0 * Hits / Total : 0.0);
+  return Buffer;
+}
+
+static std::string timeWindow(uint64_t Time, bool Day) {
+  const time_t Seconds = Time / 1000000000;
+  struct tm Local;
+  localtime_r(&Seconds, &Local);
+  char Buffer[32];
+  strftime(Buffer, sizeof(Buffer), Day ? "%Y-%m-%d" : "%Y-%m-%d %H:00", &Local);
+  return Buffer;
+}
+
+/// The groups of an event: one per reason for -g reason
+static std::vector<std::string> groupKeys(const StatsRecord &Record,
+                                          const std::string &Group) {
+  if (Group == "dir")
+    return {Record.m_objectfile.substr(0, Record.m_objectfile.rfind('/') + 1)};
+  if (Group == "tu")
+    return {Record.m_objectfile};
+  if (Group == "hour" || Group == "day")
+    return {timeWindow(Record.m_time, Group == "day")};
+  // Reasons name the declaration or option, not the object
+  std::vector<std::string> Keys;
+  if (Record.m_event != 'M')
+    return Keys;
+  size_t Start = 0;
+  while (Start <= Record.m_reason.size()) {
+    size_t End = Record.m_reason.find('\n', Start);
+    if (End == std::string::npos)
+      End = Record.m_reason.size();
+    Keys.push_back(End > Start ? Record.m_reason.substr(Start, End - Start)
+                               : "unknown");
+    Start = End + 1;
+  }
+  return Keys;
+}
+
+static void usage(const char *Name) {
+  fprintf(stderr,
+          "usage: %s [-f <log>] [-s <seconds>] [-g dir|tu|hour|day|reason] "
+          "[-n <rows>]\n",
+          Name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  std::string Log = StatsRecord::log_filename();
+  std::string Group;
+  long long Since = 0;
+  size_t Rows = 20;
+  for (int I = 1; I < argc; ++I) {
+    const std::string Arg = argv[I];
+    if (Arg == "-f" && I + 1 < argc)
+      Log = argv[++I];
+    else if (Arg == "-s" && I + 1 < argc)
+      Since = atoll(argv[++I]);
+    else if (Arg == "-g" && I + 1 < argc)
+      Group = argv[++I];
+    else if (Arg == "-n" && I + 1 < argc)
+      Rows = atoi(argv[++I]);
+    else
+      usage(argv[0]);
+  }
+  if (Group != "" && Group != "dir" && Group != "tu" && Group != "hour" &&
+      Group != "day" && Group != "reason")
+    usage(argv[0]);
+  if (Log == "") {
+    fprintf(stderr, "%s: no log file (-f or CLANG_HASH_STATS)\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<StatsRecord> Records;
+  if (!StatsRecord::read_log(Log, Records)) {
+    perror(Log.c_str());
+    return 1;
+  }
+  const uint64_t Now = StatsRecord::now_ns();
+  const uint64_t Start = Since > 0 ? Now - Since * 1000000000ULL : 0;
+
+  Totals All;
+  std::map<std::string, Totals> Groups;
+  for (const StatsRecord &Record : Records) {
+    if (Record.m_time < Start)
+      continue;
+    All.add(Record);
+    if (Group != "") {
+      for (const std::string &Key : groupKeys(Record, Group))
+        Groups[Key].add(Record);
+    }
+  }
+
+  if (Group == "") {
+    const uint64_t Total = All.Hits + All.Misses;
+    printf("compilations                %10llu\n", (unsigned long long)Total);
+    printf("cache hits                  %10llu  %8s\n",
+           (unsigned long long)All.Hits, formatRate(All.Hits, Total).c_str());
+    printf("cache misses                %10llu  %8s\n",
+           (unsigned long long)All.Misses,
+           formatRate(All.Misses, Total).c_str());
+    printf("objects from cache          %10.1f MB\n", All.HitBytes / 1e6);
+    printf("time saved by hits          %13s\n", formatTime(All.Saved).c_str());
+    printf("hashing overhead            %13s\n",
+           formatTime(All.Overhead).c_str());
+    printf("net time saved              %13s\n", formatTime(All.net()).c_str());
+    return 0;
+  }
+
+  // Time windows in order, everything else by the most misses
+  std::vector<std::pair<std::string, Totals>> Sorted(Groups.begin(),
+                                                     Groups.end());
+  if (Group != "hour" && Group != "day") {
+    std::stable_sort(Sorted.begin(), Sorted.end(),
+                     [](const std::pair<std::string, Totals> &A,
+                        const std::pair<std::string, Totals> &B) {
+                       return A.second.Misses > B.second.Misses;
+                     });
+  } else if (Sorted.size() > Rows) {
+    Sorted.erase(Sorted.begin(), Sorted.end() - Rows);
+  }
+  if (Sorted.size() > Rows)
+    Sorted.resize(Rows);
+
+  printf("%8s %8s %8s %13s  %s\n", "hits", "misses", "rate", "net saved",
+         Group.c_str());
+  for (const auto &Entry : Sorted) {
+    const Totals &T = Entry.second;
+    printf("%8llu %8llu %8s %13s  %s\n", (unsigned long long)T.Hits,
+           (unsigned long long)T.Misses,
+           formatRate(T.Hits, T.Hits + T.Misses).c_str(),
+           formatTime(T.net()).c_str(), Entry.first.c_str());
+  }
+  return 0;
+}
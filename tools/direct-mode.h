@@ -0,0 +1,302 @@
+#ifndef __CHASH_TOOLS_DIRECT_MODE
+#define __CHASH_TOOLS_DIRECT_MODE
+
+/*
+ * Direct mode of chash-collect: a hit without starting the compiler.
+ *
+ * The manifest of a compiler invocation (compiler, arguments, working
+ * directory, relevant environment) records the files the translation
+ * unit read, with their size and a fingerprint of their contents, and
+ * the AST hash of the resulting cache entry. If all files are
+ * unchanged on the next invocation, the translation unit hashes the
+ * same, and the cached object can be used right away. The manifest
+ * also keeps what the compilation printed and its dependency file, as
+ * they are no longer produced by the compiler.
+ *
+ * Like ccache, direct mode cannot see headers that appear in an
+ * include directory that precedes the one of the recorded header.
+ * Translation units that use __DATE__, __TIME__ or __TIMESTAMP__ get
+ * no manifest.
+ *
+ * The token prefilter keys such a manifest by the preprocessed token
+ * stream of the translation unit instead (see hashPreprocessedTokens).
+ * It needs a preprocessor run, but no input list, and still avoids
+ * the parser and semantic analysis when a file was only touched or
+ * its layout changed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Hash.h"
+
+struct ManifestInput {
+  std::string Path;
+  unsigned long long Size = 0;
+  std::string Fingerprint;
+};
+
+/// Fingerprints a file via mmap. Returns false, if it cannot be read.
+/// With TimeMacros, it also tells whether the file mentions a time
+/// macro, whose expansion differs between compilations.
+inline bool fingerprintFile(const std::string &Path, ManifestInput &Input,
+                            bool *TimeMacros = nullptr) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return false;
+  struct stat Stat;
+  if (fstat(Fd, &Stat) != 0 || !S_ISREG(Stat.st_mode)) {
+    close(Fd);
+    return false;
+  }
+  Input.Path = Path;
+  Input.Size = Stat.st_size;
+  Hash H;
+  if (Stat.st_size > 0) {
+    void *Data = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    if (Data == MAP_FAILED) {
+      close(Fd);
+      return false;
+    }
+    H.processBytes(Data, Stat.st_size);
+    if (TimeMacros) {
+      *TimeMacros = memmem(Data, Stat.st_size, "__DATE__", 8) ||
+                    memmem(Data, Stat.st_size, "__TIME__", 8) ||
+                    memmem(Data, Stat.st_size, "__TIMESTAMP__", 13);
+    }
+    munmap(Data, Stat.st_size);
+  }
+  close(Fd);
+  Input.Fingerprint = H.getDigest().asString();
+  return true;
+}
+
+/// Runs Work(I) for all I < Count on a few threads
+template <typename Function>
+inline void parallelFor(size_t Count, Function Work) {
+  std::atomic<size_t> Next(0);
+  auto Worker = [&]() {
+    for (size_t I = Next++; I < Count; I = Next++)
+      Work(I);
+  };
+  const size_t Jobs = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), (Count + 15) / 16);
+  std::vector<std::thread> Threads;
+  for (size_t I = 1; I < Jobs; ++I)
+    Threads.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+}
+
+/// Whether the directive at Text[Pos] (after the #) is a line marker
+inline bool isLineMarker(const std::string &Text, size_t Pos) {
+  while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\t'))
+    ++Pos;
+  if (Pos < Text.size() && isdigit((unsigned char)Text[Pos]))
+    return true;
+  return Text.compare(Pos, 4, "line") == 0 && Pos + 4 < Text.size() &&
+         (Text[Pos + 4] == ' ' || Text[Pos + 4] == '\t');
+}
+
+/// The end of the string or character literal at Text[Pos]
+inline size_t literalEnd(const std::string &Text, size_t Pos) {
+  const char Quote = Text[Pos];
+  // Raw string literals: R"delim(...)delim", with an encoding prefix
+  size_t Prefix = Pos;
+  while (Prefix > 0 && (isalnum((unsigned char)Text[Prefix - 1]) ||
+                        Text[Prefix - 1] == '_'))
+    --Prefix;
+  const std::string Encoding = Text.substr(Prefix, Pos - Prefix);
+  if (Quote == '"' && (Encoding == "R" || Encoding == "u8R" ||
+                       Encoding == "uR" || Encoding == "UR" ||
+                       Encoding == "LR")) {
+    const size_t Open = Text.find('(', Pos);
+    if (Open != std::string::npos) {
+      const std::string Close =
+          ")" + Text.substr(Pos + 1, Open - Pos - 1) + "\"";
+      const size_t End = Text.find(Close, Open);
+      return End == std::string::npos ? Text.size() : End + Close.size();
+    }
+  }
+  size_t End = Pos + 1;
+  while (End < Text.size() && Text[End] != Quote && Text[End] != '\n')
+    End += Text[End] == '\\' ? 2 : 1;
+  return std::min(End + 1, Text.size());
+}
+
+/// Hashes the token stream of preprocessed source (the output of -E)
+/// without its locations: line markers are dropped, and whitespace
+/// between tokens only counts as a space or a line break, as the end
+/// of a #pragma matters. String and character literals are kept.
+inline void hashPreprocessedTokens(const std::string &Text, Hash &H) {
+  std::string Tokens;
+  Tokens.reserve(Text.size());
+  bool LineStart = true;
+  char Space = 0;
+  size_t Pos = 0;
+  while (Pos < Text.size()) {
+    const char C = Text[Pos];
+    if (C == '\n') {
+      Space = '\n';
+      LineStart = true;
+      ++Pos;
+      continue;
+    }
+    if (C == ' ' || C == '\t' || C == '\r' || C == '\v' || C == '\f') {
+      if (!Space)
+        Space = ' ';
+      ++Pos;
+      continue;
+    }
+    if (LineStart) {
+      LineStart = false;
+      if (C == '#' && isLineMarker(Text, Pos + 1)) {
+        Pos = std::min(Text.find('\n', Pos), Text.size());
+        continue;
+      }
+    }
+    if (Space && !Tokens.empty())
+      Tokens += Space;
+    Space = 0;
+    if (C == '"' || C == '\'') {
+      const size_t End = literalEnd(Text, Pos);
+      Tokens.append(Text, Pos, End - Pos);
+      Pos = End;
+    } else {
+      Tokens += C;
+      ++Pos;
+    }
+  }
+  H.processBytes(Tokens.data(), Tokens.size());
+}
+
+struct Manifest {
+  std::string Key;
+  std::string AstHash;
+  std::vector<ManifestInput> Inputs;
+  std::string Elements;    // element-hashes line of the plugin
+  std::string Diagnostics; // what the compiler printed
+  std::string DepFile;     // path of the dependency file, if any
+  std::string DepContents;
+
+  /// Fingerprints the files the translation unit read. Returns false,
+  /// if a file is unreadable or uses a time macro.
+  bool recordInputs(const std::vector<std::string> &Paths) {
+    Inputs.assign(Paths.size(), ManifestInput());
+    std::vector<char> Ok(Paths.size(), false), Time(Paths.size(), false);
+    parallelFor(Paths.size(), [&](size_t I) {
+      bool TimeMacros = false;
+      Ok[I] = fingerprintFile(Paths[I], Inputs[I], &TimeMacros);
+      Time[I] = TimeMacros;
+    });
+    for (size_t I = 0; I < Paths.size(); ++I) {
+      if (!Ok[I] || Time[I])
+        return false;
+    }
+    return true;
+  }
+
+  /// Whether all recorded files are unchanged. The sizes are checked
+  /// first, as they are cheap.
+  bool inputsUnchanged() const {
+    for (const ManifestInput &Input : Inputs) {
+      struct stat Stat;
+      if (stat(Input.Path.c_str(), &Stat) != 0 ||
+          (unsigned long long)Stat.st_size != Input.Size)
+        return false;
+    }
+    std::atomic<bool> Unchanged(true);
+    parallelFor(Inputs.size(), [&](size_t I) {
+      ManifestInput Current;
+      if (Unchanged &&
+          (!fingerprintFile(Inputs[I].Path, Current) ||
+           Current.Fingerprint != Inputs[I].Fingerprint))
+        Unchanged = false;
+    });
+    return Unchanged;
+  }
+
+  bool read(const std::string &Path) {
+    std::ifstream In(Path, std::ios::binary);
+    std::string Line;
+    if (!getline(In, Line) || Line != "chash-manifest 1")
+      return false;
+    while (getline(In, Line)) {
+      std::stringstream Fields(Line);
+      std::string Tag;
+      Fields >> Tag;
+      if (Tag == "key") {
+        Fields >> Key;
+      } else if (Tag == "ast-hash") {
+        Fields >> AstHash;
+      } else if (Tag == "input") {
+        ManifestInput Input;
+        Fields >> Input.Size >> Input.Fingerprint;
+        Fields.get();
+        getline(Fields, Input.Path);
+        Inputs.push_back(Input);
+      } else if (Tag == "elements" || Tag == "stderr" || Tag == "depfile") {
+        size_t Length = 0;
+        Fields >> Length;
+        if (Tag == "depfile") {
+          Fields.get();
+          getline(Fields, DepFile);
+        }
+        std::string &Text = Tag == "elements" ? Elements
+                            : Tag == "stderr" ? Diagnostics : DepContents;
+        Text.resize(Length);
+        if (Length && !In.read(&Text[0], Length))
+          return false;
+        In.get(); // newline
+      } else {
+        return false;
+      }
+    }
+    return Key != "" && AstHash != "";
+  }
+
+  bool write(const std::string &Path) const {
+    const std::string Temporary = Path + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream Out(Temporary, std::ios::binary);
+      Out << "chash-manifest 1\n";
+      Out << "key " << Key << "\n";
+      Out << "ast-hash " << AstHash << "\n";
+      for (const ManifestInput &Input : Inputs) {
+        Out << "input " << Input.Size << " " << Input.Fingerprint << " "
+            << Input.Path << "\n";
+      }
+      Out << "elements " << Elements.size() << "\n" << Elements << "\n";
+      Out << "stderr " << Diagnostics.size() << "\n" << Diagnostics << "\n";
+      if (DepFile != "") {
+        Out << "depfile " << DepContents.size() << " " << DepFile << "\n"
+            << DepContents << "\n";
+      }
+      if (!Out.good()) {
+        unlink(Temporary.c_str());
+        return false;
+      }
+    }
+    if (rename(Temporary.c_str(), Path.c_str()) != 0) {
+      unlink(Temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif
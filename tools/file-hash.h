@@ -0,0 +1,24 @@
+#ifndef __CHASH_TOOLS_FILE_HASH
+#define __CHASH_TOOLS_FILE_HASH
+
+#include <cstdio>
+#include <string>
+
+#include "Hash.h"
+
+/// Adds the contents of a file to the hash. Returns false, if the file
+/// cannot be read.
+inline bool hashFileContents(const std::string &Path, Hash &H) {
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F)
+    return false;
+  char Buffer[65536];
+  size_t Length;
+  while ((Length = fread(Buffer, 1, sizeof(Buffer), F)) > 0)
+    H.processBytes(Buffer, Length);
+  const bool Ok = !ferror(F);
+  fclose(F);
+  return Ok;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef __CHASH_TOOLS_INFO_FILE
+#define __CHASH_TOOLS_INFO_FILE
+
+/*
+ * Reader for the .info records written by the clang-hash-collect
+ * wrapper. Every line of an .info file is the repr() of a Python dict;
+ * the most recent record is the last line. We parse the subset of
+ * Python literals that repr() produces for these records: dicts,
+ * lists, tuples, strings, numbers, None, True, and False.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+struct PyValue {
+  enum Kind { None, Bool, Int, Float, String, List, Dict };
+
+  Kind K = None;
+  bool BoolValue = false;
+  long long IntValue = 0;
+  double FloatValue = 0;
+  std::string StringValue;
+  std::vector<PyValue> Items;                          // List, Tuple
+  std::vector<std::pair<PyValue, PyValue>> DictItems;  // Dict
+
+  bool isString() const { return K == String; }
+  bool isList() const { return K == List; }
+
+  const PyValue *get(const std::string &Key) const {
+    if (K != Dict)
+      return nullptr;
+    for (const auto &Item : DictItems) {
+      if (Item.first.K == String && Item.first.StringValue == Key)
+        return &Item.second;
+    }
+    return nullptr;
+  }
+};
+
+class PyLiteralParser {
+public:
+  PyLiteralParser(const std::string &Text) : Text(Text), Pos(0) {}
+
+  bool parse(PyValue &Result, std::string *Error = nullptr) {
+    bool Ok = parseValue(Result);
+    skipSpace();
+    if (Ok && Pos != Text.size())
+      Ok = fail("trailing characters");
+    if (!Ok && Error)
+      *Error = ErrorMessage + " at offset " + std::to_string(Pos);
+    return Ok;
+  }
+
+private:
+  const std::string &Text;
+  size_t Pos;
+  std::string ErrorMessage;
+
+  bool fail(const char *Message) {
+    ErrorMessage = Message;
+    return false;
+  }
+
+  void skipSpace() {
+    while (Pos < Text.size() && isspace((unsigned char)Text[Pos]))
+      ++Pos;
+  }
+
+  bool consume(char C) {
+    skipSpace();
+    if (Pos < Text.size() && Text[Pos] == C) {
+      ++Pos;
+      return true;
+    }
+    return false;
+  }
+
+  bool consumeWord(const char *Word) {
+    size_t Length = strlen(Word);
+    if (Text.compare(Pos, Length, Word) == 0) {
+      Pos += Length;
+      return true;
+    }
+    return false;
+  }
+
+  bool parseValue(PyValue &V) {
+    skipSpace();
+    if (Pos >= Text.size())
+      return fail("unexpected end of input");
+
+    const char C = Text[Pos];
+    if (C == '{')
+      return parseDict(V);
+    if (C == '[')
+      return parseSequence(V, '[', ']');
+    if (C == '(')
+      return parseSequence(V, '(', ')');
+    if (C == '\'' || C == '"')
+      return parseString(V);
+    if (C == 'u' && Pos + 1 < Text.size() &&
+        (Text[Pos + 1] == '\'' || Text[Pos + 1] == '"')) {
+      ++Pos; // Python 2 unicode literal
+      return parseString(V);
+    }
+    if (consumeWord("None")) {
+      V.K = PyValue::None;
+      return true;
+    }
+    if (consumeWord("True") || consumeWord("False")) {
+      V.K = PyValue::Bool;
+      V.BoolValue = Text[Pos - 4] == 'T';
+      return true;
+    }
+    return parseNumber(V);
+  }
+
+  bool parseDict(PyValue &V) {
+    V.K = PyValue::Dict;
+    consume('{');
+    while (!consume('}')) {
+      std::pair<PyValue, PyValue> Item;
+      if (!parseValue(Item.first))
+        return false;
+      if (!consume(':'))
+        return fail("expected ':'");
+      if (!parseValue(Item.second))
+        return false;
+      V.DictItems.push_back(std::move(Item));
+      if (!consume(',')) {
+        if (!consume('}'))
+          return fail("expected ',' or '}'");
+        break;
+      }
+    }
+    return true;
+  }
+
+  bool parseSequence(PyValue &V, char Open, char Close) {
+    V.K = PyValue::List;
+    consume(Open);
+    while (!consume(Close)) {
+      V.Items.emplace_back();
+      if (!parseValue(V.Items.back()))
+        return false;
+      if (!consume(',')) {
+        if (!consume(Close))
+          return fail("expected ',' or closing bracket");
+        break;
+      }
+    }
+    return true;
+  }
+
+  bool parseString(PyValue &V) {
+    V.K = PyValue::String;
+    const char Quote = Text[Pos++];
+    while (Pos < Text.size() && Text[Pos] != Quote) {
+      char C = Text[Pos++];
+      if (C == '\\' && Pos < Text.size()) {
+        C = Text[Pos++];
+        switch (C) {
+        case 'n': C = '\n'; break;
+        case 't': C = '\t'; break;
+        case 'r': C = '\r'; break;
+        case '0': C = '\0'; break;
+        case 'x':
+          if (Pos + 2 > Text.size())
+            return fail("truncated escape sequence");
+          C = (char)std::stoi(Text.substr(Pos, 2), nullptr, 16);
+          Pos += 2;
+          break;
+        default: break; // \\, \', \"
+        }
+      }
+      V.StringValue += C;
+    }
+    if (Pos >= Text.size())
+      return fail("unterminated string");
+    ++Pos;
+    return true;
+  }
+
+  bool parseNumber(PyValue &V) {
+    size_t Start = Pos;
+    bool IsFloat = false;
+    if (Pos < Text.size() && (Text[Pos] == '-' || Text[Pos] == '+'))
+      ++Pos;
+    while (Pos < Text.size()) {
+      const char C = Text[Pos];
+      if (isdigit((unsigned char)C)) {
+      } else if (C == '.' || C == 'e' || C == 'E' ||
+                 ((C == '-' || C == '+') && (Text[Pos - 1] == 'e' || Text[Pos - 1] == 'E'))) {
+        IsFloat = true;
+      } else {
+        break;
+      }
+      ++Pos;
+    }
+    // Python 2 long literals
+    if (Pos < Text.size() && Text[Pos] == 'L')
+      ++Pos;
+    if (Start == Pos || (Pos - Start == 1 && !isdigit((unsigned char)Text[Start])))
+      return fail("unexpected character");
+    const std::string Number = Text.substr(Start, Pos - Start);
+    if (IsFloat) {
+      V.K = PyValue::Float;
+      V.FloatValue = std::stod(Number);
+    } else {
+      V.K = PyValue::Int;
+      V.IntValue = std::stoll(Number);
+    }
+    return true;
+  }
+};
+
+/// The Python repr() of a string
+inline std::string pyRepr(const std::string &S) {
+  std::string Result = "'";
+  for (char C : S) {
+    switch (C) {
+    case '\\': Result += "\\\\"; break;
+    case '\'': Result += "\\'"; break;
+    case '\n': Result += "\\n"; break;
+    case '\t': Result += "\\t"; break;
+    case '\r': Result += "\\r"; break;
+    default:
+      if ((unsigned char)C < 0x20 || (unsigned char)C >= 0x7f) {
+        char Escape[5];
+        snprintf(Escape, sizeof(Escape), "\\x%02x", (unsigned char)C);
+        Result += Escape;
+      } else {
+        Result += C;
+      }
+    }
+  }
+  return Result + "'";
+}
+
+/// One entry of the element-hashes list: ("function:foo", "hash", [uses])
+struct InfoElement {
+  std::string Name;
+  std::string LocalHash;
+  bool HasUses = false;
+  std::vector<std::string> Uses;
+};
+
+struct InfoRecord {
+  std::string Path;
+  std::string ObjectFile;
+  std::string SourceFile;
+  std::string AstHash;
+  long long ParseTime = -1; // ns, -1 if unknown
+  std::vector<InfoElement> Elements;
+};
+
+/// Extracts the element-hashes of a parsed record
+inline bool readElements(const PyValue &Record, InfoRecord &Result) {
+  const PyValue *ObjectFile = Record.get("obj-file");
+  if (ObjectFile && ObjectFile->isString())
+    Result.ObjectFile = ObjectFile->StringValue;
+  const PyValue *SourceFile = Record.get("filename");
+  if (SourceFile && SourceFile->isString())
+    Result.SourceFile = SourceFile->StringValue;
+  const PyValue *AstHash = Record.get("ast-hash");
+  if (AstHash && AstHash->isString())
+    Result.AstHash = AstHash->StringValue;
+  const PyValue *ParseTime = Record.get("parse-duration");
+  if (ParseTime && ParseTime->K == PyValue::Int)
+    Result.ParseTime = ParseTime->IntValue;
+
+  const PyValue *Elements = Record.get("element-hashes");
+  if (!Elements || !Elements->isList())
+    return Elements == nullptr; // Records without hashes are empty
+  for (const PyValue &Element : Elements->Items) {
+    if (!Element.isList() || Element.Items.size() < 2 ||
+        !Element.Items[0].isString() || !Element.Items[1].isString())
+      return false;
+    InfoElement E;
+    E.Name = Element.Items[0].StringValue;
+    E.LocalHash = Element.Items[1].StringValue;
+    if (Element.Items.size() > 2 && Element.Items[2].isList()) {
+      E.HasUses = true;
+      for (const PyValue &Use : Element.Items[2].Items) {
+        if (Use.isString())
+          E.Uses.push_back(Use.StringValue);
+      }
+    }
+    Result.Elements.push_back(std::move(E));
+  }
+  return true;
+}
+
+/// Reads the most recent record of an .info file. Returns false, if
+/// the file cannot be read or the record is malformed.
+inline bool readInfoFile(const std::string &Path, InfoRecord &Result,
+                         std::string *Error = nullptr) {
+  std::ifstream File(Path);
+  if (!File.good()) {
+    if (Error)
+      *Error = "cannot open file";
+    return false;
+  }
+  std::string Line, LastLine;
+  while (std::getline(File, Line)) {
+    if (Line.find_first_not_of(" \t\r") != std::string::npos)
+      LastLine.swap(Line);
+  }
+  Result.Path = Path;
+  if (LastLine.empty())
+    return true;
+
+  PyValue Record;
+  if (!PyLiteralParser(LastLine).parse(Record, Error))
+    return false;
+  if (!readElements(Record, Result)) {
+    if (Error)
+      *Error = "malformed element-hashes";
+    return false;
+  }
+  return true;
+}
+
+/// Recursively collects all .info files below a directory (os.walk)
+inline void listInfoFiles(const std::string &Directory,
+                          std::vector<std::string> &Result) {
+  DIR *D = opendir(Directory.c_str());
+  if (!D)
+    return;
+  while (struct dirent *Entry = readdir(D)) {
+    const std::string Name = Entry->d_name;
+    if (Name == "." || Name == "..")
+      continue;
+    const std::string Path = Directory + "/" + Name;
+    struct stat Stat;
+    if (stat(Path.c_str(), &Stat) != 0)
+      continue;
+    if (S_ISDIR(Stat.st_mode)) {
+      listInfoFiles(Path, Result);
+    } else if (Name.size() > 5 && Name.compare(Name.size() - 5, 5, ".info") == 0) {
+      Result.push_back(Path);
+    }
+  }
+  closedir(D);
+}
+
+/// Reads the given .info files with a pool of Jobs threads. The
+/// records are stored in the order of the paths. Unreadable files
+/// result in empty records and an error message.
+inline void readInfoFiles(const std::vector<std::string> &Paths, unsigned Jobs,
+                          std::vector<InfoRecord> &Records,
+                          std::vector<std::string> &Errors) {
+  Records.assign(Paths.size(), InfoRecord());
+  std::vector<std::string> FileErrors(Paths.size());
+  std::atomic<size_t> Next(0);
+  auto Worker = [&]() {
+    for (size_t I = Next++; I < Paths.size(); I = Next++) {
+      if (!readInfoFile(Paths[I], Records[I], &FileErrors[I])) {
+        Records[I] = InfoRecord();
+        if (FileErrors[I].empty())
+          FileErrors[I] = "unknown error";
+      }
+    }
+  };
+
+  if (Jobs == 0)
+    Jobs = std::max(1u, std::thread::hardware_concurrency());
+  Jobs = std::min<size_t>(Jobs, std::max<size_t>(Paths.size(), 1));
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < Jobs; ++I)
+    Threads.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+
+  for (size_t I = 0; I < Paths.size(); ++I) {
+    if (!FileErrors[I].empty())
+      Errors.push_back(Paths[I] + ": " + FileErrors[I]);
+  }
+}
+
+#endif
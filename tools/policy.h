@@ -0,0 +1,174 @@
+#ifndef __CHASH_TOOLS_POLICY
+#define __CHASH_TOOLS_POLICY
+
+/*
+ * Adaptive policy of chash-collect: translation units whose AST hash
+ * does not pay off are compiled without the plugin.
+ *
+ *   CLANG_HASH_POLICY   the history file, shared by all compilations
+ *
+ * For every object file (and working directory), the history keeps
+ * the hit rate, the parse and hash time of the plugin, and the time
+ * of a compilation without it, as moving averages. A hit saves the
+ * compilation minus parsing and hashing, a miss costs the hashing. If
+ * the expected saving of the next compilation is negative, the plugin
+ * is left out. After a number of such compilations, the plugin runs
+ * again to find out whether the translation unit started to hit.
+ *
+ * The history is a fixed-size hash table in a memory-mapped file, so
+ * that the decision costs an open and a few memory accesses. Slots
+ * are claimed with an atomic compare-and-swap; concurrent updates of
+ * the same entry may lose one of them, which only delays the policy.
+ */
+
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Hash.h"
+
+/// Compilations with the plugin before the policy decides
+static const uint32_t PolicyWarmup = 4;
+/// Compilations without the plugin before it is tried again
+static const uint32_t PolicyReprobe = 16;
+
+struct PolicyEntry {
+  uint64_t Key;      // 0: free slot
+  uint32_t Runs;     // compilations with the plugin
+  uint32_t Skips;    // compilations without it since the last probe
+  uint32_t HitRate;  // fixed point, 1 << 16 is 100%
+  uint32_t Reserved;
+  uint64_t ParseNs;
+  uint64_t HashNs;
+  uint64_t CompileNs; // compilation without the plugin
+};
+
+struct PolicyHeader {
+  uint64_t Magic;
+  uint64_t Capacity;
+};
+
+class PolicyTable {
+  static const uint64_t Magic = 0x3159434c4f504843ULL; // "CHPOLCY1"
+  static const uint64_t Capacity = 1 << 16;
+  static const unsigned Probes = 16;
+
+  void *Data = MAP_FAILED;
+  size_t Size = 0;
+
+  PolicyHeader *header() { return static_cast<PolicyHeader *>(Data); }
+  PolicyEntry *entries() { return reinterpret_cast<PolicyEntry *>(header() + 1); }
+
+public:
+  PolicyTable() = default;
+  PolicyTable(const PolicyTable &) = delete;
+  PolicyTable &operator=(const PolicyTable &) = delete;
+  ~PolicyTable() {
+    if (Data != MAP_FAILED)
+      munmap(Data, Size);
+  }
+
+  /// Maps the history file, which is created if necessary. Returns
+  /// false, if it cannot be used.
+  bool open(const std::string &Path) {
+    int Fd = ::open(Path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (Fd < 0)
+      return false;
+    const size_t Expected = sizeof(PolicyHeader) + Capacity * sizeof(PolicyEntry);
+    struct stat Stat;
+    // A new file is extended sparsely; all compilations agree on the size
+    if (fstat(Fd, &Stat) != 0 ||
+        ((size_t)Stat.st_size != Expected && (Stat.st_size != 0 ||
+                                              ftruncate(Fd, Expected) != 0))) {
+      close(Fd);
+      return false;
+    }
+    Data = mmap(nullptr, Expected, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    close(Fd);
+    if (Data == MAP_FAILED)
+      return false;
+    Size = Expected;
+    // The first compilation initializes the header
+    __sync_bool_compare_and_swap(&header()->Magic, 0, Magic);
+    __sync_bool_compare_and_swap(&header()->Capacity, 0, Capacity);
+    if (header()->Magic != Magic || header()->Capacity != Capacity) {
+      munmap(Data, Size);
+      Data = MAP_FAILED;
+      return false;
+    }
+    return true;
+  }
+
+  /// The entry of a key, which is claimed if it is new. Returns
+  /// nullptr, if the neighbourhood of the key is full.
+  PolicyEntry *lookup(uint64_t Key) {
+    if (Data == MAP_FAILED)
+      return nullptr;
+    if (Key == 0)
+      Key = 1;
+    for (unsigned I = 0; I < Probes; ++I) {
+      PolicyEntry &E = entries()[(Key + I) % Capacity];
+      // Another compilation may claim the slot for the same key
+      if (E.Key == 0)
+        __sync_bool_compare_and_swap(&E.Key, 0, Key);
+      if (E.Key == Key)
+        return &E;
+    }
+    return nullptr;
+  }
+};
+
+/// The key of a translation unit: its object file in the working
+/// directory
+inline uint64_t policyKey(const std::string &ObjectFile) {
+  Hash H;
+  H << std::string("chash-policy 1");
+  char Cwd[4096];
+  if (ObjectFile[0] != '/' && getcwd(Cwd, sizeof(Cwd)))
+    H << std::string(Cwd) << (uint8_t)0;
+  H << ObjectFile;
+  const Hash::Digest D = H.getDigest();
+  return (uint64_t)D.Value[0] << 32 | D.Value[1];
+}
+
+/// Whether the next compilation should leave out the plugin
+inline bool policyBypass(const PolicyEntry &E) {
+  // Without a miss, the time of a compilation is unknown
+  if (E.Runs < PolicyWarmup || E.Skips >= PolicyReprobe || E.CompileNs == 0)
+    return false;
+  const double HitRate = E.HitRate / 65536.0;
+  const double Parse = E.ParseNs, Hashing = E.HashNs, Compile = E.CompileNs;
+  return HitRate * (Compile - Parse - Hashing) - (1 - HitRate) * Hashing < 0;
+}
+
+/// Moves an average a quarter towards a sample
+inline uint64_t policyAverage(uint64_t Average, uint64_t Sample, bool First) {
+  return First ? Sample : Average - Average / 4 + Sample / 4;
+}
+
+/// Records a compilation with the plugin. Times of 0 are unknown, e.g.
+/// for hits without the compiler.
+inline void policyRecord(PolicyEntry &E, bool Hit, uint64_t ParseNs,
+                         uint64_t HashNs, uint64_t CompileNs) {
+  const bool First = E.Runs == 0;
+  E.HitRate = policyAverage(E.HitRate, Hit ? 1 << 16 : 0, First);
+  if (ParseNs)
+    E.ParseNs = policyAverage(E.ParseNs, ParseNs, E.ParseNs == 0);
+  if (HashNs)
+    E.HashNs = policyAverage(E.HashNs, HashNs, E.HashNs == 0);
+  if (CompileNs)
+    E.CompileNs = policyAverage(E.CompileNs, CompileNs, E.CompileNs == 0);
+  E.Runs++;
+  E.Skips = 0;
+}
+
+/// Records a compilation without the plugin
+inline void policySkipped(PolicyEntry &E, uint64_t CompileNs) {
+  E.CompileNs = policyAverage(E.CompileNs, CompileNs, E.CompileNs == 0);
+  E.Skips++;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef __CHASH_TOOLS_PROCESS
+#define __CHASH_TOOLS_PROCESS
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+/// Writes the whole buffer, unless the file descriptor fails
+inline bool writeAll(int Fd, const char *Buffer, size_t Length) {
+  while (Length > 0) {
+    const ssize_t N = write(Fd, Buffer, Length);
+    if (N < 0 && errno != EINTR)
+      return false;
+    if (N > 0) {
+      Buffer += N;
+      Length -= N;
+    }
+  }
+  return true;
+}
+
+/// Runs a program (searched in PATH) with the given arguments, with
+/// inherited stdin, stdout, and stderr. Returns the exit status, 128+n
+/// for a program killed by signal n, and 127 if the program could not
+/// be started.
+///
+/// If Stderr is given, the standard error of the program is passed
+/// through as it arrives and additionally collected in Stderr.
+inline int runProcess(const std::vector<std::string> &Args,
+                      std::string *Stderr = nullptr) {
+  std::vector<char *> Argv;
+  for (const std::string &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  int Pipe[2] = {-1, -1};
+  if (Stderr && pipe(Pipe) != 0) {
+    perror("pipe");
+    return 127;
+  }
+
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    perror("fork");
+    return 127;
+  }
+  if (Pid == 0) {
+    if (Stderr) {
+      dup2(Pipe[1], STDERR_FILENO);
+      close(Pipe[0]);
+      close(Pipe[1]);
+    }
+    execvp(Argv[0], Argv.data());
+    perror(Argv[0]);
+    _exit(127);
+  }
+
+  if (Stderr) {
+    close(Pipe[1]);
+    char Buffer[4096];
+    ssize_t Length;
+    while ((Length = read(Pipe[0], Buffer, sizeof(Buffer))) != 0) {
+      if (Length < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      writeAll(STDERR_FILENO, Buffer, Length);
+      Stderr->append(Buffer, Length);
+    }
+    close(Pipe[0]);
+  }
+
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR)
+      return 127;
+  }
+  if (WIFSIGNALED(Status))
+    return 128 + WTERMSIG(Status);
+  return WEXITSTATUS(Status);
+}
+
+/// Runs a program like runProcess, but collects its standard output
+/// in Stdout and discards its standard error.
+inline int runProcessOutput(const std::vector<std::string> &Args,
+                            std::string &Stdout) {
+  std::vector<char *> Argv;
+  for (const std::string &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  int Pipe[2] = {-1, -1};
+  if (pipe(Pipe) != 0) {
+    perror("pipe");
+    return 127;
+  }
+
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    perror("fork");
+    return 127;
+  }
+  if (Pid == 0) {
+    dup2(Pipe[1], STDOUT_FILENO);
+    close(Pipe[0]);
+    close(Pipe[1]);
+    int Null = open("/dev/null", O_WRONLY);
+    if (Null >= 0)
+      dup2(Null, STDERR_FILENO);
+    execvp(Argv[0], Argv.data());
+    _exit(127);
+  }
+
+  close(Pipe[1]);
+  char Buffer[65536];
+  ssize_t Length;
+  while ((Length = read(Pipe[0], Buffer, sizeof(Buffer))) != 0) {
+    if (Length < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    Stdout.append(Buffer, Length);
+  }
+  close(Pipe[0]);
+
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR)
+      return 127;
+  }
+  if (WIFSIGNALED(Status))
+    return 128 + WTERMSIG(Status);
+  return WEXITSTATUS(Status);
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef __CHASH_TOOLS_SYMBOL_GRAPH
+#define __CHASH_TOOLS_SYMBOL_GRAPH
+
+/*
+ * The def-use graph of all symbols in a project, as recorded in the
+ * element-hashes of the .info files.
+ *
+ * The global hash of a symbol covers its local hash and the global
+ * hashes of all definitions it uses (transitively). Cyclic uses
+ * (recursion, function pointer tables) are condensed into strongly
+ * connected components, which are hashed as a whole: the SCC hash
+ * covers the sorted (name, local hash) pairs of all members and the
+ * sorted hashes of all SCCs it uses. Therefore, the result does not
+ * depend on the order of the records or the traversal.
+ *
+ * Symbols without a local hash (library functions) are not part of the
+ * global hash.
+ */
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Hash.h"
+#include "info-file.h"
+
+class SymbolGraph {
+public:
+  typedef uint32_t SymbolId;
+  enum : SymbolId { InvalidId = ~0u };
+
+  /// Adds all elements of a record. Returns false and the name of the
+  /// symbol, if it was already defined with a different local hash.
+  bool addRecord(const InfoRecord &Record, std::string *Conflict = nullptr) {
+    for (const InfoElement &Element : Record.Elements) {
+      SymbolId Id = intern(Element.Name);
+      if (Defined[Id] && LocalHashes[Id] != Element.LocalHash) {
+        if (Conflict)
+          *Conflict = Element.Name;
+        return false;
+      }
+      Defined[Id] = true;
+      LocalHashes[Id] = Element.LocalHash;
+      if (Element.HasUses && hasUses(Element.Name)) {
+        std::vector<SymbolId> Edges;
+        for (const std::string &Use : Element.Uses)
+          Edges.push_back(intern(Use));
+        std::sort(Edges.begin(), Edges.end());
+        Edges.erase(std::unique(Edges.begin(), Edges.end()), Edges.end());
+        Uses[Id].swap(Edges);
+      }
+    }
+    return true;
+  }
+
+  size_t size() const { return Names.size(); }
+  const std::string &name(SymbolId Id) const { return Names[Id]; }
+  bool isDefined(SymbolId Id) const { return Defined[Id]; }
+  const std::string &localHash(SymbolId Id) const { return LocalHashes[Id]; }
+  const std::vector<SymbolId> &uses(SymbolId Id) const { return Uses[Id]; }
+
+  SymbolId lookup(const std::string &Name) const {
+    auto It = Ids.find(Name);
+    return It == Ids.end() ? InvalidId : It->second;
+  }
+
+  /// Finds a defined symbol by its name without prefix (main,
+  /// foo:file.c) or by its full name (function:main).
+  SymbolId find(const std::string &Symbol) const {
+    static const char *Prefixes[] = {"", "function:", "variable:",
+                                     "static function:", "static variable:"};
+    for (const char *Prefix : Prefixes) {
+      SymbolId Id = lookup(Prefix + Symbol);
+      if (Id != InvalidId && Defined[Id])
+        return Id;
+    }
+    return InvalidId;
+  }
+
+  /// Condenses the graph into its strongly connected components. The
+  /// components are numbered in reverse topological order: a component
+  /// only uses components with a smaller number.
+  void computeComponents() {
+    const SymbolId N = size();
+    Component.assign(N, InvalidId);
+    Components.clear();
+
+    // Iterative Tarjan, as deep call chains overflow the stack
+    std::vector<SymbolId> Index(N, InvalidId), LowLink(N, 0);
+    std::vector<bool> OnStack(N, false);
+    std::vector<SymbolId> Stack;
+    std::vector<std::pair<SymbolId, size_t>> CallStack;
+    SymbolId NextIndex = 0;
+
+    for (SymbolId Root = 0; Root < N; ++Root) {
+      if (Index[Root] != InvalidId)
+        continue;
+      CallStack.push_back(std::make_pair(Root, 0));
+      while (!CallStack.empty()) {
+        SymbolId V = CallStack.back().first;
+        size_t &Edge = CallStack.back().second;
+        if (Edge == 0 && Index[V] == InvalidId) {
+          Index[V] = LowLink[V] = NextIndex++;
+          Stack.push_back(V);
+          OnStack[V] = true;
+        }
+        if (Edge < Uses[V].size()) {
+          SymbolId W = Uses[V][Edge++];
+          if (Index[W] == InvalidId) {
+            CallStack.push_back(std::make_pair(W, 0));
+          } else if (OnStack[W]) {
+            LowLink[V] = std::min(LowLink[V], Index[W]);
+          }
+          continue;
+        }
+        CallStack.pop_back();
+        if (!CallStack.empty()) {
+          SymbolId Parent = CallStack.back().first;
+          LowLink[Parent] = std::min(LowLink[Parent], LowLink[V]);
+        }
+        if (LowLink[V] == Index[V]) {
+          const SymbolId C = Components.size();
+          Components.emplace_back();
+          SymbolId W;
+          do {
+            W = Stack.back();
+            Stack.pop_back();
+            OnStack[W] = false;
+            Component[W] = C;
+            Components.back().push_back(W);
+          } while (W != V);
+        }
+      }
+    }
+  }
+
+  SymbolId componentOf(SymbolId Id) const { return Component[Id]; }
+  const std::vector<std::vector<SymbolId>> &components() const {
+    return Components;
+  }
+
+  /// Calculates the hash of a single component. The hashes of all used
+  /// components must be known.
+  std::string hashComponent(SymbolId C) const {
+    std::vector<std::pair<std::string, std::string>> Members;
+    std::vector<std::string> Used;
+    for (SymbolId Member : Components[C]) {
+      if (!Defined[Member])
+        continue;
+      Members.push_back(std::make_pair(Names[Member], LocalHashes[Member]));
+      for (SymbolId W : Uses[Member]) {
+        const SymbolId UsedC = Component[W];
+        if (UsedC != C && !ComponentHashes[UsedC].empty())
+          Used.push_back(ComponentHashes[UsedC]);
+      }
+    }
+    std::sort(Members.begin(), Members.end());
+    std::sort(Used.begin(), Used.end());
+    Used.erase(std::unique(Used.begin(), Used.end()), Used.end());
+
+    Hash H;
+    H << (uint32_t)Members.size();
+    for (const auto &Member : Members)
+      H << Member.first << Member.second;
+    H << (uint32_t)Used.size();
+    for (const std::string &U : Used)
+      H << U;
+    return H.getDigest().asString();
+  }
+
+  /// The global hash of a symbol is derived from the hash of its
+  /// component, so that members of the same cycle differ.
+  std::string globalHash(SymbolId Id) const {
+    const std::string &ComponentHash = ComponentHashes[Component[Id]];
+    if (!Defined[Id] || ComponentHash.empty())
+      return "";
+    Hash H;
+    H << ComponentHash << Names[Id];
+    return H.getDigest().asString();
+  }
+
+  const std::string &componentHash(SymbolId Id) const {
+    return ComponentHashes[Component[Id]];
+  }
+
+  /// Calculates the hashes of all components. Undefined symbols get an
+  /// empty hash. Returns the number of hashed components.
+  ///
+  /// For an incremental update, Previous holds the last component hash
+  /// of every symbol (or an empty string) and Dirty marks the symbols
+  /// whose local hash, uses, or definition changed since then. A
+  /// component is only rehashed, if it contains a dirty symbol or uses
+  /// a component whose hash changed. All other components keep their
+  /// previous hash.
+  size_t computeGlobalHashes(const std::vector<std::string> *Previous = nullptr,
+                             const std::vector<bool> *Dirty = nullptr) {
+    computeComponents();
+    ComponentHashes.assign(Components.size(), std::string());
+    std::vector<bool> Changed(Components.size(), Previous == nullptr);
+    size_t Hashed = 0;
+
+    for (SymbolId C = 0; C < Components.size(); ++C) {
+      bool AnyDefined = false, Rehash = Previous == nullptr;
+      for (SymbolId Member : Components[C]) {
+        AnyDefined |= Defined[Member];
+        if (Previous && ((*Dirty)[Member] || (*Previous)[Member].empty()))
+          Rehash = true;
+        for (SymbolId W : Uses[Member])
+          Rehash |= Component[W] != C && Changed[Component[W]];
+      }
+      if (!AnyDefined) {
+        Changed[C] = Rehash;
+        continue;
+      }
+      if (!Rehash) {
+        ComponentHashes[C] = (*Previous)[Components[C].front()];
+        continue;
+      }
+      ComponentHashes[C] = hashComponent(C);
+      ++Hashed;
+      if (Previous)
+        Changed[C] = ComponentHashes[C] != (*Previous)[Components[C].front()];
+    }
+    return Hashed;
+  }
+
+protected:
+  std::vector<std::string> Names;
+  std::unordered_map<std::string, SymbolId> Ids;
+  std::vector<bool> Defined;
+  std::vector<std::string> LocalHashes;
+  std::vector<std::vector<SymbolId>> Uses;
+
+  std::vector<SymbolId> Component;
+  std::vector<std::vector<SymbolId>> Components;
+  std::vector<std::string> ComponentHashes;
+
+  /// Like read_info_files(): only functions and variables have uses
+  static bool hasUses(const std::string &Name) {
+    const std::string Prefix = Name.substr(0, Name.find(':'));
+    return Prefix == "function" || Prefix == "variable" ||
+           Prefix == "static function" || Prefix == "static variable";
+  }
+
+  SymbolId intern(const std::string &Name) {
+    auto It = Ids.find(Name);
+    if (It != Ids.end())
+      return It->second;
+    const SymbolId Id = Names.size();
+    Ids.emplace(Name, Id);
+    Names.push_back(Name);
+    Defined.push_back(false);
+    LocalHashes.emplace_back();
+    Uses.emplace_back();
+    return Id;
+  }
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef __CHASH_TOOLS_SYMBOL_STORE
+#define __CHASH_TOOLS_SYMBOL_STORE
+
+/*
+ * Persistent state for incremental global-hash updates. The store
+ * remembers the element-hashes of every .info file (with the mtime and
+ * size of the file) and the component and global hash of every symbol
+ * after the last update. On the next update, only .info files that
+ * changed are read again, and only the components that depend on a
+ * changed symbol are hashed again (see SymbolGraph).
+ *
+ * The store is a tab-separated text file:
+ *
+ *   chash-store 1
+ *   F <path> <mtime> <size>                       for every .info file
+ *   E <name> <local hash> <has uses> <use>...     elements of the file above
+ *   S <name> <component hash> <global hash>       for every defined symbol
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "info-file.h"
+
+struct StoredFile {
+  long long MTime = 0;
+  long long Size = 0;
+  InfoRecord Record;
+};
+
+struct StoredSymbol {
+  std::string ComponentHash;
+  std::string GlobalHash;
+};
+
+class SymbolStore {
+public:
+  static constexpr const char *Magic = "chash-store 1";
+
+  std::map<std::string, StoredFile> Files;
+  std::map<std::string, StoredSymbol> Symbols;
+
+  /// Loads the store. A missing file is an empty store.
+  bool load(const std::string &Path, std::string *Error = nullptr) {
+    Files.clear();
+    Symbols.clear();
+    std::ifstream In(Path);
+    if (!In.good())
+      return true;
+
+    std::string Line;
+    if (!std::getline(In, Line) || Line != Magic)
+      return fail(Error, "not a chash store");
+
+    StoredFile *Current = nullptr;
+    while (std::getline(In, Line)) {
+      std::vector<std::string> Fields = split(Line);
+      if (Fields.empty())
+        continue;
+      if (Fields[0] == "F" && Fields.size() == 4) {
+        Current = &Files[Fields[1]];
+        Current->Record.Path = Fields[1];
+        Current->MTime = std::stoll(Fields[2]);
+        Current->Size = std::stoll(Fields[3]);
+      } else if (Fields[0] == "E" && Fields.size() >= 4 && Current) {
+        InfoElement Element;
+        Element.Name = Fields[1];
+        Element.LocalHash = Fields[2];
+        Element.HasUses = Fields[3] == "1";
+        Element.Uses.assign(Fields.begin() + 4, Fields.end());
+        Current->Record.Elements.push_back(std::move(Element));
+      } else if (Fields[0] == "S" && Fields.size() == 4) {
+        StoredSymbol &Symbol = Symbols[Fields[1]];
+        Symbol.ComponentHash = Fields[2];
+        Symbol.GlobalHash = Fields[3];
+      } else {
+        return fail(Error, "malformed line: " + Line);
+      }
+    }
+    return true;
+  }
+
+  /// Writes the store atomically (temporary file and rename)
+  bool save(const std::string &Path, std::string *Error = nullptr) const {
+    const std::string Temporary = Path + ".tmp";
+    {
+      std::ofstream Out(Temporary);
+      if (!Out.good())
+        return fail(Error, "cannot write " + Temporary);
+      Out << Magic << "\n";
+      for (const auto &File : Files) {
+        Out << "F\t" << File.first << "\t" << File.second.MTime << "\t"
+            << File.second.Size << "\n";
+        for (const InfoElement &Element : File.second.Record.Elements) {
+          Out << "E\t" << Element.Name << "\t" << Element.LocalHash << "\t"
+              << (Element.HasUses ? "1" : "0");
+          for (const std::string &Use : Element.Uses)
+            Out << "\t" << Use;
+          Out << "\n";
+        }
+      }
+      for (const auto &Symbol : Symbols) {
+        Out << "S\t" << Symbol.first << "\t" << Symbol.second.ComponentHash
+            << "\t" << Symbol.second.GlobalHash << "\n";
+      }
+      if (!Out.good())
+        return fail(Error, "cannot write " + Temporary);
+    }
+    if (rename(Temporary.c_str(), Path.c_str()) != 0)
+      return fail(Error, "cannot rename " + Temporary);
+    return true;
+  }
+
+  static long long modificationTime(const struct stat &Stat) {
+    return Stat.st_mtim.tv_sec * 1000000000LL + Stat.st_mtim.tv_nsec;
+  }
+
+  /// Has the .info file changed since it was stored?
+  bool isUpToDate(const std::string &Path, const struct stat &Stat) const {
+    auto It = Files.find(Path);
+    return It != Files.end() && It->second.MTime == modificationTime(Stat) &&
+           It->second.Size == (long long)Stat.st_size;
+  }
+
+private:
+  static bool fail(std::string *Error, const std::string &Message) {
+    if (Error)
+      *Error = Message;
+    return false;
+  }
+
+  static std::vector<std::string> split(const std::string &Line) {
+    std::vector<std::string> Fields;
+    std::stringstream Stream(Line);
+    std::string Field;
+    while (std::getline(Stream, Field, '\t'))
+      Fields.push_back(Field);
+    return Fields;
+  }
+};
+
+#endif